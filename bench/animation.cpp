@@ -0,0 +1,181 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <new>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "ozz/animation/runtime/animation.h"
+#include "ozz/animation/runtime/blending_job.h"
+#include "ozz/animation/runtime/sampling_job.h"
+#include "ozz/animation/runtime/skeleton.h"
+#include "ozz/base/maths/soa_transform.h"
+#include "ozz/base/memory/allocator.h"
+
+#include "extern/aixlog/aixlog.h"
+
+#include "geometry/geom.h"
+#include "util/animation.h"
+
+// counts the heap allocations of Animator::update, an animator should not allocate once it is made
+// run it from the prototype directory so the clips of the native module are found
+
+static std::atomic<bool> counting(false);
+static std::atomic<uint64_t> allocations(0);
+
+void* operator new(size_t size)
+{
+	if (counting) { allocations++; }
+	void *block = std::malloc(size ? size : 1);
+	if (!block) { throw std::bad_alloc(); }
+
+	return block;
+}
+
+void operator delete(void *block) noexcept
+{
+	std::free(block);
+}
+
+void operator delete(void *block, size_t size) noexcept
+{
+	std::free(block);
+}
+
+// ozz allocates through its own allocator instead of new
+class CountingAllocator : public ozz::memory::Allocator {
+public:
+	ozz::memory::Allocator *fallback = nullptr;
+public:
+	void* Allocate(size_t size, size_t alignment) override
+	{
+		if (counting) { allocations++; }
+		return fallback->Allocate(size, alignment);
+	}
+	void Deallocate(void *block) override
+	{
+		fallback->Deallocate(block);
+	}
+};
+
+enum : uint32_t {
+	CLIP_IDLE,
+	CLIP_WALK,
+	CLIP_RUN,
+	CLIP_LEFT_STRAFE,
+	CLIP_RIGHT_STRAFE,
+	CLIP_FALLING
+};
+
+static const float FRAME_DELTA = 1.f / 60.f;
+static const uint32_t WARMUP_FRAMES = 1200; // long enough for every shared pose to be sampled once
+static const uint32_t MEASURED_FRAMES = 10000;
+static const float SHARED_POSE_RATE = 30.f; // same as the creatures
+
+struct bench_case_t {
+	std::string name;
+	util::animation_blend_t blend;
+	util::animation_lod_t lod;
+};
+
+static std::vector<bench_case_t> bench_cases();
+static uint64_t run_case(util::Animator &animator, const bench_case_t &bench, double &microseconds);
+
+int main(int argc, char *argv[])
+{
+	CountingAllocator allocator;
+	allocator.fallback = ozz::memory::SetDefaulAllocator(&allocator);
+
+	const std::vector<std::pair<uint32_t, std::string>> animations = {
+		std::make_pair(CLIP_IDLE, "modules/native/media/animations/human/idle.ozz"),
+		std::make_pair(CLIP_WALK, "modules/native/media/animations/human/walk.ozz"),
+		std::make_pair(CLIP_RUN, "modules/native/media/animations/human/run.ozz"),
+		std::make_pair(CLIP_LEFT_STRAFE, "modules/native/media/animations/human/left_strafe.ozz"),
+		std::make_pair(CLIP_RIGHT_STRAFE, "modules/native/media/animations/human/right_strafe.ozz"),
+		std::make_pair(CLIP_FALLING, "modules/native/media/animations/human/falling.ozz")
+	};
+	auto set = util::load_animation_set("modules/native/media/skeletons/human.ozz", animations);
+	if (set->skeleton.num_joints() == 0 || set->animations.size() != animations.size()) {
+		std::cerr << "animation bench: could not load the human clips, run it from the prototype directory\n";
+		return EXIT_FAILURE;
+	}
+
+	util::AnimationPoseCache poses(set, SHARED_POSE_RATE);
+
+	uint64_t total = 0;
+	for (const auto &bench : bench_cases()) {
+		util::Animator animator(set);
+		animator.set_pose_cache(&poses);
+		double microseconds = 0.0;
+		const uint64_t count = run_case(animator, bench, microseconds);
+		std::cout << bench.name << ": " << count << " allocations, " << microseconds << " us per update\n";
+		total += count;
+	}
+
+	return total == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+static std::vector<bench_case_t> bench_cases()
+{
+	std::vector<bench_case_t> cases;
+
+	bench_case_t single;
+	single.name = "single clip";
+	single.blend.add(CLIP_IDLE, 1.f);
+	cases.push_back(single);
+
+	bench_case_t mixed;
+	mixed.name = "three clips";
+	mixed.blend.add(CLIP_WALK, 0.5f);
+	mixed.blend.add(CLIP_RUN, 0.3f);
+	mixed.blend.add(CLIP_LEFT_STRAFE, 0.2f);
+	cases.push_back(mixed);
+
+	bench_case_t interpolated = mixed;
+	interpolated.name = "interpolated";
+	interpolated.lod.sample = false;
+	interpolated.lod.alpha = 0.5f;
+	cases.push_back(interpolated);
+
+	bench_case_t shared;
+	shared.name = "shared pose";
+	shared.blend.add(CLIP_RUN, 1.f);
+	shared.lod.shared = true;
+	cases.push_back(shared);
+
+	bench_case_t hidden = mixed;
+	hidden.name = "off screen";
+	hidden.lod.visible = false;
+	cases.push_back(hidden);
+
+	return cases;
+}
+
+static uint64_t run_case(util::Animator &animator, const bench_case_t &bench, double &microseconds)
+{
+	// the first samples fill the shared poses, that is the pose cache allocating and not the animator
+	for (uint32_t i = 0; i < WARMUP_FRAMES; i++) {
+		animator.update(FRAME_DELTA, bench.blend, bench.lod);
+	}
+
+	allocations = 0;
+	counting = true;
+	auto start = std::chrono::steady_clock::now();
+	for (uint32_t i = 0; i < MEASURED_FRAMES; i++) {
+		animator.update(FRAME_DELTA, bench.blend, bench.lod);
+	}
+	auto end = std::chrono::steady_clock::now();
+	counting = false;
+
+	microseconds = std::chrono::duration<double, std::micro>(end - start).count() / MEASURED_FRAMES;
+
+	return allocations;
+}
@@ -9,15 +9,21 @@ layout(location = 4) in vec4 weights;
 out vec3 normal;
 out vec2 texcoords;
 
-layout(binding = 20) uniform samplerBuffer joint_matrix_tbo;
+layout(binding = 10) uniform samplerBuffer TRANSFORMS; // for instanced rendering
+layout(binding = 20) uniform samplerBuffer joint_matrix_tbo; // skinning palette of every creature
 
+uniform bool INSTANCED;
 uniform mat4 VP;
 uniform mat4 MODEL;
-uniform bool RAGDOLL;
+uniform int JOINT_OFFSET; // first joint of the creature in the palette
+uniform int JOINT_STRIDE; // joints between two instances in the palette
+uniform int INSTANCE_OFFSET; // first model matrix of the instances in the transforms
+
+int joint_base;
 
 mat4 fetch_joint_matrix(int joint)
 {
-	int base_index = 4 * joint;
+	int base_index = 4 * (joint_base + joint);
 
 	mat4 matrix;
 	matrix[0] = texelFetch(joint_matrix_tbo, base_index);
@@ -31,6 +37,19 @@ mat4 fetch_joint_matrix(int joint)
 
 void main(void)
 {
+	mat4 model = MODEL;
+	joint_base = JOINT_OFFSET;
+	if (INSTANCED == true) {
+		int instance = INSTANCE_OFFSET + gl_InstanceID;
+		vec4 col[4];
+		col[0] = texelFetch(TRANSFORMS, instance * 4);
+		col[1] = texelFetch(TRANSFORMS, instance * 4 + 1);
+		col[2] = texelFetch(TRANSFORMS, instance * 4 + 2);
+		col[3] = texelFetch(TRANSFORMS, instance * 4 + 3);
+		model = mat4(col[0], col[1], col[2], col[3]);
+		joint_base += gl_InstanceID * JOINT_STRIDE;
+	}
+
 	mat4 skin = weights.x * fetch_joint_matrix(int(joints.x));
 	skin += weights.y * fetch_joint_matrix(int(joints.y));
 	skin += weights.z * fetch_joint_matrix(int(joints.z));
@@ -39,5 +58,5 @@ void main(void)
 	normal = vnormal;
 	texcoords = vtexcoords;
 		
-	gl_Position = VP * MODEL * skin * vec4(vposition, 1.0);
+	gl_Position = VP * model * skin * vec4(vposition, 1.0);
 }
@@ -1,4 +1,6 @@
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
@@ -9,6 +11,7 @@
 #include <list>
 #include <span>
 #include <array>
+#include <algorithm>
 
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
@@ -18,6 +21,7 @@
 #include <glm/vec4.hpp>
 #include <glm/mat4x4.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 // don't move this
 #include "extern/namegen/namegen.h"
@@ -35,6 +39,7 @@
 #include "extern/cereal/archives/binary.hpp"
 
 #include "extern/ozz/animation/runtime/animation.h"
+#include "extern/ozz/animation/runtime/blending_job.h"
 #include "extern/ozz/animation/runtime/local_to_model_job.h"
 #include "extern/ozz/animation/runtime/sampling_job.h"
 #include "extern/ozz/animation/runtime/skeleton.h"
@@ -59,19 +64,26 @@
 #include "geometry/geom.h"
 #include "geometry/voronoi.h"
 #include "util/image.h"
+#include "util/heightquery.h"
+#include "util/heightpyramid.h"
 #include "util/entity.h"
 #include "util/camera.h"
 #include "util/window.h"
 #include "util/input.h"
 #include "util/timer.h"
 #include "util/animation.h"
+#include "util/mappedfile.h"
+#include "util/navcache.h"
 #include "util/navigation.h"
+#include "util/flowfield.h"
+#include "util/spatialhash.h"
 #include "module/module.h"
 #include "graphics/text.h"
 #include "graphics/shader.h"
 #include "graphics/mesh.h"
 #include "graphics/texture.h"
 #include "graphics/model.h"
+#include "graphics/palette.h"
 #include "graphics/clouds.h"
 #include "graphics/sky.h"
 #include "graphics/render.h"
@@ -80,6 +92,9 @@
 #include "graphics/forest.h"
 #include "physics/heightfield.h"
 #include "physics/physics.h"
+#include "physics/ground.h"
+#include "physics/scenery.h"
+#include "physics/meshcache.h"
 #include "physics/bumper.h"
 #include "physics/ragdoll.h"
 #include "media.h"
@@ -88,20 +103,31 @@
 #include "debugger.h"
 #include "geography/sitegen.h"
 #include "geography/landscape.h"
+#include "geography/sitecache.h"
 #include "crowd.h"
+#include "formation.h"
 #include "army.h"
 #include "battle.h"
 
+static const float FORMATION_PROMOTE_DISTANCE = 150.f; // visible formations closer to the camera get individual creatures
+static const float FORMATION_OFFSCREEN_DISTANCE = 50.f; // same for formations outside the view
+static const float FORMATION_HYSTERESIS = 20.f; // stops formations on the edge from switching every frame
+static const float FORMATION_SPEED = 6.f; // same as the creatures
+static const float FORMATION_SEARCH_EXTENTS[3] = { 16.f, 64.f, 16.f };
+
+static const float SCENERY_CELL_SIZE = 64.f; // size of the cells that batch static collision
+static const uint32_t MAX_RAGDOLLS = 16; // ragdolls that can be active at the same time
+static const uint16_t HEIGHTMAP_RES = 2048;
+static const uint32_t SITE_CACHE_SIZE = 2; // battle sites generated ahead, each holds a full landscape
+
 static const geom::rectangle_t AGENT_NAV_AREA = {
 	{ 2560.F, 2560.F },
 	{ 3584.F, 3584.F }
 };
 
-static void heightmap_to_triangle_soup(const util::Image<float> *heightmap, float amp, std::vector<float> &vertices, std::vector<int> &indices, float x_offset, float y_offset, float scale);
-
 void Battle::init(const module::Module *mod, const util::Window *window, const shader_group_t *shaders)
 {
-	landscape = std::make_unique<geography::Landscape>(mod, 2048);
+	landscape = std::make_unique<geography::Landscape>(mod, HEIGHTMAP_RES);
 
 	terrain = std::make_unique<gfx::Terrain>(landscape->SCALE, landscape->get_heightmap(), landscape->get_normalmap(), landscape->get_sitemasks());
 
@@ -109,17 +135,22 @@ void Battle::init(const module::Module *mod, const util::Window *window, const s
 
 	ordinary = std::make_unique<gfx::RenderGroup>(&shaders->debug);
 	creature_scenery = std::make_unique<gfx::RenderGroup>(&shaders->creature);
+	palette = std::make_unique<gfx::SkinningPalette>();
+	palette->alloc();
+	creature_transforms.alloc(GL_DYNAMIC_DRAW);
+	aggregate_transforms.alloc(GL_DYNAMIC_DRAW);
+	scenery = std::make_unique<physics::StaticScenery>(SCENERY_CELL_SIZE);
 
 	skybox.init(window->width, window->height);
 	
 	forest = std::make_unique<gfx::Forest>(&shaders->tree, &shaders->billboard);
-	
-	central_heightmap.resize(128, 128, util::COLORSPACE_GRAYSCALE);
 }
 
 void Battle::load_assets(const module::Module *mod)
 {
 	landscape->load_buildings();
+
+	sites = std::make_unique<geography::SiteCache>(mod, HEIGHTMAP_RES, SITE_CACHE_SIZE);
 	
 	terrain->insert_material("STONEMAP", MediaManager::load_texture("ground/stone.dds"));
 	terrain->insert_material("REGOLITH_MAP", MediaManager::load_texture("ground/grass.dds"));
@@ -136,6 +167,9 @@ void Battle::add_entities(const module::Module *mod)
 	add_creatures(mod);
 
 	add_physics_bodies();
+
+	// static bodies are in the world now so the ground query knows where it can't use the heightmap
+	ground.build(physicsman.get_world(), landscape->get_heights(), physics::COLLISION_GROUP_HEIGHTMAP | physics::COLLISION_GROUP_WORLD);
 }
 	
 void Battle::add_creatures(const module::Module *mod)
@@ -147,7 +181,9 @@ void Battle::add_creatures(const module::Module *mod)
 		origin = result.point;
 		origin.y += 1.f;
 	}
-	player = new Creature { origin, glm::quat(1.f, 0.f, 0.f, 0.f), MediaManager::load_model("human.glb"), mod->test_armature };
+	ragdolls.create(mod->test_armature, MAX_RAGDOLLS);
+
+	player = new Creature { origin, glm::quat(1.f, 0.f, 0.f, 0.f), MediaManager::load_model("human.glb"), mod->test_armature, palette.get(), &ragdolls };
 
 	physicsman.add_body(player->get_body(), physics::COLLISION_GROUP_ACTOR, physics::COLLISION_GROUP_ACTOR | physics::COLLISION_GROUP_WORLD | physics::COLLISION_GROUP_HEIGHTMAP);
 
@@ -159,7 +195,18 @@ void Battle::add_creatures(const module::Module *mod)
 	//crowd_manager->add_agent(player->position, result.point, navigation.get_navquery());
 
 	glm::vec3 target_point = result.point;
+	crowd_goal = target_point;
 
+	creature_model = MediaManager::load_model("human.glb");
+	creature_armature = &mod->test_armature;
+	// a new range is identity matrices, nothing writes to it so the stand-ins keep the bind pose
+	aggregate_joints = palette->allocate(player->joint_count(false));
+
+	// four units of five by five soldiers, two on each side
+	for (int i = 0; i < 4; i++) {
+		formations.push_back(Formation(glm::vec2(0.f, 1.f)));
+		formations.back().team = i / 2;
+	}
 	for (int i = 0; i < 10; i++) {
 		for (int j = 0; j < 10; j++) {
 			glm::vec3 position = { 2700.f + (i+i), 0.f, 3000.f + (j+j) };
@@ -167,12 +214,19 @@ void Battle::add_creatures(const module::Module *mod)
 			result = physicsman.cast_ray(position, up, physics::COLLISION_GROUP_HEIGHTMAP | physics::COLLISION_GROUP_WORLD);
 			position = result.point;
 			position.y += 2.f;
-			auto creature = std::make_unique<Creature>(position, glm::quat(1.f, 0.f, 0.f, 0.f), MediaManager::load_model("human.glb"), mod->test_armature);
-			physicsman.add_body(creature->get_body(), physics::COLLISION_GROUP_ACTOR, physics::COLLISION_GROUP_ACTOR | physics::COLLISION_GROUP_WORLD | physics::COLLISION_GROUP_HEIGHTMAP);
-			//ents.push_back(creature.get());
-			crowd_manager->add_agent(position, target_point, navigation.get_navquery());
-			creatures.push_back(std::move(creature));
+			add_creature(position, glm::vec2(0.f, 1.f), (i / 5) * 2 + (j / 5));
+		}
+	}
+
+	// the formations start with the arrangement of their soldiers
+	for (uint32_t i = 0; i < formations.size(); i++) {
+		std::vector<glm::vec3> positions;
+		for (int j = 0; j < creatures.size(); j++) {
+			if (creature_formations[j] == i) {
+				positions.push_back(creatures[j]->position);
+			}
 		}
+		formations[i].gather(positions, std::vector<glm::vec3>(positions.size(), glm::vec3(0.f)));
 	}
 	
 	creature_scenery->add_object(MediaManager::load_model("human.glb"), ents);
@@ -186,23 +240,12 @@ void Battle::add_buildings()
 		for (const auto &house : group.buildings) {
 			std::vector<const Entity*> house_entities;
 			const gfx::Model *model = house.model;
-			// get collision shape
-			std::vector<glm::vec3> positions;
-			std::vector<uint16_t> indices;
-			uint16_t offset = 0;
-			for (const auto &mesh : model->collision_trimeshes) {
-				for (const auto &pos : mesh.positions) {
-					positions.push_back(pos);
-				}
-				for (const auto &index : mesh.indices) {
-					indices.push_back(index + offset);
-				}
-				offset = positions.size();
-			}
-			btCollisionShape *shape = physicsman.add_mesh(positions, indices);
+			// shapes are shared between battles and read the collision meshes of the model in place
+			btCollisionShape *shape = collision_shape(model);
 			// create entities
 			for (const auto &transform : house.transforms) {
-				StationaryObject *stationary = new StationaryObject { transform.position, transform.rotation, shape };
+				uint32_t instance = scenery->add(shape, transform.position, transform.rotation);
+				StationaryObject *stationary = new StationaryObject { transform.position, transform.rotation, instance };
 				stationaries.push_back(stationary);
 				house_entities.push_back(stationary);
 			}
@@ -214,27 +257,17 @@ void Battle::add_buildings()
 	
 void Battle::add_walls()
 {
-	const auto walls = landscape->get_walls();
-	for (const auto &wall : walls) {
+	const auto &walls = landscape->get_walls();
+	for (int i = 0; i < walls.size(); i++) {
+		const auto &wall = walls[i];
 		std::vector<const Entity*> wall_entities;
-		const auto model = MediaManager::load_model(wall.model);
-		// get collision shape
-		std::vector<glm::vec3> positions;
-		std::vector<uint16_t> indices;
-		uint16_t offset = 0;
-		for (const auto &mesh : model->collision_trimeshes) {
-			for (const auto &pos : mesh.positions) {
-				positions.push_back(pos);
-			}
-			for (const auto &index : mesh.indices) {
-				indices.push_back(index + offset);
-			}
-			offset = positions.size();
-		}
-		btCollisionShape *shape = physicsman.add_mesh(positions, indices);
+		const auto model = wall_models[i];
+		// shapes are shared between battles and read the collision meshes of the model in place
+		btCollisionShape *shape = collision_shape(model);
 		// create entities
 		for (const auto &transform : wall.transforms) {
-			StationaryObject *stationary = new StationaryObject { transform.position, transform.rotation, shape };
+			uint32_t instance = scenery->add(shape, transform.position, transform.rotation);
+			StationaryObject *stationary = new StationaryObject { transform.position, transform.rotation, instance };
 			stationaries.push_back(stationary);
 			wall_entities.push_back(stationary);
 		}
@@ -247,31 +280,21 @@ void Battle::add_trees()
 {
 	const auto trees = landscape->get_trees();
 
-	entities.clear();
-
-	for (const auto &tree : trees) {
-		const gfx::Model *trunk = MediaManager::load_model(tree.trunk);
-		const gfx::Model *leaves = MediaManager::load_model(tree.leaves);
-		const gfx::Model *billboard = MediaManager::load_model(tree.billboard);
-		// get collision shape
-		std::vector<glm::vec3> positions;
-		std::vector<uint16_t> indices;
-		uint16_t offset = 0;
-		for (const auto &mesh : trunk->collision_trimeshes) {
-			for (const auto &pos : mesh.positions) {
-				positions.push_back(pos);
-			}
-			for (const auto &index : mesh.indices) {
-				indices.push_back(index + offset);
-			}
-			offset = positions.size();
-		}
-		btCollisionShape *shape = physicsman.add_mesh(positions, indices);
-		auto start = entities.size();
-		for (const auto &transform : tree.transforms) {
+	tree_instances.resize(trees.size());
+
+	for (int i = 0; i < trees.size(); i++) {
+		const auto &tree = trees[i];
+		const gfx::Model *trunk = tree_models[i].trunk;
+		const gfx::Model *leaves = tree_models[i].leaves;
+		const gfx::Model *billboard = tree_models[i].billboard;
+		// shapes are shared between battles and read the collision meshes of the model in place
+		btCollisionShape *shape = collision_shape(trunk);
+		// trees outside the site have no collision
+		tree_instances[i].assign(tree.transforms.size(), physics::StaticScenery::INVALID_INSTANCE);
+		for (int j = 0; j < tree.transforms.size(); j++) {
+			const auto &transform = tree.transforms[j];
 			if (point_in_rectangle(glm::vec2(transform.position.x, transform.position.z), landscape->SITE_BOUNDS)) {
-				StationaryObject *stationary = new StationaryObject { transform.position, transform.rotation, shape };
-				tree_stationaries.push_back(stationary);
+				tree_instances[i][j] = scenery->add(shape, transform.position, transform.rotation);
 			}
 		}
 		std::vector<const geom::transformation_t*> transformations;
@@ -284,35 +307,31 @@ void Battle::add_trees()
 	forest->build_hierarchy();
 }
 
-void Battle::add_physics_bodies()
+void Battle::remove_tree(uint32_t model, uint32_t transform)
 {
-	for (const auto &stationary : tree_stationaries) {
-		physicsman.add_body(stationary->body, physics::COLLISION_GROUP_WORLD, physics::COLLISION_GROUP_ACTOR | physics::COLLISION_GROUP_RAY | physics::COLLISION_GROUP_RAGDOLL);
-	}
+	if (model >= tree_instances.size() || transform >= tree_instances[model].size()) { return; }
 
-	// add stationary objects to physics
-	for (const auto &stationary : stationaries) {
-		physicsman.add_body(stationary->body, physics::COLLISION_GROUP_WORLD, physics::COLLISION_GROUP_ACTOR | physics::COLLISION_GROUP_RAY | physics::COLLISION_GROUP_RAGDOLL);
-	}
+	scenery->remove(tree_instances[model][transform]);
+	tree_instances[model][transform] = physics::StaticScenery::INVALID_INSTANCE;
+}
+
+void Battle::add_physics_bodies()
+{
+	// add trees, houses and walls to physics
+	scenery->insert(physicsman.get_world(), physics::COLLISION_GROUP_WORLD, physics::COLLISION_GROUP_ACTOR | physics::COLLISION_GROUP_RAY | physics::COLLISION_GROUP_RAGDOLL);
 }
 
 void Battle::remove_physics_bodies()
 {
-	// remove stationary objects from physics
-	for (const auto &stationary : stationaries) {
-		physicsman.remove_body(stationary->body);
-	}
-	for (const auto &stationary : tree_stationaries) {
-		physicsman.remove_body(stationary->body);
-	}
+	// the scenery owns its collision objects so they have to be out of the world before it gets cleared
+	scenery->detach();
 
 	physicsman.remove_body(player->get_body());
 	for (auto &creature : creatures) {
 		physicsman.remove_body(creature->get_body());
+		creature->remove_ragdoll(physicsman.get_world());
 	}
-	if (player->m_ragdoll_mode) {
-		player->remove_ragdoll(physicsman.get_world());
-	}
+	player->remove_ragdoll(physicsman.get_world());
 }
 
 void Battle::cleanup()
@@ -323,7 +342,15 @@ void Battle::cleanup()
 
 	delete player;
 	creatures.clear();
-
+	creature_agents.clear();
+	creature_formations.clear();
+	formations.clear();
+	creature_hash.clear();
+	palette->clear();
+	aggregate_transforms.matrices.clear();
+	ragdolls.clear();
+
+	ground.clear();
 	physicsman.clear();
 	ordinary->clear();
 	creature_scenery->clear();
@@ -333,10 +360,10 @@ void Battle::cleanup()
 		delete stationaries[i];
 	}
 	stationaries.clear();
-	for (int i = 0; i < tree_stationaries.size(); i++) {
-		delete tree_stationaries[i];
-	}
-	tree_stationaries.clear();
+	scenery->clear();
+	tree_instances.clear();
+	wall_models.clear();
+	tree_models.clear();
 
 	forest->clear();
 }
@@ -346,17 +373,60 @@ void Battle::teardown()
 	skybox.teardown();
 
 	physicsman.clear();
+
+	collision_meshes.clear();
+
+	// waits for sites still being generated
+	sites.reset();
 }
 	
+void Battle::load_wall_models()
+{
+	wall_models.clear();
+	for (const auto &wall : landscape->get_walls()) {
+		wall_models.push_back(MediaManager::load_model(wall.model));
+	}
+}
+
+void Battle::load_tree_models()
+{
+	tree_models.clear();
+	for (const auto &tree : landscape->get_trees()) {
+		tree_models_t models;
+		models.trunk = MediaManager::load_model(tree.trunk);
+		models.leaves = MediaManager::load_model(tree.leaves);
+		models.billboard = MediaManager::load_model(tree.billboard);
+		tree_models.push_back(models);
+	}
+}
+
+void Battle::create_collision_shapes()
+{
+	// fills the cache so adding the scenery later only has to look the shapes up
+	for (const auto &group : landscape->get_houses()) {
+		for (const auto &house : group.buildings) {
+			collision_shape(house.model);
+		}
+	}
+	for (const auto &model : wall_models) {
+		collision_shape(model);
+	}
+	for (const auto &models : tree_models) {
+		collision_shape(models.trunk);
+	}
+}
+
 void Battle::create_navigation()
 {
 	std::vector<float> vertex_soup;
 	std::vector<int> index_soup;
 
 	// add static collision like buildings and walls
-	const auto walls = landscape->get_walls();
-	for (const auto &wall : walls) {
-		const auto model = MediaManager::load_model(wall.model);
+	// runs next to the main thread so it can't touch the media manager, the wall models are loaded before
+	const auto &walls = landscape->get_walls();
+	for (int i = 0; i < walls.size(); i++) {
+		const auto &wall = walls[i];
+		const auto model = wall_models[i];
 		for (const auto &transform : wall.transforms) {
 			glm::mat4 T = glm::translate(glm::mat4(1.f), transform.position);
 			glm::mat4 R = glm::mat4(transform.rotation);
@@ -404,54 +474,230 @@ void Battle::create_navigation()
 		}
 	}
 	
-	// add the heightmap
-	central_heightmap.clear();
-	const glm::vec2 downscale = { 
-		(AGENT_NAV_AREA.max.x - AGENT_NAV_AREA.min.x) / float(central_heightmap.width()),
-		(AGENT_NAV_AREA.max.y - AGENT_NAV_AREA.min.y) / float(central_heightmap.height())
-	};
-	for (int y = 0; y < central_heightmap.width(); y++) {
-		for (int x = 0; x < central_heightmap.height(); x++) {
-			glm::vec2 realspace = {
-				AGENT_NAV_AREA.min.x + downscale.x * x,
-				AGENT_NAV_AREA.min.y + downscale.y * y
-			};
-			float height = landscape->sample_heightmap(realspace) / landscape->SCALE.y;
-			central_heightmap.plot(x, y, util::CHANNEL_RED, height);
-		}
-	}
-
-	heightmap_to_triangle_soup(&central_heightmap, landscape->SCALE.y, vertex_soup, index_soup, AGENT_NAV_AREA.min.x, AGENT_NAV_AREA.min.y, (AGENT_NAV_AREA.max.x-AGENT_NAV_AREA.min.x)/float(central_heightmap.width()));
+	// the heightmap is rasterized directly into the navigation voxels
+	const util::Image<float> *heightmap = landscape->get_heightmap();
+	util::navigation_heightmap_t terrain;
+	terrain.image = heightmap;
+	terrain.spacing = landscape->SCALE.x / float(heightmap->width());
+	// texel centers like the physics heightfield and the height queries so the navmesh lies on the same ground
+	terrain.offset = glm::vec2(0.5f * terrain.spacing);
+	terrain.amplitude = landscape->SCALE.y;
+	terrain.area = AGENT_NAV_AREA;
 	
-	navigation.build(vertex_soup, index_soup);
+	navigation.build(vertex_soup, index_soup, &terrain);
 
 	crowd_manager = std::make_unique<CrowdManager>(navigation.get_navmesh());
+	flowfields = std::make_unique<util::FlowFieldCache>(navigation.get_navmesh(), navigation.get_navquery());
+}
+
+void Battle::update_creature_hash()
+{
+	// straight from the bulk crowd output, creatures without an agent use their own position
+	const auto &agent_positions = crowd_manager->positions();
+	creature_points.resize(creatures.size());
+
+	#pragma omp parallel for
+	for (int i = 0; i < creatures.size(); i++) {
+		util::spatial_point_t &point = creature_points[i];
+		const int32_t agent = creature_agents[i];
+		point.position = agent >= 0 ? agent_positions[agent] : creatures[i]->position;
+		point.id = i;
+		point.unit = creature_formations[i];
+		point.team = formations[creature_formations[i]].team;
+	}
+
+	creature_hash.build(creature_points);
 }
 
+int32_t Battle::nearest_enemy(uint32_t creature, float max_distance) const
+{
+	util::spatial_filter_t filter;
+	filter.teams = ~(1u << formations[creature_formations[creature]].team);
+
+	std::vector<uint32_t> results;
+	creature_hash.query_nearest(creatures[creature]->position, 1, max_distance, filter, results);
+
+	return results.empty() ? -1 : int32_t(results.front());
+}
+
+void Battle::update_formations(float delta, const glm::vec3 &eye, const glm::mat4 &viewproj)
+{
+	glm::vec4 planes[6];
+	geom::frustum_to_planes(viewproj, planes);
+
+	for (uint32_t i = 0; i < formations.size(); i++) {
+		const Formation &formation = formations[i];
+		const glm::vec3 centroid = formation.get_centroid();
+		const glm::vec3 extents = glm::vec3(formation.get_radius());
+		const bool visible = geom::AABB_in_frustum(centroid - extents, centroid + extents, planes);
+		const float distance = glm::distance(eye, centroid) - formation.get_radius();
+		// units behind the camera can come closer before they need their soldiers
+		const float promote = visible ? FORMATION_PROMOTE_DISTANCE : FORMATION_OFFSCREEN_DISTANCE;
+		if (formation.aggregated && distance < promote) {
+			promote_formation(i);
+		} else if (!formation.aggregated && distance > promote + FORMATION_HYSTERESIS) {
+			demote_formation(i);
+		}
+	}
+
+	// aggregated formations move over the same flow field as the creatures
+	const util::FlowField *field = flowfields->request(crowd_goal);
+	dtQueryFilter filter;
+	filter.setIncludeFlags(0xFFFF);
+	filter.setExcludeFlags(0);
+	for (auto &formation : formations) {
+		if (!formation.aggregated) { continue; }
+		const glm::vec3 centroid = formation.get_centroid();
+		dtPolyRef poly = 0;
+		float nearest[3];
+		dtStatus status = navigation.get_navquery()->findNearestPoly(glm::value_ptr(centroid), FORMATION_SEARCH_EXTENTS, &filter, &poly, nearest);
+		if (dtStatusFailed(status) || !poly || !field) {
+			formation.update(delta, glm::vec2(0.f), 0.f, centroid.y);
+			continue;
+		}
+		glm::vec3 direction = field->direction(poly, centroid);
+		formation.update(delta, glm::vec2(direction.x, direction.z), FORMATION_SPEED, nearest[1]);
+	}
+
+	// coarse collisions between the footprints of the aggregates
+	for (int i = 0; i < formations.size(); i++) {
+		for (int j = i + 1; j < formations.size(); j++) {
+			Formation &a = formations[i];
+			Formation &b = formations[j];
+			if (!a.aggregated || !b.aggregated) { continue; }
+			glm::vec2 offset = { b.get_centroid().x - a.get_centroid().x, b.get_centroid().z - a.get_centroid().z };
+			float distance = glm::length(offset);
+			float overlap = a.get_radius() + b.get_radius() - distance;
+			if (overlap > 0.f && distance > 0.001f) {
+				glm::vec2 push = (0.5f * overlap / distance) * offset;
+				a.push(-push);
+				b.push(push);
+			}
+		}
+	}
+
+	// aggregates are still drawn, a stand-in on every slot
+	aggregate_transforms.matrices.clear();
+	for (const auto &formation : formations) {
+		if (!formation.aggregated) { continue; }
+		const glm::vec2 facing = formation.get_facing();
+		const glm::mat4 R = glm::mat4(glm::angleAxis(atan2f(facing.x, facing.y), glm::vec3(0.f, 1.f, 0.f)));
+		for (uint32_t slot = 0; slot < formation.size(); slot++) {
+			// same height the soldiers get when the formation is promoted
+			const glm::vec3 position = formation.slot_position(slot) + glm::vec3(0.f, 1.f, 0.f);
+			aggregate_transforms.matrices.push_back(glm::translate(glm::mat4(1.f), position) * R);
+		}
+	}
+}
 
-// TODO replace with hmmm triangulator
-static void heightmap_to_triangle_soup(const util::Image<float> *heightmap, float amp, std::vector<float> &vertices, std::vector<int> &indices, float x_offset, float y_offset, float scale)
+void Battle::add_creature(const glm::vec3 &position, const glm::vec2 &facing, uint32_t formation)
 {
-	uint32_t index_offset = vertices.size() / 3;
+	auto creature = std::make_unique<Creature>(position, glm::angleAxis(atan2f(facing.x, facing.y), glm::vec3(0.f, 1.f, 0.f)), creature_model, *creature_armature, palette.get(), &ragdolls);
+	physicsman.add_body(creature->get_body(), physics::COLLISION_GROUP_ACTOR, physics::COLLISION_GROUP_ACTOR | physics::COLLISION_GROUP_WORLD | physics::COLLISION_GROUP_HEIGHTMAP);
+	creature_agents.push_back(crowd_manager->add_agent(position, crowd_goal, navigation.get_navquery()));
+	creature_formations.push_back(formation);
+	creatures.push_back(std::move(creature));
+}
 
-	for (int y = 0; y < heightmap->height(); y++) {
-		for (int x = 0; x < heightmap->width(); x++) {
-			vertices.push_back(scale * x + x_offset);
-			vertices.push_back(heightmap->sample(x, y, util::CHANNEL_RED)*amp);
-			vertices.push_back(scale * y + y_offset);
+// the soldiers come back in their slots with the speed of the formation
+void Battle::promote_formation(uint32_t index)
+{
+	Formation &formation = formations[index];
+	const glm::vec3 velocity = formation.get_velocity();
+	for (uint32_t slot = 0; slot < formation.size(); slot++) {
+		glm::vec3 position = formation.slot_position(slot);
+		glm::vec3 origin = { position.x, landscape->SCALE.y, position.z };
+		glm::vec3 end = { position.x, 0.f, position.z };
+		auto result = physicsman.cast_ray(origin, end, physics::COLLISION_GROUP_HEIGHTMAP | physics::COLLISION_GROUP_WORLD);
+		if (result.hit) {
+			position.y = result.point.y + 1.f;
+		}
+		add_creature(position, formation.get_facing(), index);
+		if (creature_agents.back() >= 0) {
+			crowd_manager->set_agent_velocity(creature_agents.back(), velocity);
 		}
 	}
-	for (int y = 0; y < heightmap->height()-1; y++) {
-		for (int x = 0; x < heightmap->width()-1; x++) {
-			int index = x + y * heightmap->height() + index_offset;
 
-			indices.push_back(index);
-			indices.push_back(index + heightmap->height());
-			indices.push_back(index + 1);
+	formation.aggregated = false;
+
+	sort_creatures();
+}
+
+// the new creatures can fill ranges that were freed in the middle of the palette
+// in palette order the creatures are drawn in as few instanced calls as possible
+void Battle::sort_creatures()
+{
+	std::vector<uint32_t> order(creatures.size());
+	for (uint32_t i = 0; i < order.size(); i++) {
+		order[i] = i;
+	}
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+		return creatures[a]->joint_offset() < creatures[b]->joint_offset();
+	});
+
+	std::vector<std::unique_ptr<Creature>> sorted_creatures(creatures.size());
+	std::vector<int32_t> sorted_agents(creatures.size());
+	std::vector<uint32_t> sorted_formations(creatures.size());
+	for (uint32_t i = 0; i < order.size(); i++) {
+		sorted_creatures[i] = std::move(creatures[order[i]]);
+		sorted_agents[i] = creature_agents[order[i]];
+		sorted_formations[i] = creature_formations[order[i]];
+	}
+	creatures.swap(sorted_creatures);
+	creature_agents.swap(sorted_agents);
+	creature_formations.swap(sorted_formations);
+}
 
-			indices.push_back(index + 1);
-			indices.push_back(index + heightmap->height());
-			indices.push_back(index + 1 + heightmap->height());
+// the creatures of the formation are removed after the formation took over their state
+void Battle::demote_formation(uint32_t index)
+{
+	Formation &formation = formations[index];
+
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> velocities;
+	for (int i = 0; i < creatures.size(); i++) {
+		if (creature_formations[i] != index) { continue; }
+		positions.push_back(creatures[i]->position);
+		const int32_t agent = creature_agents[i];
+		velocities.push_back(agent >= 0 ? crowd_manager->agent_velocity(agent) : glm::vec3(0.f));
+	}
+	formation.gather(positions, velocities);
+
+	// erased in order so the other creatures keep their palette order for the instanced draw
+	uint32_t kept = 0;
+	for (uint32_t i = 0; i < creatures.size(); i++) {
+		if (creature_formations[i] == index) {
+			creatures[i]->remove_ragdoll(physicsman.get_world());
+			physicsman.remove_body(creatures[i]->get_body());
+			if (creature_agents[i] >= 0) {
+				crowd_manager->remove_agent(creature_agents[i]);
+			}
+			creatures[i].reset();
+			continue;
 		}
+		creatures[kept] = std::move(creatures[i]);
+		creature_agents[kept] = creature_agents[i];
+		creature_formations[kept] = creature_formations[i];
+		kept++;
 	}
+	creatures.resize(kept);
+	creature_agents.resize(kept);
+	creature_formations.resize(kept);
+
+	formation.aggregated = true;
+}
+
+btCollisionShape* Battle::collision_shape(const gfx::Model *model)
+{
+	std::vector<physics::collision_mesh_view_t> views;
+	for (const auto &mesh : model->collision_trimeshes) {
+		physics::collision_mesh_view_t view;
+		view.positions = mesh.positions.data();
+		view.vertex_count = mesh.positions.size();
+		view.indices = mesh.indices.data();
+		view.index_count = mesh.indices.size();
+		views.push_back(view);
+	}
+
+	return collision_meshes.shape(model->hash, views);
 }
@@ -1,34 +1,79 @@
 
+// models of one tree species of the landscape
+struct tree_models_t {
+	const gfx::Model *trunk = nullptr;
+	const gfx::Model *leaves = nullptr;
+	const gfx::Model *billboard = nullptr;
+};
+
 class Battle {
 public:
 	bool naval = false;
 	util::Camera camera;
 	physics::PhysicsManager physicsman;
+	physics::GroundQuery ground; // batched ground probes of the creatures
+	std::unique_ptr<physics::StaticScenery> scenery; // collision of trees, houses and walls
+	physics::CollisionMeshCache collision_meshes; // collision shapes of the scenery models
 	std::unique_ptr<geography::Landscape> landscape;
+	std::unique_ptr<geography::SiteCache> sites; // sites generated before the battle starts
 	// graphics
 	std::unique_ptr<gfx::RenderGroup> ordinary;
 	std::unique_ptr<gfx::RenderGroup> creature_scenery;
+	// joint matrices of every creature, declared before the creatures so it outlives them
+	std::unique_ptr<gfx::SkinningPalette> palette;
+	gfx::TransformBuffer creature_transforms; // model matrices for the instanced creature draw
+	gfx::TransformBuffer aggregate_transforms; // a stand-in for every soldier of the aggregated formations
+	uint32_t aggregate_joints = 0; // palette range of the stand-ins, all of them are in bind pose
 	std::unique_ptr<gfx::Terrain> terrain;
 	std::unique_ptr<gfx::Forest> forest;
 	gfx::Skybox skybox;
 	// entities
+	physics::RagdollPool ragdolls; // declared before the creatures so it outlives them
 	Creature *player;
 	std::vector<std::unique_ptr<Creature>> creatures;
+	std::vector<int32_t> creature_agents; // crowd agent of each creature
+	std::vector<uint32_t> creature_formations; // formation of each creature
+	// units that are aggregated when they are far away or off screen
+	std::vector<Formation> formations;
+	// creature positions of the last crowd update, for neighbour and target queries
+	util::SpatialHash creature_hash;
 	std::vector<StationaryObject*> stationaries;
-	std::vector<StationaryObject*> tree_stationaries;
-	std::vector<Entity> entities;
+	util::AnimationScheduler animation_scheduler;
 	// navigation
 	util::Navigation navigation;
 	std::unique_ptr<CrowdManager> crowd_manager;
+	std::unique_ptr<util::FlowFieldCache> flowfields;
+	glm::vec3 crowd_goal = {}; // shared move target of the creatures
 public:
 	void init(const module::Module *mod, const util::Window *window, const shader_group_t *shaders);
 	void load_assets(const module::Module *mod);
+	// models are uploaded to the GPU so these two have to run on the main thread
+	void load_wall_models();
+	void load_tree_models();
+	// only needs the models so it can run on another thread while the navigation is built
+	void create_collision_shapes();
 	void create_navigation();
 	void add_entities(const module::Module *mod);
 	void cleanup();
 	void teardown();
+	// swaps formations between individual creatures and aggregates depending on the camera
+	void update_formations(float delta, const glm::vec3 &eye, const glm::mat4 &viewproj);
+	void update_creature_hash();
+	// closest creature of another team, -1 if there is none within the distance
+	int32_t nearest_enemy(uint32_t creature, float max_distance) const;
+	const gfx::Model* get_creature_model() const { return creature_model; }
+	// takes a felled tree out of the collision, indices are the same as the trees of the landscape
+	void remove_tree(uint32_t model, uint32_t transform);
 private:
-	util::Image<float> central_heightmap; // for the navigation
+	// what new creatures are made of when a formation is promoted
+	const gfx::Model *creature_model = nullptr;
+	const module::ragdoll_armature_import_t *creature_armature = nullptr;
+	std::vector<util::spatial_point_t> creature_points;
+	// scenery models of the current landscape, same order as its walls and trees
+	std::vector<const gfx::Model*> wall_models;
+	std::vector<tree_models_t> tree_models;
+	// scenery instance of every tree transform, invalid for trees outside the site
+	std::vector<std::vector<uint32_t>> tree_instances;
 private:
 	void add_creatures(const module::Module *mod);
 	void add_buildings();
@@ -36,5 +81,10 @@ private:
 	void add_trees();
 	void add_physics_bodies();
 	void remove_physics_bodies();
+	void add_creature(const glm::vec3 &position, const glm::vec2 &facing, uint32_t formation);
+	void promote_formation(uint32_t index);
+	void demote_formation(uint32_t index);
+	void sort_creatures();
+	btCollisionShape* collision_shape(const gfx::Model *model);
 };
 	
@@ -1,6 +1,9 @@
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <iostream>
 #include <fstream>
+#include <cstdio>
 #include <unordered_map>
 #include <chrono>
 #include <map>
@@ -35,6 +38,7 @@
 #include "extern/cereal/archives/binary.hpp"
 
 #include "extern/ozz/animation/runtime/animation.h"
+#include "extern/ozz/animation/runtime/blending_job.h"
 #include "extern/ozz/animation/runtime/local_to_model_job.h"
 #include "extern/ozz/animation/runtime/sampling_job.h"
 #include "extern/ozz/animation/runtime/skeleton.h"
@@ -59,13 +63,18 @@
 #include "geometry/geom.h"
 #include "geometry/voronoi.h"
 #include "util/image.h"
+#include "util/heightquery.h"
+#include "util/heightpyramid.h"
 #include "util/entity.h"
 #include "util/camera.h"
 #include "util/window.h"
 #include "util/input.h"
 #include "util/timer.h"
 #include "util/animation.h"
+#include "util/mappedfile.h"
+#include "util/navcache.h"
 #include "util/navigation.h"
+#include "util/proximity.h"
 #include "module/module.h"
 #include "graphics/text.h"
 #include "graphics/shader.h"
@@ -85,36 +94,20 @@
 #include "geography/worldgraph.h"
 #include "geography/mapfield.h"
 #include "geography/atlas.h"
+#include "geography/sitegen.h"
+#include "geography/landscape.h"
 #include "army.h"
 #include "campaign.h"
 
-// store navigation data
-struct navigation_tile_record {
-	int x;
-	int y;
-	std::vector<uint8_t> data;
+static const float PICK_DISTANCE = 1000.f;
+static const float PROXIMITY_CELL_SIZE = 64.f;
+static const float SETTLEMENT_RADIUS = 5.f;
+static const float ARMY_RADIUS = 1.f;
+static const uint32_t SAVE_MAGIC = 'S'<<24 | 'A'<<16 | 'V'<<8 | 'E';
+static const uint32_t SAVE_VERSION = 1; // increase when the layout of the save or its navigation blobs changes
+static const float NAVIGATION_STREAM_MARGIN = 512.f; // navmesh tiles are kept loaded this far around the camera and the player
 
-	template <class Archive>
-	void serialize(Archive &archive)
-	{
-		archive(x, y, data);
-	}
-};
-
-struct navigation_mesh_record {
-	glm::vec3 origin; 
-	float tilewidth; 
-	float tileheight; 
-	int maxtiles; 
-	int maxpolys;
-	std::vector<struct navigation_tile_record> tilemeshes;
-
-	template <class Archive>
-	void serialize(Archive &archive)
-	{
-		archive(origin.x, origin.y, origin.z, tilewidth, tileheight, maxtiles, maxpolys, tilemeshes);
-	}
-};
+static bool ray_hits_sphere(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 &center, float radius, float &t);
 
 void Campaign::init(const util::Window *window, const shader_group_t *shaders)
 {
@@ -142,14 +135,9 @@ void Campaign::load_assets()
 	worldmap->add_material("WATER_BUMPMAP", MediaManager::load_texture("ground/water_normal.dds"));
 }
 	
-void Campaign::add_heightfields()
+void Campaign::create_proximity()
 {
-	const auto terragen = atlas.get_terragen();
-
-	int group = physics::COLLISION_GROUP_HEIGHTMAP;
-	int masks = physics::COLLISION_GROUP_RAY;
-	collisionman.add_heightfield(&terragen->heightmap, atlas.SCALE, group, masks);
-	collisionman.add_heightfield(atlas.get_watermap(), atlas.SCALE, group, masks);
+	proximity.init(glm::vec2(0.f), geom::translate_3D_to_2D(atlas.SCALE), PROXIMITY_CELL_SIZE);
 }
 	
 void Campaign::add_armies()
@@ -157,6 +145,10 @@ void Campaign::add_armies()
 	player->teleport(player_army.position);
 	player->scale = 2.f;
 
+	// the player army is told when it reaches settlements and other armies
+	player_proximity = proximity.insert(player_army.position, ARMY_RADIUS, util::PROXIMITY_ARMY, 0);
+	proximity.watch(player_proximity, util::PROXIMITY_SETTLEMENT | util::PROXIMITY_ARMY);
+
 	std::vector<const Entity*> ents;
 	ents.push_back(player.get());
 
@@ -221,12 +213,9 @@ void Campaign::add_settlements()
 {
 	for (const auto &settlement : settlements) {
 		glm::vec3 position = settlement.second.transform.position;
-		position.y = 0.f;
-		glm::vec3 origin = { position.x, atlas.SCALE.y, position.z };
-		auto result = collisionman.cast_ray(origin, position, physics::COLLISION_GROUP_HEIGHTMAP);
-		position.y = result.point.y;
+		position.y = atlas.sample_height(geom::translate_3D_to_2D(position));
 		auto node = std::make_unique<SettlementNode>(position, settlement.second.transform.rotation, settlement.second.tileID);
-		collisionman.add_ghost_object(node->ghost_object.get(), physics::COLLISION_GROUP_GHOSTS, physics::COLLISION_GROUP_GHOSTS);
+		node->proximity = proximity.insert(geom::translate_3D_to_2D(position), SETTLEMENT_RADIUS, util::PROXIMITY_SETTLEMENT, settlement_nodes.size());
 		settlement_nodes.push_back(std::move(node));
 		
 		// labels
@@ -248,11 +237,12 @@ void Campaign::cleanup()
 	}
 	entities.clear();
 
-	for (auto &node : settlement_nodes) {
-		collisionman.remove_ghost_object(node->ghost_object.get());
-	}
 	settlement_nodes.clear();
 
+	proximity.clear();
+	player_proximity = util::ProximityGrid::INVALID_HANDLE;
+	target_proximity = util::ProximityGrid::INVALID_HANDLE;
+
 	settlements.clear();
 
 	labelman->clear();
@@ -260,8 +250,6 @@ void Campaign::cleanup()
 	ordinary->clear();
 	creatures->clear();
 
-	collisionman.clear();
-
 	landnav.cleanup();
 	seanav.cleanup();
 }
@@ -269,115 +257,82 @@ void Campaign::cleanup()
 void Campaign::teardown()
 {
 	skybox.teardown();
-
-	collisionman.clear();
 }
 
-void Campaign::save(const std::string &filepath)
+bool Campaign::save(const std::string &filepath)
 {
-	navigation_mesh_record navmesh_land;
-	navigation_mesh_record navmesh_sea;
-
-	// save the campaign navigation data
-	{
-		navmesh_land.tilemeshes.clear();
-
-		const dtNavMesh *navmesh = landnav.get_navmesh();
-		if (navmesh) {
-			const dtNavMeshParams *navparams = navmesh->getParams();
-			navmesh_land.origin = { navparams->orig[0], navparams->orig[1], navparams->orig[2] };
-			navmesh_land.tilewidth = navparams->tileWidth;
-			navmesh_land.tileheight = navparams->tileHeight;
-			navmesh_land.maxtiles = navparams->maxTiles;
-			navmesh_land.maxpolys = navparams->maxPolys;
-			for (int i = 0; i < navmesh->getMaxTiles(); i++) {
-				const dtMeshTile *tile = navmesh->getTile(i);
-				if (!tile) { continue; }
-				if (!tile->header) { continue; }
-				const dtMeshHeader *tileheader = tile->header;
-				struct navigation_tile_record navrecord;
-				navrecord.x = tileheader->x;
-				navrecord.y = tileheader->y;
-				navrecord.data.insert(navrecord.data.end(), tile->data, tile->data + tile->dataSize);
-				navmesh_land.tilemeshes.push_back(navrecord);
-			}
-		}
+	// the navigation meshes are stored as blobs next to the save so loading can map them in place
+	if (!landnav.save_blob(filepath + ".landnav")) {
+		LOG(ERROR, "Save") << "save file " + filepath + " could not be saved";
+		return false;
 	}
-
-	{
-		navmesh_sea.tilemeshes.clear();
-
-		const dtNavMesh *navmesh = seanav.get_navmesh();
-		if (navmesh) {
-			const dtNavMeshParams *navparams = navmesh->getParams();
-			navmesh_sea.origin = { navparams->orig[0], navparams->orig[1], navparams->orig[2] };
-			navmesh_sea.tilewidth = navparams->tileWidth;
-			navmesh_sea.tileheight = navparams->tileHeight;
-			navmesh_sea.maxtiles = navparams->maxTiles;
-			navmesh_sea.maxpolys = navparams->maxPolys;
-			for (int i = 0; i < navmesh->getMaxTiles(); i++) {
-				const dtMeshTile *tile = navmesh->getTile(i);
-				if (!tile) { continue; }
-				if (!tile->header) { continue; }
-				const dtMeshHeader *tileheader = tile->header;
-				struct navigation_tile_record navrecord;
-				navrecord.x = tileheader->x;
-				navrecord.y = tileheader->y;
-				navrecord.data.insert(navrecord.data.end(), tile->data, tile->data + tile->dataSize);
-				navmesh_sea.tilemeshes.push_back(navrecord);
-			}
-		}
+	if (!seanav.save_blob(filepath + ".seanav")) {
+		// the land blob is already replaced so the old save would load with the wrong navigation
+		std::remove(filepath.c_str());
+		LOG(ERROR, "Save") << "save file " + filepath + " could not be saved";
+		return false;
 	}
 
 	std::ofstream stream(filepath, std::ios::binary);
 
-	if (stream.is_open()) {
-		cereal::BinaryOutputArchive archive(stream);
-		archive(atlas, seed, navmesh_land, navmesh_sea, settlements, player_army, camera.position, camera.direction);
-	} else {
-		LOG(ERROR, "Save") << "save file " + filepath + "could not be saved";
+	if (!stream.is_open()) {
+		LOG(ERROR, "Save") << "save file " + filepath + " could not be saved";
+		return false;
 	}
+
+	cereal::BinaryOutputArchive archive(stream);
+	archive(SAVE_MAGIC, SAVE_VERSION);
+	archive(atlas, seed, settlements, player_army, camera.position, camera.direction);
+
+	return true;
 }
 
-void Campaign::load(const std::string &filepath)
+bool Campaign::load(const std::string &filepath)
 {
-	navigation_mesh_record navmesh_land;
-	navigation_mesh_record navmesh_sea;
-
 	auto worldgraph = atlas.get_worldgraph();
 
 	std::ifstream stream(filepath, std::ios::binary);
-
-	if (stream.is_open()) {
-		cereal::BinaryInputArchive archive(stream);
-		archive(atlas, seed, navmesh_land, navmesh_sea, settlements, player_army, camera.position, camera.direction);
-	} else {
+	if (!stream.is_open()) {
 		LOG(ERROR, "Save") << "save file " + filepath + " could not be loaded";
-		return;
+		return false;
 	}
 
-	// load campaign the navigation data
-	landnav.alloc(navmesh_land.origin, navmesh_land.tilewidth, navmesh_land.tileheight, navmesh_land.maxtiles, navmesh_land.maxpolys);
-	for (const auto &tilemesh : navmesh_land.tilemeshes) {
-		landnav.load_tilemesh(tilemesh.x, tilemesh.y, tilemesh.data);
+	cereal::BinaryInputArchive archive(stream);
+	// saves from before the navigation blobs have no header, a bad magic rejects them as well
+	uint32_t magic = 0;
+	uint32_t version = 0;
+	archive(magic, version);
+	if (magic != SAVE_MAGIC || version != SAVE_VERSION) {
+		LOG(ERROR, "Save") << "save file " + filepath + " is from another version of the game";
+		return false;
 	}
-	seanav.alloc(navmesh_sea.origin, navmesh_sea.tilewidth, navmesh_sea.tileheight, navmesh_sea.maxtiles, navmesh_sea.maxpolys);
-	for (const auto &tilemesh : navmesh_sea.tilemeshes) {
-		seanav.load_tilemesh(tilemesh.x, tilemesh.y, tilemesh.data);
+
+	// the navigation blobs are checked first so a missing one doesn't leave half a campaign behind
+	// tiles are mapped in when the camera or the player army gets near them
+	if (!landnav.load_blob(filepath + ".landnav", false) || !seanav.load_blob(filepath + ".seanav", false)) {
+		LOG(ERROR, "Save") << "navigation of save file " + filepath + " could not be loaded";
+		landnav.cleanup();
+		seanav.cleanup();
+		return false;
 	}
 
+	archive(atlas, seed, settlements, player_army, camera.position, camera.direction);
+
 	worldgraph->reload_references();
+
+	return true;
+}
+
+void Campaign::stream_navigation()
+{
+	stream_navigation(geom::translate_3D_to_2D(camera.position), geom::translate_3D_to_2D(player->position));
 }
 	
 void Campaign::collide_camera()
 {
-	auto camresult = collisionman.cast_ray(glm::vec3(camera.position.x, atlas.SCALE.y, camera.position.z), glm::vec3(camera.position.x, 0.f, camera.position.z), physics::COLLISION_GROUP_HEIGHTMAP);
-
-	if (camresult.hit) {
-		float yoffset = camresult.point.y + 10.f;
-		if (camera.position.y < yoffset) {
-			camera.position.y = yoffset;
-		}
+	float yoffset = atlas.sample_height(geom::translate_3D_to_2D(camera.position)) + 10.f;
+	if (camera.position.y < yoffset) {
+		camera.position.y = yoffset;
 	}
 }
 	
@@ -472,10 +427,75 @@ void Campaign::update_labels()
 void Campaign::offset_entities()
 {
 	// movable entities vertical offset
-	glm::vec3 origin = { player->position.x, atlas.SCALE.y, player->position.z };
-	glm::vec3 end = { player->position.x, 0.f, player->position.z };
-	auto result = collisionman.cast_ray(origin, end, physics::COLLISION_GROUP_HEIGHTMAP);
-	player->set_y_offset(result.point.y);
+	player->set_y_offset(atlas.sample_height(geom::translate_3D_to_2D(player->position)));
+}
+	
+const geography::tile_t* Campaign::battle_tile() const
+{
+	// the army touches the settlement before it reaches its tile so the position can't be used
+	if (player->get_target_type() == TARGET_SETTLEMENT) {
+		const auto &tiles = atlas.get_worldgraph()->tiles;
+		if (battle_info.tileID < tiles.size()) {
+			return &tiles[battle_info.tileID];
+		}
+	}
+
+	return atlas.tile_at_position(geom::translate_3D_to_2D(player->position));
+}
+
+geography::site_parameters_t Campaign::battle_site() const
+{
+	geography::site_parameters_t site;
+	site.campaign_seed = seed;
+	site.walled = true;
+
+	const auto tily = battle_tile();
+	if (tily) {
+		site.nautical = !tily->land;
+		site.amplitude = tily->amp;
+		site.tileref = tily->index;
+		site.precipitation = tily->precipitation;
+		site.temperature = tily->temperature;
+		std::mt19937 gen(seed);
+		gen.discard(site.tileref);
+		std::uniform_int_distribution<int32_t> local_seed_distrib;
+		site.local_seed = local_seed_distrib(gen);
+
+		if (tily->feature == geography::tile_feature::WOODS) {
+			site.tree_density = 255;
+		} else if (tily->regolith == geography::tile_regolith::SNOW || tily->regolith == geography::tile_regolith::SAND) {
+			site.tree_density = 0;
+		} else {
+			site.tree_density = (site.precipitation > 64) ? 64 : site.precipitation;
+		}
+	} else {
+		// same as a sand tile
+		site.tree_density = 0;
+	}
+
+	if (player->get_target_type() == TARGET_SETTLEMENT) {
+		auto search = settlements.find(battle_info.settlementID);
+		if (search != settlements.end()) {
+			site.site_radius = search->second.population;
+		}
+	}
+
+	return site;
+}
+
+bool Campaign::update_proximity()
+{
+	proximity.move(player_proximity, geom::translate_3D_to_2D(player->position));
+
+	// the enter and leave events are for encounters between armies once they move on the map
+	proximity.update();
+
+	// checks the contact instead of the enter event because the target can be picked while the army is already there
+	if (player->get_target_type() == TARGET_SETTLEMENT && target_proximity != util::ProximityGrid::INVALID_HANDLE) {
+		return proximity.touching(player_proximity, target_proximity);
+	}
+
+	return false;
 }
 	
 void Campaign::update_faction_map()
@@ -496,20 +516,40 @@ void Campaign::update_faction_map()
 	
 void Campaign::change_player_target(const glm::vec3 &ray)
 {
-	auto result = collisionman.cast_ray(camera.position, camera.position + (1000.f * ray), physics::COLLISION_GROUP_HEIGHTMAP | physics::COLLISION_GROUP_GHOSTS);
-	if (result.hit) {
+	glm::vec3 point;
+	bool hit = atlas.intersect_ray(camera.position, ray, PICK_DISTANCE, point);
+	float distance = hit ? glm::distance(camera.position, point) : PICK_DISTANCE;
+
+	// settlements in front of the land, the query circle covers the ray on the map
+	const glm::vec2 start = geom::translate_3D_to_2D(camera.position);
+	const glm::vec2 end = geom::translate_3D_to_2D(camera.position + distance * ray);
+	std::vector<uint32_t> candidates;
+	proximity.query_radius(0.5f * (start + end), 0.5f * glm::distance(start, end), util::PROXIMITY_SETTLEMENT, candidates);
+	const SettlementNode *target = nullptr;
+	for (uint32_t handle : candidates) {
+		const SettlementNode *node = settlement_nodes[proximity.tag(handle)].get();
+		float t = 0.f;
+		if (ray_hits_sphere(camera.position, ray, node->position, SETTLEMENT_RADIUS, t) && t < distance) {
+			distance = t;
+			target = node;
+		}
+	}
+	if (target) {
+		point = camera.position + distance * ray;
+		hit = true;
+	}
+
+	if (hit) {
 		player->set_target_type(TARGET_LAND);
-		marker.position = result.point;
-		if (result.object) {
-			SettlementNode *node = static_cast<SettlementNode*>(result.object->getUserPointer());
-			if (node) {
-				player->set_target_type(TARGET_SETTLEMENT);
-				battle_info.settlementID = node->get_tileref();
-				battle_info.tileID = node->get_tileref();
-			}
+		marker.position = point;
+		if (target) {
+			player->set_target_type(TARGET_SETTLEMENT);
+			battle_info.settlementID = target->get_tileref();
+			battle_info.tileID = target->get_tileref();
+			target_proximity = target->proximity;
 		}
 		// get tile
-		glm::vec2 position = geom::translate_3D_to_2D(result.point);
+		glm::vec2 position = geom::translate_3D_to_2D(point);
 		const auto tily = atlas.tile_at_position(position);
 		if (tily != nullptr && glm::distance(position, geom::translate_3D_to_2D(player->position)) < 10.f) {
 			// embark or disembark
@@ -521,6 +561,8 @@ void Campaign::change_player_target(const glm::vec3 &ray)
 				player->teleport(position);
 			}
 		}
+		// the path can go through tiles that are far from the camera
+		stream_navigation(geom::translate_3D_to_2D(player->position), geom::translate_3D_to_2D(marker.position));
 		// change path if found
 		std::list<glm::vec2> waypoints;
 		if (player->get_movement_mode() == MOVEMENT_LAND) {
@@ -532,4 +574,26 @@ void Campaign::change_player_target(const glm::vec3 &ray)
 		}
 	}
 }
-	
+
+// loads the tiles in the rectangle around both points and unloads the others
+void Campaign::stream_navigation(const glm::vec2 &a, const glm::vec2 &b)
+{
+	const glm::vec2 min = glm::min(a, b) - glm::vec2(NAVIGATION_STREAM_MARGIN);
+	const glm::vec2 max = glm::max(a, b) + glm::vec2(NAVIGATION_STREAM_MARGIN);
+	landnav.stream_tiles(min, max);
+	seanav.stream_tiles(min, max);
+}
+
+static bool ray_hits_sphere(const glm::vec3 &origin, const glm::vec3 &direction, const glm::vec3 &center, float radius, float &t)
+{
+	const glm::vec3 offset = origin - center;
+	const float b = glm::dot(offset, direction);
+	const float c = glm::dot(offset, offset) - radius * radius;
+	const float discriminant = b * b - c;
+	if (discriminant < 0.f) { return false; }
+
+	t = -b - sqrtf(discriminant);
+	if (t < 0.f) { t = -b + sqrtf(discriminant); }
+
+	return t >= 0.f;
+}
@@ -46,31 +46,16 @@ struct army_t {
 
 class SettlementNode : public Entity {
 public:
-	std::unique_ptr<btGhostObject> ghost_object;
-	std::unique_ptr<btCollisionShape> shape;
+	uint32_t proximity = util::ProximityGrid::INVALID_HANDLE; // entry in the campaign proximity grid
 public:
 	SettlementNode(const glm::vec3 &pos, const glm::quat &rot, uint32_t tile)
 	{
 		tileref = tile;
 		position = pos;
 		rotation = rot;
-
-		transform.setIdentity();
-
-		transform.setOrigin(vec3_to_bt(pos));
-		transform.setRotation(quat_to_bt(rot));
-	
-		shape = std::make_unique<btSphereShape>(5.f);
-
-		ghost_object = std::make_unique<btGhostObject>();
-		ghost_object->setCollisionShape(shape.get());
-		ghost_object->setWorldTransform(transform);
-		// link ghost object to this entity
-		ghost_object->setUserPointer(this);
 	}
 	uint32_t get_tileref(void) const { return tileref; }
 private:
-	btTransform transform;
 	uint32_t tileref = 0;
 };
 
@@ -105,7 +90,6 @@ public:
 	util::Navigation landnav;
 	util::Navigation seanav;
 	util::Camera camera;
-	physics::PhysicsManager collisionman;
 	geography::Atlas atlas;
 	// graphics
 	std::unique_ptr<gfx::Worldmap> worldmap;
@@ -117,6 +101,8 @@ public:
 	Entity marker;
 	std::unique_ptr<ArmyNode> player;
 	std::vector<std::unique_ptr<SettlementNode>> settlement_nodes;
+	util::ProximityGrid proximity;
+	uint32_t player_proximity = util::ProximityGrid::INVALID_HANDLE;
 	std::unordered_map<uint32_t, settlement_t> settlements;
 	army_t player_army;
 	std::vector<Entity*> entities;
@@ -126,10 +112,12 @@ public:
 public:
 	void init(const util::Window *window, const shader_group_t *shaders);
 public:
-	void save(const std::string &filepath);
-	void load(const std::string &filepath);
+	// false if the navigation blobs or the save itself could not be written
+	bool save(const std::string &filepath);
+	// false if the save is from another version or its navigation blobs are missing
+	bool load(const std::string &filepath);
 public:
-	void add_heightfields();
+	void create_proximity();
 	void load_assets();
 	void add_armies();
 	void add_trees();
@@ -142,14 +130,24 @@ public:
 	void update_labels();
 	void update_faction_map();
 	void offset_entities();
+	// keeps the navmesh tiles around the camera and the player army loaded
+	void stream_navigation();
+	// true once the player army reaches its target settlement
+	bool update_proximity();
+	// tile of the coming battle, the target settlement or else where the player army stands
+	const geography::tile_t* battle_tile() const;
+	// what the coming battle is generated from, prefetching and loading the site both use this so their keys agree
+	geography::site_parameters_t battle_site() const;
 	void change_player_target(const glm::vec3 &ray);
 private:
 	//navigation_mesh_record m_navmesh_land;
 	//navigation_mesh_record m_navmesh_sea;
+	uint32_t target_proximity = util::ProximityGrid::INVALID_HANDLE;
 	float m_scroll_time = 0.f;
 	float m_scroll_speed = 1.f;
 	enum campaign_scroll_status m_scroll_status = campaign_scroll_status::NONE;
 private:
 	void collide_camera();
+	void stream_navigation(const glm::vec2 &a, const glm::vec2 &b);
 };
 	
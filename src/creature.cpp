@@ -3,6 +3,8 @@
 #include <map>
 #include <list>
 #include <vector>
+#include <mutex>
+#include <atomic>
 #include <GL/glew.h>
 #include <GL/gl.h> 
 
@@ -13,6 +15,7 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include "extern/ozz/animation/runtime/animation.h"
+#include "extern/ozz/animation/runtime/blending_job.h"
 #include "extern/ozz/animation/runtime/local_to_model_job.h"
 #include "extern/ozz/animation/runtime/sampling_job.h"
 #include "extern/ozz/animation/runtime/skeleton.h"
@@ -27,19 +30,38 @@
 #include "geometry/geom.h"
 #include "util/entity.h"
 #include "util/image.h"
+#include "util/heightquery.h"
 #include "util/animation.h"
 #include "module/module.h"
 #include "graphics/texture.h"
 #include "graphics/mesh.h"
 #include "graphics/model.h"
+#include "graphics/palette.h"
 #include "physics/heightfield.h"
 #include "physics/physics.h"
+#include "physics/ground.h"
 #include "physics/bumper.h"
 
 #include "physics/ragdoll.h"
 
 #include "creature.h"
 
+static const float BOUNDS_RADIUS = 2.f; // sphere around a creature used for visibility tests
+static const float SHARED_POSE_RATE = 30.f; // shared poses per second of animation
+
+struct creature_rig_t {
+	std::shared_ptr<const util::AnimationSet> animations;
+	// poses shared by creatures far enough from the camera
+	std::unique_ptr<util::AnimationPoseCache> poses;
+	// left: skeleton target, right: ragdoll transform matrix
+	std::vector<std::pair<uint32_t, uint32_t>> targets;
+	// reduced joint set, joints that are not in it are skinned rigidly to their closest ancestor that is
+	std::vector<uint32_t> reduced_joints;
+	uint32_t reduced_count = 0;
+};
+
+static std::shared_ptr<const creature_rig_t> load_rig(const module::ragdoll_armature_import_t &armature);
+
 static inline glm::quat direction_to_quat(glm::vec2 direction)
 {
 	float angle = atan2(direction.x, direction.y);
@@ -48,7 +70,7 @@ static inline glm::quat direction_to_quat(glm::vec2 direction)
 	return rotation;
 }
 
-Creature::Creature(const glm::vec3 &pos, const glm::quat &rot, const gfx::Model *model, const module::ragdoll_armature_import_t &armature)
+Creature::Creature(const glm::vec3 &pos, const glm::quat &rot, const gfx::Model *model, const module::ragdoll_armature_import_t &armature, gfx::SkinningPalette *palette, physics::RagdollPool *ragdolls)
 {
 	position = pos;
 	rotation = rot;
@@ -67,45 +89,22 @@ Creature::Creature(const glm::vec3 &pos, const glm::quat &rot, const gfx::Model
 
 	m_bumper = std::make_unique<physics::Bumper>(pos, 0.3f, 1.8f);
 
-	const std::vector<std::pair<uint32_t, std::string>> animations = {
-		std::make_pair(CA_IDLE, "modules/native/media/animations/human/idle.ozz"),
-		std::make_pair(CA_WALK, "modules/native/media/animations/human/walk.ozz"),
-		std::make_pair(CA_RUN, "modules/native/media/animations/human/run.ozz"),
-		std::make_pair(CA_LEFT_STRAFE, "modules/native/media/animations/human/left_strafe.ozz"),
-		std::make_pair(CA_RIGHT_STRAFE, "modules/native/media/animations/human/right_strafe.ozz"),
-		std::make_pair(CA_FALLING, "modules/native/media/animations/human/falling.ozz")
-	};
-	m_animator = std::make_unique<util::Animator>("modules/native/media/skeletons/human.ozz", animations);
-	m_joint_transforms.matrices.resize(m_animator->models.size());
-	m_joint_transforms.alloc(GL_DYNAMIC_DRAW);
+	m_rig = load_rig(armature);
+	m_animator = std::make_unique<util::Animator>(m_rig->animations);
+	m_animator->set_pose_cache(m_rig->poses.get());
+	m_palette = palette;
+	m_joint_offset = m_palette->allocate(m_animator->models.size());
 
-	m_ragdoll.create(armature);
-	
-	// left: skeleton target, right: ragdoll transform matrix
-	std::list<std::pair<uint32_t, std::string>> names;
-	for (int i = 0; i < m_animator->skeleton.num_joints(); i++) {
-		names.push_back(std::make_pair(i, m_animator->skeleton.joint_names()[i]));
-		//std::cout << m_animator->skeleton.joint_names()[i] << std::endl;
-	}
-	for (int i = 0; i < armature.bones.size(); i++) {
-		const auto &bone = armature.bones[i];
-		for (auto it = names.begin(); it != names.end(); ){
-			auto joint = *it;
-			std::string name = joint.second;
-			bool found = false;
-			for (const auto &pattern : bone.targets) {
-				if (name.find(pattern) != std::string::npos) {
-					found = true;
-					break;
-				}
-			}
-			if (found) {
-				m_targets.push_back(std::make_pair(joint.first, i));
-				it = names.erase(it);
-			} else {
-				it++;
-			}
-		}
+	// ragdolls are only made when the creature goes limp
+	m_ragdolls = ragdolls;
+}
+
+// the ragdoll has to be out of the physics world before this
+Creature::~Creature()
+{
+	m_palette->release(m_joint_offset, m_animator->models.size());
+	if (m_ragdoll) {
+		m_ragdolls->release(m_ragdoll);
 	}
 }
 
@@ -190,17 +189,44 @@ void Creature::update(const btDynamicsWorld *world)
 	m_bumper->update(world);
 }
 
+void Creature::update(const btDynamicsWorld *world, const physics::ground_probe_t &probe)
+{
+	m_bumper->update(world, probe);
+}
+
+physics::ground_probe_t Creature::ground_probe() const
+{
+	return m_bumper->ground_probe();
+}
+
 void Creature::sync(float delta)
+{
+	sync_body();
+	animate(delta);
+}
+
+// reads the physics state, must not run while the physics world steps
+void Creature::sync_body()
 {
 	if (m_ragdoll_mode) {
 		scale = 1.f;
-		m_ragdoll.update();
-		position = m_ragdoll.position();
+		// without a ragdoll the creature stays in its frozen pose
+		if (m_ragdoll) {
+			m_ragdoll->update();
+			position = m_ragdoll->position();
+			for (int i = 0; i < m_ragdoll_pose.size(); i++) {
+				m_ragdoll_pose[i] = m_ragdoll->transform(i);
+			}
+		}
 	} else {
 		position = m_bumper->position();
 		scale = 0.01f;
 	}
+}
 
+// no physics or OpenGL calls in here so creatures can be animated in parallel
+void Creature::animate(float delta, const util::animation_lod_t &lod)
+{
 	if (!m_bumper->grounded()) {
 		change_animation(CA_FALLING);
 	} else {
@@ -226,25 +252,53 @@ void Creature::sync(float delta)
 		rotation = direction_to_quat(m_direction);
 	}
 
-	m_animator->update(delta, m_previous_animation, m_current_animation, m_animation_mix);
+	m_animator->update(delta, m_previous_animation, m_current_animation, m_animation_mix, lod);
+	// off screen, only the playback time had to move on
+	if (!lod.visible) {
+		return;
+	}
+
+	// the range of this creature in the palette, other creatures write to their own range at the same time
+	glm::mat4 *joints = m_palette->joints(m_joint_offset);
 
-	glm::mat4 ROOT_TRANSFORM = glm::translate(glm::mat4(1.f), position) * glm::mat4(rotation) * glm::scale(glm::mat4(1.f), glm::vec3(scale));
 	for (const auto &skin : m_model->skins) {
 		if (m_ragdoll_mode) {
+			// inverse of translation * rotation * scale, the same for every joint
+			const glm::mat4 inverse_root = glm::scale(glm::mat4(1.f), glm::vec3(1.f / scale)) * glm::mat4(glm::conjugate(rotation)) * glm::translate(glm::mat4(1.f), -position);
+			const glm::mat4 root = inverse_root * m_ragdoll_pose[0];
 			for (int i = 0; i < skin.inversebinds.size(); i++) {
-				m_joint_transforms.matrices[i] = glm::inverse(ROOT_TRANSFORM) * m_ragdoll.transform(0);
+				joints[i] = root;
 			}
-			for (const auto &target : m_targets) {
-				glm::mat4 T = m_ragdoll.transform(target.second); 
-				m_joint_transforms.matrices[target.first] = glm::inverse(ROOT_TRANSFORM) * T;
+			for (const auto &target : m_rig->targets) {
+				joints[target.first] = inverse_root * m_ragdoll_pose[target.second];
+			}
+		} else if (lod.reduced) {
+			// a rigid child has the same skinning matrix as its parent in bind pose
+			// joints are ordered parents first so the ancestor is always done
+			for (int i = 0; i < m_animator->models.size(); i++) {
+				const uint32_t joint = m_rig->reduced_joints[i];
+				if (joint == i) {
+					joints[i] = util::ozz_to_mat4(m_animator->pose()[i]) * skin.inversebinds[i];
+				} else {
+					joints[i] = joints[joint];
+				}
 			}
 		} else {
 			for (int i = 0; i < m_animator->models.size(); i++) {
-				m_joint_transforms.matrices[i] = util::ozz_to_mat4(m_animator->models[i]) * skin.inversebinds[i];
+				joints[i] = util::ozz_to_mat4(m_animator->pose()[i]) * skin.inversebinds[i];
 			}
 		}
 	}
-	m_joint_transforms.update();
+}
+
+geom::sphere_t Creature::bounds() const
+{
+	return geom::sphere_t { position, BOUNDS_RADIUS };
+}
+
+uint32_t Creature::joint_count(bool reduced) const
+{
+	return reduced ? m_rig->reduced_count : m_animator->models.size();
 }
 	
 void Creature::change_animation(enum creature_animation_t anim)
@@ -256,12 +310,134 @@ void Creature::change_animation(enum creature_animation_t anim)
 	}
 }
 
-void Creature::add_ragdoll(btDynamicsWorld *world)
+bool Creature::add_ragdoll(btDynamicsWorld *world)
 {
-	m_ragdoll.add_to_world(world, m_bumper->position(), m_velocity);
+	if (m_ragdoll_mode || !m_ragdolls) { return false; }
+
+	m_ragdoll = m_ragdolls->acquire();
+	if (!m_ragdoll) { return false; }
+
+	// bones without a skeleton joint only follow the creature
+	std::vector<glm::mat4> transforms(m_ragdoll->bone_count(), glm::translate(glm::mat4(1.f), m_bumper->position()));
+
+	// the skinning matrix of a joint in world space is where its bone has to be
+	if (!m_model->skins.empty()) {
+		const auto &skin = m_model->skins.front();
+		const glm::mat4 world_transform = glm::translate(glm::mat4(1.f), position) * glm::mat4(rotation) * glm::scale(glm::mat4(1.f), glm::vec3(scale));
+		const auto &pose = m_animator->pose();
+		for (const auto &target : m_rig->targets) {
+			if (target.first < pose.size() && target.first < skin.inversebinds.size() && target.second < transforms.size()) {
+				transforms[target.second] = world_transform * util::ozz_to_mat4(pose[target.first]) * skin.inversebinds[target.first];
+			}
+		}
+	}
+
+	m_ragdoll->add_to_world(world, transforms, m_velocity);
+	m_ragdoll->update();
+	m_ragdoll_pose.resize(m_ragdoll->bone_count());
+	for (int i = 0; i < m_ragdoll_pose.size(); i++) {
+		m_ragdoll_pose[i] = m_ragdoll->transform(i);
+	}
+
+	m_ragdoll_mode = true;
+
+	return true;
 }
 
 void Creature::remove_ragdoll(btDynamicsWorld *world)
 {
-	m_ragdoll.remove_from_world(world);
+	if (m_ragdoll) {
+		m_ragdoll->remove_from_world(world);
+		m_ragdolls->release(m_ragdoll);
+		m_ragdoll = nullptr;
+	}
+	m_ragdoll_pose.clear();
+
+	m_ragdoll_mode = false;
+}
+
+void Creature::settle_ragdoll(btDynamicsWorld *world)
+{
+	if (!m_ragdoll || !m_ragdoll->resting()) { return; }
+
+	// the pose was read in the last sync so it is already the final one
+	m_ragdoll->remove_from_world(world);
+	m_ragdolls->release(m_ragdoll);
+	m_ragdoll = nullptr;
+}
+
+// the skeleton, clips and joint mapping are the same for every creature with this armature
+static std::shared_ptr<const creature_rig_t> load_rig(const module::ragdoll_armature_import_t &armature)
+{
+	static std::mutex mutex;
+	static std::map<const module::ragdoll_armature_import_t*, std::weak_ptr<const creature_rig_t>> rigs;
+
+	std::lock_guard<std::mutex> guard(mutex);
+
+	auto shared = rigs[&armature].lock();
+	if (shared) {
+		return shared;
+	}
+
+	auto rig = std::make_shared<creature_rig_t>();
+
+	const std::vector<std::pair<uint32_t, std::string>> animations = {
+		std::make_pair(CA_IDLE, "modules/native/media/animations/human/idle.ozz"),
+		std::make_pair(CA_WALK, "modules/native/media/animations/human/walk.ozz"),
+		std::make_pair(CA_RUN, "modules/native/media/animations/human/run.ozz"),
+		std::make_pair(CA_LEFT_STRAFE, "modules/native/media/animations/human/left_strafe.ozz"),
+		std::make_pair(CA_RIGHT_STRAFE, "modules/native/media/animations/human/right_strafe.ozz"),
+		std::make_pair(CA_FALLING, "modules/native/media/animations/human/falling.ozz")
+	};
+	rig->animations = util::load_animation_set("modules/native/media/skeletons/human.ozz", animations);
+	rig->poses = std::make_unique<util::AnimationPoseCache>(rig->animations, SHARED_POSE_RATE);
+
+	const ozz::animation::Skeleton &skeleton = rig->animations->skeleton;
+	std::list<std::pair<uint32_t, std::string>> names;
+	for (int i = 0; i < skeleton.num_joints(); i++) {
+		names.push_back(std::make_pair(i, skeleton.joint_names()[i]));
+	}
+	for (int i = 0; i < armature.bones.size(); i++) {
+		const auto &bone = armature.bones[i];
+		for (auto it = names.begin(); it != names.end(); ){
+			auto joint = *it;
+			std::string name = joint.second;
+			bool found = false;
+			for (const auto &pattern : bone.targets) {
+				if (name.find(pattern) != std::string::npos) {
+					found = true;
+					break;
+				}
+			}
+			if (found) {
+				rig->targets.push_back(std::make_pair(joint.first, i));
+				it = names.erase(it);
+			} else {
+				it++;
+			}
+		}
+	}
+
+	// the reduced joint set is every joint the ragdoll drives and their ancestors
+	const auto parents = skeleton.joint_parents();
+	std::vector<bool> kept(skeleton.num_joints(), rig->targets.empty());
+	for (const auto &target : rig->targets) {
+		for (int joint = target.first; joint != ozz::animation::Skeleton::kNoParent && !kept[joint]; joint = parents[joint]) {
+			kept[joint] = true;
+		}
+	}
+	rig->reduced_joints.resize(skeleton.num_joints());
+	for (int i = 0; i < skeleton.num_joints(); i++) {
+		int joint = i;
+		while (!kept[joint] && parents[joint] != ozz::animation::Skeleton::kNoParent) {
+			joint = parents[joint];
+		}
+		rig->reduced_joints[i] = joint;
+		if (joint == i) { rig->reduced_count++; }
+	}
+
+	shared = rig;
+	rigs[&armature] = shared;
+
+	return shared;
 }
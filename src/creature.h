@@ -17,29 +17,49 @@ enum creature_movement_t {
 	CM_RIGHT_FORWARD
 };
 
+// shared by every creature with the same armature
+struct creature_rig_t;
+
 class Creature : public Entity {
 public:
 	float m_animation_mix = 0.f;
 	bool m_ragdoll_mode = false;
 	const gfx::Model *m_model;
 public:
-	Creature(const glm::vec3 &pos, const glm::quat &rot, const gfx::Model *model, const module::ragdoll_armature_import_t &armature);
+	Creature(const glm::vec3 &pos, const glm::quat &rot, const gfx::Model *model, const module::ragdoll_armature_import_t &armature, gfx::SkinningPalette *palette, physics::RagdollPool *ragdolls);
+	~Creature();
 	btRigidBody* get_body() const;
 	void control(const glm::vec3 &view, bool forward, bool backward, bool right, bool left);
 	void move(const glm::vec2 &velocity);
 	void stick_to_agent(const glm::vec3 &agent_position, const glm::vec3 &agent_velocity);
 	void jump();
 	void update(const btDynamicsWorld *world);
+	void update(const btDynamicsWorld *world, const physics::ground_probe_t &probe);
+	physics::ground_probe_t ground_probe() const;
 	void sync(float delta);
-	const gfx::TransformBuffer* joints() const { return &m_joint_transforms; };
-	void add_ragdoll(btDynamicsWorld *world);
+	// sync split in phases, only animate can run in parallel with other creatures
+	// the skinning palette is uploaded for all creatures at once after animating
+	void sync_body();
+	void animate(float delta, const util::animation_lod_t &lod = util::animation_lod_t());
+	// for animation level of detail
+	geom::sphere_t bounds() const;
+	uint32_t joint_count(bool reduced) const;
+	// first joint of this creature in the skinning palette
+	uint32_t joint_offset() const { return m_joint_offset; }
+	// borrows a ragdoll from the pool, false if none is left
+	bool add_ragdoll(btDynamicsWorld *world);
 	void remove_ragdoll(btDynamicsWorld *world);
+	// gives the ragdoll back once it is at rest, the creature keeps its last pose
+	void settle_ragdoll(btDynamicsWorld *world);
 private:
 	std::unique_ptr<physics::Bumper> m_bumper;
-	std::vector<std::pair<uint32_t, uint32_t>> m_targets;
-	physics::Ragdoll m_ragdoll;
+	std::shared_ptr<const creature_rig_t> m_rig;
+	physics::RagdollPool *m_ragdolls;
+	physics::Ragdoll *m_ragdoll = nullptr;
+	std::vector<glm::mat4> m_ragdoll_pose; // bone transforms of the ragdoll, frozen after it is given back
 	std::unique_ptr<util::Animator> m_animator;
-	gfx::TransformBuffer m_joint_transforms;
+	gfx::SkinningPalette *m_palette;
+	uint32_t m_joint_offset = 0;
 	glm::vec3 m_velocity;
 	glm::vec2 m_direction;
 	enum creature_animation_t m_current_animation;
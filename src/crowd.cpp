@@ -4,9 +4,14 @@
 #include <iostream>
 #include <cstdio>
 #include <vector>
+#include <string>
+#include <memory>
+#include <unordered_map>
 #include <cstring>
 #include <thread>
 #include <list>
+#include <algorithm>
+#include <limits>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/quaternion.hpp>
@@ -19,59 +24,61 @@
 #include "extern/recast/ChunkyTriMesh.h"
 #include "extern/recast/DetourCrowd.h"
 
+#include "geometry/geom.h"
+#include "util/image.h"
+#include "util/mappedfile.h"
+#include "util/navcache.h"
 #include "util/navigation.h"
+#include "util/flowfield.h"
 #include "crowd.h"
 
 static const float BOX_EXTENTS[3] = { 512.f, 512.f, 512.f }; // size of box around start/end points to look for nav polygons
-static const int MAX_AGENTS = 1024;
-static const float MAX_AGENT_RADIUS = 1024.f;
+static const int PARTITION_COUNT = 8;
+static const int MAX_PARTITION_AGENTS = 1024; // includes the ghosts of neighbouring partitions
+static const float MAX_AGENT_RADIUS = 1.f; // sets the cell size of the crowd proximity grid
+static const float ARRIVAL_RADIUS = 2.f; // agents following a flow field slow down this close to the goal
+static const uint32_t REBALANCE_INTERVAL = 60; // frames between resizing the partitions
+static const float MIGRATION_MARGIN = 1.f; // how far an agent can stray out of its partition, stops agents on the border from flipping back and forth
+static const float GHOST_MARGIN = 6.f; // agents this close to a partition are ghosts in it, covers the collision query range of the agents
+static const float FLOCK_RADIUS = 3.f; // neighbours that steer a flocking agent, also the cell size of the spatial hash
+static const int MAX_FLOCK_NEIGHBOURS = 8;
+static const float SEPARATION_WEIGHT = 2.f;
+static const float COHESION_WEIGHT = 0.2f;
+static const float ALIGNMENT_WEIGHT = 0.5f;
+static const float ORCA_TIME_HORIZON = 1.f; // seconds ahead that flocking agents avoid collisions
+static const uint32_t AVOIDANCE_FLAGS = DT_CROWD_OBSTACLE_AVOIDANCE | DT_CROWD_SEPARATION;
 
-CrowdManager::CrowdManager(dtNavMesh *navmesh)
-{
-	dtcrowd = dtAllocCrowd();
-	dtcrowd->init(MAX_AGENTS, MAX_AGENT_RADIUS, navmesh);
+struct orca_line_t {
+	glm::vec2 point;
+	glm::vec2 direction;
+};
 
-	// Setup local avoidance params to different qualities.
-	dtObstacleAvoidanceParams params;
-	// Use mostly default settings, copy from dtCrowd.
-	memcpy(&params, dtcrowd->getObstacleAvoidanceParams(0), sizeof(dtObstacleAvoidanceParams));
+static void setup_avoidance(dtCrowd *crowd);
+static orca_line_t orca_line(const glm::vec2 &relative_position, const glm::vec2 &velocity, const glm::vec2 &other_velocity, float radius, float dt);
 
-	// Low (11)
-	params.velBias = 0.5f;
-	params.adaptiveDivs = 5;
-	params.adaptiveRings = 2;
-	params.adaptiveDepth = 1;
-	dtcrowd->setObstacleAvoidanceParams(0, &params);
-
-	// Medium (22)
-	params.velBias = 0.5f;
-	params.adaptiveDivs = 5;
-	params.adaptiveRings = 2;
-	params.adaptiveDepth = 2;
-	dtcrowd->setObstacleAvoidanceParams(1, &params);
-
-	// Good (45)
-	params.velBias = 0.5f;
-	params.adaptiveDivs = 7;
-	params.adaptiveRings = 2;
-	params.adaptiveDepth = 3;
-	dtcrowd->setObstacleAvoidanceParams(2, &params);
-
-	// High (66)
-	params.velBias = 0.5f;
-	params.adaptiveDivs = 7;
-	params.adaptiveRings = 3;
-	params.adaptiveDepth = 3;
+CrowdManager::CrowdManager(dtNavMesh *navmesh)
+{
+	partitions.resize(PARTITION_COUNT);
+	for (auto &partition : partitions) {
+		partition.crowd = dtAllocCrowd();
+		partition.crowd->init(MAX_PARTITION_AGENTS, MAX_AGENT_RADIUS, navmesh);
+		setup_avoidance(partition.crowd);
+		partition.agents.assign(MAX_PARTITION_AGENTS, -1);
+	}
 
-	dtcrowd->setObstacleAvoidanceParams(3, &params);
+	// until the first rebalance everything goes to the first partition, overflow goes to the emptiest one
+	partitions.front().min_x = -std::numeric_limits<float>::max();
+	partitions.front().max_x = std::numeric_limits<float>::max();
 }
 
 CrowdManager::~CrowdManager()
 {
-	dtFreeCrowd(dtcrowd);
+	for (auto &partition : partitions) {
+		dtFreeCrowd(partition.crowd);
+	}
 }
 
-void CrowdManager::add_agent(glm::vec3 start, glm::vec3 destination, const dtNavMeshQuery *navquery)
+int32_t CrowdManager::add_agent(glm::vec3 start, glm::vec3 destination, const dtNavMeshQuery *navquery)
 {
 	// find the start polygon
 	dtQueryFilter filter;
@@ -83,7 +90,7 @@ void CrowdManager::add_agent(glm::vec3 start, glm::vec3 destination, const dtNav
 	dtStatus status = navquery->findNearestPoly(glm::value_ptr(start), BOX_EXTENTS, &filter, &start_poly, nearest_start);
 	if ((status & DT_FAILURE) || (status & DT_STATUS_DETAIL_MASK)) {
 		printf("couldn't find start polygon\n");
-		return; 
+		return -1; 
 	}
 
 	// find the end polygon
@@ -92,7 +99,7 @@ void CrowdManager::add_agent(glm::vec3 start, glm::vec3 destination, const dtNav
 	status = navquery->findNearestPoly(glm::value_ptr(destination), BOX_EXTENTS, &filter, &end_poly, nearest_end);
 	if ((status & DT_FAILURE) || (status & DT_STATUS_DETAIL_MASK)) { 
 		printf("couldn't find end polygon\n");
-		return; 
+		return -1; 
 	}
 
 	// add the agent
@@ -119,28 +126,123 @@ void CrowdManager::add_agent(glm::vec3 start, glm::vec3 destination, const dtNav
 	ap.obstacleAvoidanceType = 3;
 	ap.separationWeight = 2.f;
 
-	int idx = dtcrowd->addAgent(nearest_start, &ap);
-	if (idx != -1) {
-		dtcrowd->requestMoveTarget(idx, end_poly, nearest_end);
+	uint32_t target = partition_at(nearest_start[0]);
+	if (partitions[target].count >= MAX_PARTITION_AGENTS) {
+		for (uint32_t i = 0; i < partitions.size(); i++) {
+			if (partitions[i].count < partitions[target].count) { target = i; }
+		}
 	}
+	crowd_partition_t &partition = partitions[target];
+
+	int idx = partition.crowd->addAgent(nearest_start, &ap);
+	if (idx == -1) {
+		return -1;
+	}
+
+	partition.crowd->requestMoveTarget(idx, end_poly, nearest_end);
+
+	crowd_slot_t slot;
+	slot.partition = target;
+	slot.local = idx;
+	partition.count++;
+
+	uint32_t index = slots.size();
+	if (!free_slots.empty()) {
+		index = free_slots.back();
+		free_slots.pop_back();
+		slots[index] = slot;
+		agent_positions[index] = glm::make_vec3(nearest_start);
+		agent_velocities[index] = glm::vec3(0.f);
+		steerings[index] = crowd_steering::AVOIDANCE;
+		preferred[index] = 0;
+	} else {
+		slots.push_back(slot);
+		agent_positions.push_back(glm::make_vec3(nearest_start));
+		agent_velocities.push_back(glm::vec3(0.f));
+		steerings.push_back(crowd_steering::AVOIDANCE);
+		preferred.push_back(0);
+		preferred_velocities.push_back(glm::vec3(0.f));
+		steered_velocities.push_back(glm::vec3(0.f));
+	}
+	partition.agents[idx] = index;
+
+	return index;
+}
+
+void CrowdManager::remove_agent(uint32_t index)
+{
+	int local = -1;
+	dtCrowd *crowd = find_agent(index, local);
+	if (!crowd) { return; }
+
+	crowd_partition_t &partition = partitions[slots[index].partition];
+	crowd->removeAgent(local);
+	partition.agents[local] = -1;
+	partition.count--;
+
+	for (auto &other : partitions) {
+		remove_ghost(other, index);
+	}
+
+	slots[index].local = -1;
+	preferred[index] = 0;
+	agent_velocities[index] = glm::vec3(0.f);
+	free_slots.push_back(index);
 }
 
 void CrowdManager::update(float dt)
 {
-	dtcrowd->update(dt, nullptr);
+	if (frame++ % REBALANCE_INTERVAL == 0) {
+		rebalance();
+	}
+
+	// moving agents between crowds and ghosts touch several crowds so it stays single threaded
+	migrate();
+	exchange_ghosts();
+
+	// flocking agents only look at the agents around them in the spatial hash
+	build_hash();
+	#pragma omp parallel for
+	for (int i = 0; i < slots.size(); i++) {
+		if (preferred[i]) {
+			steered_velocities[i] = flock(i, dt);
+		}
+	}
+
+	// each crowd has its own nav query so they only share the navmesh, which is read only here
+	// the crowd still moves flocking agents along the navmesh surface
+	#pragma omp parallel for
+	for (int i = 0; i < partitions.size(); i++) {
+		crowd_partition_t &partition = partitions[i];
+		const int count = partition.crowd->getAgentCount();
+		for (int local = 0; local < count; local++) {
+			const int32_t index = partition.agents[local];
+			if (index >= 0 && preferred[index]) {
+				partition.crowd->requestMoveVelocity(local, glm::value_ptr(steered_velocities[index]));
+			}
+		}
+		partition.crowd->update(dt, nullptr);
+	}
+
+	std::fill(preferred.begin(), preferred.end(), 0);
+
+	export_agents();
 }
 
 const dtCrowdAgent* CrowdManager::agent_at(uint32_t index)
 {
-	return dtcrowd->getAgent(index);
+	int local = -1;
+	dtCrowd *crowd = find_agent(index, local);
+
+	return crowd ? crowd->getAgent(local) : nullptr;
 }
 
 glm::vec3 CrowdManager::agent_velocity(uint32_t index)
 {
 	glm::vec3 velocity = {0.f, 0.f, 0.f};
 
-	const dtCrowdAgent *agent = dtcrowd->getAgent(index);
-	if (!agent->active) { return velocity; }
+	const dtCrowdAgent *agent = agent_at(index);
+	if (!agent || !agent->active) { return velocity; }
 
 	const float *v = agent->vel;
 	velocity.x = v[0];
@@ -154,7 +256,8 @@ glm::vec3 CrowdManager::agent_position(uint32_t index)
 {
 	glm::vec3 position = {0.f, 0.f, 0.f};
 
-	const dtCrowdAgent *agent = dtcrowd->getAgent(index);
+	const dtCrowdAgent *agent = agent_at(index);
+	if (!agent) { return position; }
 
 	const float *p = agent->npos;
 	position.x = p[0];
@@ -166,18 +269,26 @@ glm::vec3 CrowdManager::agent_position(uint32_t index)
 
 void CrowdManager::agent_speed(uint32_t index, float speed)
 {
-	dtCrowdAgent *agent = dtcrowd->getEditableAgent(index);
+	int local = -1;
+	dtCrowd *crowd = find_agent(index, local);
+	if (!crowd) { return; }
+
+	dtCrowdAgent *agent = crowd->getEditableAgent(local);
 	agent->params.maxSpeed = speed;
 }
 
 void CrowdManager::retarget_agent(uint32_t index, glm::vec3 nearest, dtPolyRef poly)
 {
-	dtcrowd->requestMoveTarget(index, poly, glm::value_ptr(nearest));
+	int local = -1;
+	dtCrowd *crowd = find_agent(index, local);
+	if (crowd) {
+		crowd->requestMoveTarget(local, poly, glm::value_ptr(nearest));
+	}
 }
 	
 dtPolyRef CrowdManager::agent_polyref(uint32_t index)
 {
-	const dtCrowdAgent *agent = dtcrowd->getAgent(index);
+	const dtCrowdAgent *agent = agent_at(index);
 	if (agent) {
 		const dtPathCorridor *corridor = &agent->corridor;
 		return corridor->getFirstPoly();
@@ -188,28 +299,70 @@ dtPolyRef CrowdManager::agent_polyref(uint32_t index)
 
 void CrowdManager::teleport_agent(uint32_t index, glm::vec3 position)
 {
-	dtCrowdAgent *agent = dtcrowd->getEditableAgent(index);
+	int local = -1;
+	dtCrowd *crowd = find_agent(index, local);
+	if (!crowd) { return; }
+
+	dtCrowdAgent *agent = crowd->getEditableAgent(local);
 	if (agent) {
 		// cancel the agent's pathfinding
-		dtcrowd->resetMoveTarget(index);
+		crowd->resetMoveTarget(local);
 		// now teleport the agent
 		agent->npos[0] = position.x;
 		agent->npos[1] = position.y;
 		agent->npos[2] = position.z;
+		agent_positions[index] = position;
 	}
 }
 	
 void CrowdManager::set_agent_velocity(uint32_t index, glm::vec3 velocity)
 {
-	dtCrowdAgent *agent = dtcrowd->getEditableAgent(index);
-	if (agent) {
-		dtcrowd->requestMoveVelocity(index, glm::value_ptr(velocity));
+	request_velocity(index, velocity);
+}
+
+void CrowdManager::steer_agent(uint32_t index, const util::FlowField *field)
+{
+	int local = -1;
+	dtCrowd *crowd = find_agent(index, local);
+	if (!crowd || !field) { return; }
+
+	dtCrowdAgent *agent = crowd->getEditableAgent(local);
+	if (!agent || !agent->active) { return; }
+
+	const glm::vec3 position = { agent->npos[0], agent->npos[1], agent->npos[2] };
+	glm::vec3 direction = field->direction(agent->corridor.getFirstPoly(), position);
+
+	// ease into the goal instead of overshooting it
+	float speed = agent->params.maxSpeed;
+	if (agent->corridor.getFirstPoly() == field->get_goal_poly()) {
+		float distance = glm::distance(position, field->get_goal());
+		speed *= glm::clamp(distance / ARRIVAL_RADIUS, 0.f, 1.f);
+	}
+
+	request_velocity(index, speed * direction);
+}
+
+void CrowdManager::agent_steering(uint32_t index, crowd_steering steering)
+{
+	int local = -1;
+	dtCrowd *crowd = find_agent(index, local);
+	if (!crowd || steerings[index] == steering) { return; }
+
+	steerings[index] = steering;
+
+	// flocking agents do their own avoidance so Detour's is turned off
+	dtCrowdAgentParams params = crowd->getAgent(local)->params;
+	if (steering == crowd_steering::AVOIDANCE) {
+		params.updateFlags |= AVOIDANCE_FLAGS;
+	} else {
+		params.updateFlags &= ~AVOIDANCE_FLAGS;
 	}
+	crowd->updateAgentParameters(local, &params);
 }
 	
 struct target_result CrowdManager::agent_target(uint32_t index)
 {
-	const dtCrowdAgent *agent = dtcrowd->getAgent(index);
+	const dtCrowdAgent *agent = agent_at(index);
 	struct target_result result;
 	if (agent) {
 		result.position.x = agent->targetPos[0];
@@ -223,3 +376,385 @@ struct target_result CrowdManager::agent_target(uint32_t index)
 
 	return result;
 }
+
+dtCrowd* CrowdManager::find_agent(uint32_t index, int &local) const
+{
+	if (index >= slots.size() || slots[index].local < 0) {
+		return nullptr;
+	}
+
+	local = slots[index].local;
+
+	return partitions[slots[index].partition].crowd;
+}
+
+uint32_t CrowdManager::partition_at(float x) const
+{
+	for (uint32_t i = 0; i < partitions.size(); i++) {
+		if (x >= partitions[i].min_x && x < partitions[i].max_x) {
+			return i;
+		}
+	}
+
+	return 0;
+}
+
+// splits the world in strips with the same number of agents
+void CrowdManager::rebalance()
+{
+	if (agent_positions.empty()) { return; }
+
+	std::vector<float> xs;
+	xs.reserve(agent_positions.size());
+	for (int i = 0; i < agent_positions.size(); i++) {
+		if (slots[i].local >= 0) {
+			xs.push_back(agent_positions[i].x);
+		}
+	}
+	if (xs.empty()) { return; }
+
+	partitions.front().min_x = -std::numeric_limits<float>::max();
+	partitions.back().max_x = std::numeric_limits<float>::max();
+	for (int i = 1; i < partitions.size(); i++) {
+		auto split = xs.begin() + (i * xs.size()) / partitions.size();
+		std::nth_element(xs.begin(), split, xs.end());
+		partitions[i-1].max_x = *split;
+		partitions[i].min_x = *split;
+	}
+}
+
+void CrowdManager::migrate()
+{
+	for (uint32_t i = 0; i < slots.size(); i++) {
+		if (slots[i].local < 0) { continue; }
+		const crowd_partition_t &partition = partitions[slots[i].partition];
+		const float x = agent_positions[i].x;
+		if (x < partition.min_x - MIGRATION_MARGIN || x > partition.max_x + MIGRATION_MARGIN) {
+			move_agent(i, partition_at(x));
+		}
+	}
+}
+
+// adds the agent to the other crowd with its speed and move request, then removes the original
+bool CrowdManager::move_agent(uint32_t index, uint32_t destination)
+{
+	crowd_slot_t &slot = slots[index];
+	if (slot.partition == destination) { return true; }
+
+	crowd_partition_t &source = partitions[slot.partition];
+	crowd_partition_t &target = partitions[destination];
+
+	// agents near the border are already a ghost in the other crowd
+	remove_ghost(target, index);
+
+	const dtCrowdAgent *agent = source.crowd->getAgent(slot.local);
+	int local = target.crowd->addAgent(agent->npos, &agent->params);
+	if (local < 0) {
+		// the other crowd is full so it stays where it is
+		return false;
+	}
+
+	dtCrowdAgent *moved = target.crowd->getEditableAgent(local);
+	std::copy(agent->vel, agent->vel + 3, moved->vel);
+	std::copy(agent->dvel, agent->dvel + 3, moved->dvel);
+	std::copy(agent->nvel, agent->nvel + 3, moved->nvel);
+	moved->desiredSpeed = agent->desiredSpeed;
+	if (agent->targetState == DT_CROWDAGENT_TARGET_VELOCITY) {
+		target.crowd->requestMoveVelocity(local, agent->targetPos);
+	} else if (agent->targetRef) {
+		target.crowd->requestMoveTarget(local, agent->targetRef, agent->targetPos);
+	}
+
+	source.crowd->removeAgent(slot.local);
+	source.agents[slot.local] = -1;
+	source.count--;
+
+	target.agents[local] = index;
+	target.count++;
+
+	slot.partition = destination;
+	slot.local = local;
+
+	return true;
+}
+
+// ghosts are frozen copies of the agents near the border of a partition
+// they never move on their own but the agents of the partition avoid them
+void CrowdManager::exchange_ghosts()
+{
+	for (uint32_t p = 0; p < partitions.size(); p++) {
+		crowd_partition_t &partition = partitions[p];
+		const float min_x = partition.min_x - GHOST_MARGIN;
+		const float max_x = partition.max_x + GHOST_MARGIN;
+
+		// forget agents that left the border or moved into this partition
+		for (auto it = partition.ghosts.begin(); it != partition.ghosts.end(); ) {
+			const uint32_t index = it->first;
+			const float x = agent_positions[index].x;
+			if (slots[index].partition == p || x < min_x || x > max_x) {
+				partition.crowd->removeAgent(it->second);
+				it = partition.ghosts.erase(it);
+			} else {
+				++it;
+			}
+		}
+
+		for (uint32_t i = 0; i < slots.size(); i++) {
+			const crowd_slot_t &slot = slots[i];
+			if (slot.local < 0 || slot.partition == p) { continue; }
+			const float x = agent_positions[i].x;
+			if (x < min_x || x > max_x) { continue; }
+
+			const dtCrowdAgent *agent = partitions[slot.partition].crowd->getAgent(slot.local);
+
+			auto ghost = partition.ghosts.find(i);
+			if (ghost == partition.ghosts.end()) {
+				dtCrowdAgentParams params = agent->params;
+				params.updateFlags = 0;
+				int local = partition.crowd->addAgent(agent->npos, &params);
+				if (local < 0) { continue; }
+				ghost = partition.ghosts.insert(std::make_pair(i, local)).first;
+			}
+
+			dtCrowdAgent *copy = partition.crowd->getEditableAgent(ghost->second);
+			// invalid agents are skipped by the crowd update but still found as neighbours
+			copy->state = DT_CROWDAGENT_STATE_INVALID;
+			std::copy(agent->npos, agent->npos + 3, copy->npos);
+			std::copy(agent->vel, agent->vel + 3, copy->vel);
+			std::copy(agent->dvel, agent->dvel + 3, copy->dvel);
+		}
+	}
+}
+
+void CrowdManager::remove_ghost(crowd_partition_t &partition, uint32_t index)
+{
+	auto ghost = partition.ghosts.find(index);
+	if (ghost != partition.ghosts.end()) {
+		partition.crowd->removeAgent(ghost->second);
+		partition.ghosts.erase(ghost);
+	}
+}
+
+void CrowdManager::export_agents()
+{
+	#pragma omp parallel for
+	for (int p = 0; p < partitions.size(); p++) {
+		const crowd_partition_t &partition = partitions[p];
+		const int count = partition.crowd->getAgentCount();
+		for (int i = 0; i < count; i++) {
+			const int32_t index = partition.agents[i];
+			if (index < 0) { continue; }
+			const dtCrowdAgent *agent = partition.crowd->getAgent(i);
+			agent_positions[index] = glm::make_vec3(agent->npos);
+			agent_velocities[index] = glm::make_vec3(agent->vel);
+		}
+	}
+}
+
+// flocking agents are steered in the crowd update, the others go to the crowd straight away
+void CrowdManager::request_velocity(uint32_t index, const glm::vec3 &velocity)
+{
+	int local = -1;
+	dtCrowd *crowd = find_agent(index, local);
+	if (!crowd) { return; }
+
+	if (steerings[index] == crowd_steering::FLOCKING) {
+		preferred[index] = 1;
+		preferred_velocities[index] = velocity;
+	} else {
+		crowd->requestMoveVelocity(local, glm::value_ptr(velocity));
+	}
+}
+
+// counting sort of the agents by cell so every cell is one range in cell_agents
+void CrowdManager::build_hash()
+{
+	uint32_t size = 1;
+	while (size < 2 * slots.size()) { size <<= 1; }
+
+	cell_starts.assign(size + 1, 0);
+	cell_agents.resize(slots.size());
+
+	for (uint32_t i = 0; i < agent_positions.size(); i++) {
+		if (slots[i].local < 0) { continue; }
+		const glm::vec3 &position = agent_positions[i];
+		cell_starts[hash_cell(floorf(position.x / FLOCK_RADIUS), floorf(position.z / FLOCK_RADIUS)) + 1]++;
+	}
+	for (uint32_t i = 0; i < size; i++) {
+		cell_starts[i+1] += cell_starts[i];
+	}
+
+	// cell_starts[cell] is used as the fill cursor and ends up at the start of the next cell
+	for (uint32_t i = 0; i < agent_positions.size(); i++) {
+		if (slots[i].local < 0) { continue; }
+		const glm::vec3 &position = agent_positions[i];
+		const uint32_t cell = hash_cell(floorf(position.x / FLOCK_RADIUS), floorf(position.z / FLOCK_RADIUS));
+		cell_agents[cell_starts[cell]++] = i;
+	}
+	for (uint32_t i = size; i > 0; i--) {
+		cell_starts[i] = cell_starts[i-1];
+	}
+	cell_starts[0] = 0;
+}
+
+uint32_t CrowdManager::hash_cell(int32_t x, int32_t z) const
+{
+	const uint32_t hash = (uint32_t(x) * 73856093u) ^ (uint32_t(z) * 19349663u);
+
+	return hash & (cell_starts.size() - 2);
+}
+
+// preferred velocity with separation, cohesion and alignment, then pushed out of the ORCA half-planes of the neighbours
+glm::vec3 CrowdManager::flock(uint32_t index, float dt) const
+{
+	const dtCrowdAgent *agent = partitions[slots[index].partition].crowd->getAgent(slots[index].local);
+	const glm::vec2 position = { agent_positions[index].x, agent_positions[index].z };
+	const glm::vec2 velocity = { agent_velocities[index].x, agent_velocities[index].z };
+	const float max_speed = agent->params.maxSpeed;
+
+	glm::vec2 separation = {};
+	glm::vec2 centroid = {};
+	glm::vec2 heading = {};
+	orca_line_t lines[MAX_FLOCK_NEIGHBOURS];
+	int count = 0;
+
+	const int32_t cx = floorf(position.x / FLOCK_RADIUS);
+	const int32_t cz = floorf(position.y / FLOCK_RADIUS);
+	for (int32_t z = cz - 1; z <= cz + 1 && count < MAX_FLOCK_NEIGHBOURS; z++) {
+		for (int32_t x = cx - 1; x <= cx + 1 && count < MAX_FLOCK_NEIGHBOURS; x++) {
+			const uint32_t cell = hash_cell(x, z);
+			for (uint32_t i = cell_starts[cell]; i < cell_starts[cell+1] && count < MAX_FLOCK_NEIGHBOURS; i++) {
+				const uint32_t other = cell_agents[i];
+				if (other == index) { continue; }
+				const glm::vec2 other_position = { agent_positions[other].x, agent_positions[other].z };
+				const glm::vec2 offset = other_position - position;
+				const float distance = glm::length(offset);
+				// different cells can share a hash bucket
+				if (distance > FLOCK_RADIUS) { continue; }
+
+				const glm::vec2 other_velocity = { agent_velocities[other].x, agent_velocities[other].z };
+				if (distance > 0.001f) {
+					separation -= offset / (distance * distance);
+				}
+				centroid += other_position;
+				heading += other_velocity;
+				int other_local = -1;
+				dtCrowd *other_crowd = find_agent(other, other_local);
+				const float radius = agent->params.radius + (other_crowd ? other_crowd->getAgent(other_local)->params.radius : agent->params.radius);
+				lines[count++] = orca_line(offset, velocity, other_velocity, radius, dt);
+			}
+		}
+	}
+
+	glm::vec2 result = { preferred_velocities[index].x, preferred_velocities[index].z };
+	if (count > 0) {
+		centroid /= float(count);
+		heading /= float(count);
+		result += SEPARATION_WEIGHT * separation;
+		result += COHESION_WEIGHT * (centroid - position);
+		result += ALIGNMENT_WEIGHT * (heading - velocity);
+	}
+
+	// project on every violated half-plane in turn, a few passes get close enough to the ORCA solution
+	for (int pass = 0; pass < 2; pass++) {
+		for (int i = 0; i < count; i++) {
+			const orca_line_t &line = lines[i];
+			const glm::vec2 relative = result - line.point;
+			if (line.direction.x * relative.y - line.direction.y * relative.x < 0.f) {
+				result = line.point + glm::dot(relative, line.direction) * line.direction;
+			}
+		}
+	}
+
+	const float speed = glm::length(result);
+	if (speed > max_speed) {
+		result *= max_speed / speed;
+	}
+
+	return glm::vec3(result.x, preferred_velocities[index].y, result.y);
+}
+
+// half-plane of velocities that do not collide with the neighbour within the time horizon, as in RVO2
+// the velocities on the left of the line are allowed
+static orca_line_t orca_line(const glm::vec2 &relative_position, const glm::vec2 &velocity, const glm::vec2 &other_velocity, float radius, float dt)
+{
+	const glm::vec2 relative_velocity = velocity - other_velocity;
+	const float distance_sq = glm::dot(relative_position, relative_position);
+	const float radius_sq = radius * radius;
+
+	orca_line_t line;
+	glm::vec2 u;
+
+	if (distance_sq > radius_sq) {
+		// no collision yet
+		const glm::vec2 w = relative_velocity - relative_position / ORCA_TIME_HORIZON;
+		const float w_length_sq = glm::dot(w, w);
+		const float dot = glm::dot(w, relative_position);
+		if (dot < 0.f && dot * dot > radius_sq * w_length_sq) {
+			// project on the cut-off circle
+			const float w_length = sqrtf(w_length_sq);
+			const glm::vec2 unit_w = w / w_length;
+			line.direction = glm::vec2(unit_w.y, -unit_w.x);
+			u = (radius / ORCA_TIME_HORIZON - w_length) * unit_w;
+		} else {
+			// project on the legs
+			const float leg = sqrtf(distance_sq - radius_sq);
+			if (relative_position.x * w.y - relative_position.y * w.x > 0.f) {
+				line.direction = glm::vec2(relative_position.x * leg - relative_position.y * radius, relative_position.x * radius + relative_position.y * leg) / distance_sq;
+			} else {
+				line.direction = -glm::vec2(relative_position.x * leg + relative_position.y * radius, -relative_position.x * radius + relative_position.y * leg) / distance_sq;
+			}
+			u = glm::dot(relative_velocity, line.direction) * line.direction - relative_velocity;
+		}
+	} else {
+		// already overlapping, get apart within one step
+		const float inverse_step = dt > 0.f ? 1.f / dt : 0.f;
+		const glm::vec2 w = relative_velocity - inverse_step * relative_position;
+		const float w_length = glm::length(w);
+		const glm::vec2 unit_w = w_length > 0.f ? w / w_length : glm::vec2(1.f, 0.f);
+		line.direction = glm::vec2(unit_w.y, -unit_w.x);
+		u = (radius * inverse_step - w_length) * unit_w;
+	}
+
+	// both agents take half of the responsibility
+	line.point = velocity + 0.5f * u;
+
+	return line;
+}
+
+static void setup_avoidance(dtCrowd *crowd)
+{
+	// Setup local avoidance params to different qualities.
+	dtObstacleAvoidanceParams params;
+	// Use mostly default settings, copy from dtCrowd.
+	memcpy(&params, crowd->getObstacleAvoidanceParams(0), sizeof(dtObstacleAvoidanceParams));
+
+	// Low (11)
+	params.velBias = 0.5f;
+	params.adaptiveDivs = 5;
+	params.adaptiveRings = 2;
+	params.adaptiveDepth = 1;
+	crowd->setObstacleAvoidanceParams(0, &params);
+
+	// Medium (22)
+	params.velBias = 0.5f;
+	params.adaptiveDivs = 5;
+	params.adaptiveRings = 2;
+	params.adaptiveDepth = 2;
+	crowd->setObstacleAvoidanceParams(1, &params);
+
+	// Good (45)
+	params.velBias = 0.5f;
+	params.adaptiveDivs = 7;
+	params.adaptiveRings = 2;
+	params.adaptiveDepth = 3;
+	crowd->setObstacleAvoidanceParams(2, &params);
+
+	// High (66)
+	params.velBias = 0.5f;
+	params.adaptiveDivs = 7;
+	params.adaptiveRings = 3;
+	params.adaptiveDepth = 3;
+
+	crowd->setObstacleAvoidanceParams(3, &params);
+}
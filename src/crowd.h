@@ -4,11 +4,22 @@ struct target_result {
 	dtPolyRef ref;
 };
 
+// how an agent avoids the others
+enum class crowd_steering : uint8_t {
+	AVOIDANCE, // sampled velocity obstacles of Detour, best quality and most expensive
+	FLOCKING // separation, cohesion and alignment with simple ORCA half-planes, for agents far from the camera
+};
+
+// agents are split over several crowds by position so the crowds can be updated in parallel
+// each crowd simulates a strip of the world along the x axis, the strips are resized to keep the crowds balanced
+// agents close to the border of a strip are copied into the neighbouring crowd as ghosts so avoidance still sees them
 class CrowdManager {
 public:
 	CrowdManager(dtNavMesh *navmesh);
 	~CrowdManager();
-	void add_agent(glm::vec3 start, glm::vec3 destination, const dtNavMeshQuery *navquery);
+	// returns the index of the agent or -1 if it could not be placed, indices of removed agents are reused
+	int32_t add_agent(glm::vec3 start, glm::vec3 destination, const dtNavMeshQuery *navquery);
+	void remove_agent(uint32_t index);
 	void update(float dt);
 	glm::vec3 agent_velocity(uint32_t index);
 	glm::vec3 agent_position(uint32_t index);
@@ -19,6 +30,50 @@ public:
 	dtPolyRef agent_polyref(uint32_t index);
 	void teleport_agent(uint32_t index, glm::vec3 position);
 	void set_agent_velocity(uint32_t index, glm::vec3 velocity);
+	void steer_agent(uint32_t index, const util::FlowField *field);
+	void agent_steering(uint32_t index, crowd_steering steering);
+	uint32_t agent_count() const { return slots.size(); }
+	// positions and velocities of every agent after the last update, by agent index
+	const std::vector<glm::vec3>& positions() const { return agent_positions; }
+	const std::vector<glm::vec3>& velocities() const { return agent_velocities; }
+private:
+	struct crowd_slot_t {
+		uint32_t partition = 0;
+		int local = -1; // index of the agent in the crowd of its partition
+	};
+	struct crowd_partition_t {
+		dtCrowd *crowd = nullptr;
+		float min_x = 0.f;
+		float max_x = 0.f;
+		uint32_t count = 0; // agents without the ghosts
+		std::vector<int32_t> agents; // agent index of every crowd agent, -1 for ghosts and free ones
+		std::unordered_map<uint32_t, int> ghosts; // agent index to the crowd agent of its ghost
+	};
+	std::vector<crowd_partition_t> partitions;
+	std::vector<crowd_slot_t> slots;
+	std::vector<uint32_t> free_slots;
+	std::vector<glm::vec3> agent_positions;
+	std::vector<glm::vec3> agent_velocities;
+	uint32_t frame = 0;
+	// flocking agents, their velocity request is steered before it goes to the crowd
+	std::vector<crowd_steering> steerings;
+	std::vector<uint8_t> preferred; // if a velocity was requested this frame
+	std::vector<glm::vec3> preferred_velocities;
+	std::vector<glm::vec3> steered_velocities;
+	// spatial hash of the agents for the flocking neighbour lookup
+	std::vector<uint32_t> cell_starts;
+	std::vector<uint32_t> cell_agents;
 private:
-	dtCrowd *dtcrowd;
+	dtCrowd* find_agent(uint32_t index, int &local) const;
+	uint32_t partition_at(float x) const;
+	void rebalance();
+	void migrate();
+	bool move_agent(uint32_t index, uint32_t destination);
+	void exchange_ghosts();
+	void remove_ghost(crowd_partition_t &partition, uint32_t index);
+	void export_agents();
+	void request_velocity(uint32_t index, const glm::vec3 &velocity);
+	void build_hash();
+	uint32_t hash_cell(int32_t x, int32_t z) const;
+	glm::vec3 flock(uint32_t index, float dt) const;
 };
@@ -0,0 +1,84 @@
+#include <vector>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "formation.h"
+
+static const float SOLDIER_RADIUS = 0.5f;
+static const float TURN_RATE = 1.f; // radians per second the facing of an aggregated formation can turn
+static const float MIN_GATHER_SPEED = 0.1f; // slower soldiers keep the facing the formation had
+
+static glm::vec2 right_of(const glm::vec2 &facing);
+
+Formation::Formation(const glm::vec2 &facing)
+	: facing(glm::normalize(facing))
+{
+}
+
+void Formation::gather(const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &velocities)
+{
+	if (positions.empty()) { return; }
+
+	centroid = glm::vec3(0.f);
+	velocity = glm::vec3(0.f);
+	for (int i = 0; i < positions.size(); i++) {
+		centroid += positions[i];
+		velocity += velocities[i];
+	}
+	centroid /= float(positions.size());
+	velocity /= float(positions.size());
+
+	glm::vec2 heading = { velocity.x, velocity.z };
+	if (glm::length(heading) > MIN_GATHER_SPEED) {
+		facing = glm::normalize(heading);
+	}
+
+	// slot offsets in formation space so they turn with the formation
+	const glm::vec2 right = right_of(facing);
+	offsets.resize(positions.size());
+	radius = 0.f;
+	for (int i = 0; i < positions.size(); i++) {
+		glm::vec2 offset = { positions[i].x - centroid.x, positions[i].z - centroid.z };
+		offsets[i] = glm::vec2(glm::dot(offset, right), glm::dot(offset, facing));
+		radius = glm::max(radius, glm::length(offset));
+	}
+	radius += SOLDIER_RADIUS;
+}
+
+void Formation::update(float delta, const glm::vec2 &direction, float speed, float height)
+{
+	if (glm::length(direction) > 0.f) {
+		// turn towards the direction at a limited rate like a real unit would wheel
+		const glm::vec2 target = glm::normalize(direction);
+		float angle = atan2f(facing.x * target.y - facing.y * target.x, glm::dot(facing, target));
+		angle = glm::clamp(angle, -TURN_RATE * delta, TURN_RATE * delta);
+		const float c = cosf(angle);
+		const float s = sinf(angle);
+		facing = glm::normalize(glm::vec2(c * facing.x - s * facing.y, s * facing.x + c * facing.y));
+		velocity = speed * glm::vec3(target.x, 0.f, target.y);
+	} else {
+		velocity = glm::vec3(0.f);
+	}
+
+	centroid += delta * velocity;
+	centroid.y = height;
+}
+
+void Formation::push(const glm::vec2 &offset)
+{
+	centroid.x += offset.x;
+	centroid.z += offset.y;
+}
+
+glm::vec3 Formation::slot_position(uint32_t slot) const
+{
+	const glm::vec2 right = right_of(facing);
+	const glm::vec2 offset = offsets[slot].x * right + offsets[slot].y * facing;
+
+	return glm::vec3(centroid.x + offset.x, centroid.y, centroid.z + offset.y);
+}
+
+static glm::vec2 right_of(const glm::vec2 &facing)
+{
+	return glm::vec2(facing.y, -facing.x);
+}
@@ -0,0 +1,27 @@
+// a unit of soldiers simulated as one body while nobody is close enough to see the soldiers
+// the slot offsets keep the arrangement of the soldiers so they come back where they were
+class Formation {
+public:
+	bool aggregated = false;
+	uint16_t team = 0; // side the soldiers fight for
+public:
+	Formation(const glm::vec2 &facing);
+	// takes over the state of the individual soldiers, in slot order
+	void gather(const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &velocities);
+	// moves the whole formation, the direction comes from the navigation of the centroid
+	void update(float delta, const glm::vec2 &direction, float speed, float height);
+	// pushes the formation out of another one, the footprint is a circle around the centroid
+	void push(const glm::vec2 &offset);
+	glm::vec3 slot_position(uint32_t slot) const;
+	glm::vec3 get_centroid() const { return centroid; }
+	glm::vec2 get_facing() const { return facing; }
+	glm::vec3 get_velocity() const { return velocity; }
+	float get_radius() const { return radius; }
+	uint32_t size() const { return offsets.size(); }
+private:
+	glm::vec3 centroid = {};
+	glm::vec2 facing = { 0.f, 1.f };
+	glm::vec3 velocity = {};
+	float radius = 0.f;
+	std::vector<glm::vec2> offsets; // x to the right and y forward of the facing
+};
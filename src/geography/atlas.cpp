@@ -23,6 +23,8 @@
 #include "../geometry/geom.h"
 #include "../geometry/voronoi.h"
 #include "../util/image.h"
+#include "../util/heightquery.h"
+#include "../util/heightpyramid.h"
 #include "../module/module.h"
 #include "terragen.h"
 #include "worldgraph.h"
@@ -670,6 +672,37 @@ void Atlas::create_mapdata(long seed)
 		}
 	}
 	create_factions_map();
+
+	// both after generating and loading, the loaded images may have been reallocated
+	terrain_heights.bind(&terragen->heightmap, SCALE);
+	water_heights.bind(&watermap, SCALE);
+	terrain_pyramid.build(&terrain_heights);
+	water_pyramid.build(&water_heights);
+}
+	
+float Atlas::sample_height(const glm::vec2 &position) const
+{
+	// water surface is on top of the sea floor
+	return std::max(terrain_heights.height(position.x, position.y), water_heights.height(position.x, position.y));
+}
+
+bool Atlas::intersect_ray(const glm::vec3 &origin, const glm::vec3 &direction, float max_distance, glm::vec3 &point) const
+{
+	float distance = max_distance;
+	float water_distance = max_distance;
+	bool hit = terrain_pyramid.intersect(origin, direction, max_distance, distance);
+	if (water_pyramid.intersect(origin, direction, max_distance, water_distance)) {
+		if (!hit || water_distance < distance) {
+			distance = water_distance;
+		}
+		hit = true;
+	}
+
+	if (hit) {
+		point = origin + distance * direction;
+	}
+
+	return hit;
 }
 	
 const util::Image<uint8_t>* Atlas::get_vegetation() const
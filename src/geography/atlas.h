@@ -42,6 +42,11 @@ public:
 	Worldgraph* get_worldgraph();
 public:
 	const tile_t* tile_at_position(const glm::vec2 &position) const;
+	// height of the land or water surface, whichever is higher
+	float sample_height(const glm::vec2 &position) const;
+	bool intersect_ray(const glm::vec3 &origin, const glm::vec3 &direction, float max_distance, glm::vec3 &point) const;
+	const util::HeightQuery* get_terrain_heights() const { return &terrain_heights; }
+	const util::HeightPyramid* get_terrain_pyramid() const { return &terrain_pyramid; }
 public:
 	void colorize_holding(uint32_t holding, const glm::vec3 &color);
 public:
@@ -70,6 +75,10 @@ private:
 	util::Image<float> container;
 	util::Image<float> detail;
 	util::Image<uint8_t> mask;
+	util::HeightQuery terrain_heights;
+	util::HeightQuery water_heights;
+	util::HeightPyramid terrain_pyramid;
+	util::HeightPyramid water_pyramid;
 private:
 	std::unordered_map<uint32_t, holding_t> holdings;
 	std::unordered_map<uint32_t, uint32_t> holding_tiles;
@@ -6,6 +6,8 @@
 #include <array>
 #include <map>
 #include <chrono>
+#include <functional>
+#include <string>
 
 #include <GL/glew.h>
 #include <GL/gl.h>
@@ -17,6 +19,9 @@
 
 #include "../geometry/geom.h"
 #include "../util/image.h"
+#include "../util/heightquery.h"
+#include "../util/heightpyramid.h"
+#include "../util/taskgraph.h"
 #include "../module/module.h"
 #include "../graphics/texture.h"
 #include "../graphics/mesh.h"
@@ -83,6 +88,8 @@ Landscape::Landscape(const module::Module *mod, uint16_t heightres)
 	m_module = mod;
 
 	heightmap.resize(heightres, heightres, util::COLORSPACE_GRAYSCALE);
+	// the heightmap keeps its size so the queries can read it in place
+	heights.bind(&heightmap, SCALE);
 	normalmap.resize(heightres, heightres, util::COLORSPACE_RGB);
 	valleymap.resize(heightres, heightres, util::COLORSPACE_RGB);
 
@@ -146,25 +153,46 @@ void Landscape::generate(long campaign_seed, uint32_t tileref, int32_t local_see
 	create_valleymap();
 
 	gen_heightmap(local_seed, amplitude);
+	pyramid.build(&heights);
 
-	// create the normalmap
-	normalmap.create_normalmap(&heightmap, 32.f);
+	// everything after the heightmap only reads it so the stages can run next to each other
+	util::TaskGraph graph;
+	const uint32_t normals = graph.add("normalmap", [&]() {
+		normalmap.create_normalmap(&heightmap, 32.f);
+	});
 
+	std::vector<uint32_t> forest_dependencies = { normals };
 	// if scene is a town generate the site
 	if (site_radius > 0) {
-		create_sitemasks(site_radius);
-		place_houses(walled, site_radius, local_seed, temperature);
+		forest_dependencies.push_back(graph.add("site masks", [&]() {
+			create_sitemasks(site_radius);
+		}));
+		graph.add("houses", [&]() {
+			place_houses(walled, site_radius, local_seed, temperature);
+		});
 	}
 
 	if (walled) {
-		place_walls();
+		graph.add("walls", [&]() {
+			place_walls();
+		});
 	}
 
 	printf("precipitation %d\n", precipitation);
 	printf("tree density %d\n", tree_density);
+	// trees are kept off the roads in the site masks and off steep slopes in the normalmap
 	if (nautical == false && precipitation > 0 && tree_density > 0) {
-		gen_forest(local_seed, precipitation, temperature, tree_density);
+		graph.add("forest", [&]() {
+			gen_forest(local_seed, precipitation, temperature, tree_density);
+		}, forest_dependencies);
 	}
+
+	graph.run();
+}
+
+void Landscape::generate(const site_parameters_t &site)
+{
+	generate(site.campaign_seed, site.tileref, site.local_seed, site.amplitude, site.precipitation, site.temperature, site.tree_density, site.site_radius, site.walled, site.nautical);
 }
 
 const util::Image<float>* Landscape::get_heightmap(void) const
@@ -662,11 +690,7 @@ void Landscape::fill_wall(geom::segment_t S, wall_t *wall, wall_t *wall_left, wa
 
 float Landscape::sample_heightmap(const glm::vec2 &real) const
 {
-	glm::vec2 imagespace = {
-		heightmap.width() * (real.x / SCALE.x),
-		heightmap.height() * (real.y / SCALE.z)
-	};
-	return SCALE.y * heightmap.sample(roundf(imagespace.x), roundf(imagespace.y), util::CHANNEL_RED);
+	return heights.height(real.x, real.y);
 }
 	
 static landgen_parameters random_landgen_parameters(int32_t seed)
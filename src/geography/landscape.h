@@ -24,6 +24,20 @@ struct tree_t {
 	std::vector<geom::transformation_t> transforms;
 };
 
+// everything the generation of a battle site depends on besides the module
+struct site_parameters_t {
+	long campaign_seed = 0;
+	uint32_t tileref = 0;
+	int32_t local_seed = 0;
+	float amplitude = 0.f;
+	uint8_t precipitation = 0;
+	uint8_t temperature = 0;
+	uint8_t tree_density = 0;
+	uint8_t site_radius = 0;
+	bool walled = false;
+	bool nautical = false;
+};
+
 class Landscape {
 public:
 	glm::vec3 SCALE = { 6144.F, 1024.F, 6144.F };
@@ -38,6 +52,7 @@ public:
 public:
 	void clear(void);
 	void generate(long campaign_seed, uint32_t tileref, int32_t local_seed, float amplitude, uint8_t precipitation, uint8_t temperature, uint8_t tree_density, uint8_t site_radius, bool walled, bool nautical);
+	void generate(const site_parameters_t &site);
 public:
 	const util::Image<float>* get_heightmap(void) const;
 	const util::Image<uint8_t>* get_normalmap(void) const;
@@ -45,9 +60,13 @@ public:
 	const std::vector<tree_t>& get_trees(void) const;
 	const std::vector<building_group_t>& get_houses(void) const;
 	const std::vector<wall_t>& get_walls() const { return m_walls; };
+	const util::HeightQuery* get_heights() const { return &heights; };
+	const util::HeightPyramid* get_pyramid() const { return &pyramid; };
 	float sample_heightmap(const glm::vec2 &real) const;
 private:
 	util::Image<float> heightmap;
+	util::HeightQuery heights;
+	util::HeightPyramid pyramid;
 	util::Image<float> container;
 	util::Image<uint8_t> valleymap;
 private:
@@ -0,0 +1,127 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <thread>
+
+#include <GL/glew.h>
+#include <GL/gl.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "../extern/poisson/PoissonGenerator.h"
+
+#include "../geometry/geom.h"
+#include "../util/image.h"
+#include "../util/heightquery.h"
+#include "../util/heightpyramid.h"
+#include "../util/hash.h"
+#include "../module/module.h"
+#include "../graphics/texture.h"
+#include "../graphics/mesh.h"
+#include "../graphics/model.h"
+#include "../media.h"
+#include "sitegen.h"
+#include "landscape.h"
+#include "sitecache.h"
+
+namespace geography {
+
+SiteCache::SiteCache(const module::Module *mod, uint16_t heightres, uint32_t capacity)
+	: module(mod)
+{
+	// the models of the buildings are loaded here on the main thread, generating only reads them
+	slots.resize(capacity);
+	for (auto &slot : slots) {
+		slot.landscape = std::make_unique<Landscape>(mod, heightres);
+		slot.landscape->load_buildings();
+	}
+}
+
+SiteCache::~SiteCache()
+{
+	clear();
+}
+
+void SiteCache::prefetch(const site_parameters_t &site)
+{
+	const uint64_t key = site_key(site);
+	if (find(key)) { return; }
+
+	// least recently used slot that is not being generated right now
+	cached_site_t *victim = nullptr;
+	for (auto &slot : slots) {
+		if (slot.worker.joinable()) { continue; }
+		if (!victim || !slot.valid || (victim->valid && slot.last_used < victim->last_used)) {
+			victim = &slot;
+		}
+	}
+	if (!victim) { return; }
+
+	victim->key = key;
+	victim->valid = true;
+	victim->last_used = ++clock;
+	Landscape *landscape = victim->landscape.get();
+	victim->worker = std::thread([landscape, site]() {
+		landscape->generate(site);
+	});
+}
+
+bool SiteCache::acquire(const site_parameters_t &site, std::unique_ptr<Landscape> &landscape)
+{
+	cached_site_t *slot = find(site_key(site));
+	if (!slot) { return false; }
+
+	if (slot->worker.joinable()) {
+		slot->worker.join();
+	}
+
+	// the landscape of the last battle becomes the spare for the next prefetch
+	std::swap(slot->landscape, landscape);
+	slot->valid = false;
+
+	return true;
+}
+
+void SiteCache::clear()
+{
+	for (auto &slot : slots) {
+		if (slot.worker.joinable()) {
+			slot.worker.join();
+		}
+		slot.valid = false;
+	}
+}
+
+uint64_t SiteCache::site_key(const site_parameters_t &site) const
+{
+	// the fields are added one by one so struct padding stays out of the key
+	util::fnv_hash_t hash;
+	hash.add(module->hash);
+	hash.add(site.campaign_seed);
+	hash.add(site.tileref);
+	hash.add(site.local_seed);
+	hash.add(site.amplitude);
+	hash.add(site.precipitation);
+	hash.add(site.temperature);
+	hash.add(site.tree_density);
+	hash.add(site.site_radius);
+	hash.add(site.walled);
+	hash.add(site.nautical);
+
+	return hash.value;
+}
+
+SiteCache::cached_site_t* SiteCache::find(uint64_t key)
+{
+	for (auto &slot : slots) {
+		if (slot.valid && slot.key == key) {
+			slot.last_used = ++clock;
+			return &slot;
+		}
+	}
+
+	return nullptr;
+}
+
+};
@@ -0,0 +1,31 @@
+namespace geography {
+
+// battle sites generated in the background before the battle starts
+// generating is deterministic so a cached site is the same as one generated when the battle starts
+class SiteCache {
+public:
+	SiteCache(const module::Module *mod, uint16_t heightres, uint32_t capacity);
+	~SiteCache();
+	// starts generating the site on another thread unless it is cached or already being generated
+	void prefetch(const site_parameters_t &site);
+	// swaps the cached site into the landscape and takes the old one as spare, waits if it is still being generated
+	// returns false if the site was never prefetched
+	bool acquire(const site_parameters_t &site, std::unique_ptr<Landscape> &landscape);
+	void clear();
+private:
+	struct cached_site_t {
+		uint64_t key = 0;
+		bool valid = false; // holds a generated or generating site
+		uint64_t last_used = 0;
+		std::unique_ptr<Landscape> landscape;
+		std::thread worker;
+	};
+	const module::Module *module;
+	std::vector<cached_site_t> slots;
+	uint64_t clock = 0;
+private:
+	uint64_t site_key(const site_parameters_t &site) const;
+	cached_site_t* find(uint64_t key);
+};
+
+};
@@ -18,6 +18,7 @@
 
 #include "../geometry/geom.h"
 #include "../util/image.h"
+#include "../util/hash.h"
 #include "texture.h"
 #include "mesh.h"
 #include "model.h"
@@ -35,6 +36,7 @@ static node_t load_node(const cgltf_node *gltfnode);
 static skin_t load_skin(const cgltf_skin *gltfskin);
 static glm::mat4 local_node_transform(const node_t *n);
 static collision_trimesh_t load_collision_trimesh(const cgltf_mesh *mesh);
+static uint64_t hash_contents(const cgltf_data *data);
 static collision_hull_t load_collision_hull(const cgltf_mesh *mesh);
 
 Model::Model(const std::string &filepath)
@@ -56,6 +58,7 @@ Model::Model(const std::string &filepath)
 	if (result == cgltf_result_success) {
 		load_data(filepath, data);
 		find_bounds(data);
+		hash = hash_contents(data);
 	} else {
 		LOG(ERROR, "GLTF") << filepath;
 		print_gltf_error(result);
@@ -348,22 +351,12 @@ static collision_trimesh_t load_collision_trimesh(const cgltf_mesh *gltfmesh)
 
 	meshie.name = gltfmesh->name;
 
-	std::vector<uint8_t> indices;
 	std::vector<uint8_t> positions;
   	uint32_t vertexstart = 0;
-  	uint32_t indexstart = 0;
 	for (int i = 0; i < gltfmesh->primitives_count; i++) {
 		const cgltf_primitive *primitive = &gltfmesh->primitives[i];
-		if (primitive->indices) { 
-			append_buffer(primitive->indices, indices);
-			const void *data = &(indices[indexstart]);
-			const uint16_t *buf = static_cast<const uint16_t*>(data);
-			for (size_t index = 0; index < primitive->indices->count; index++) {
-				meshie.indices.push_back(buf[index]);
-			}
-
-			indexstart = indices.size();
-		}
+		// indices of every primitive start at its own first vertex
+		const uint32_t base = meshie.positions.size();
 		for (int j = 0; j < primitive->attributes_count; j++) {
   			const cgltf_attribute *attribute = &primitive->attributes[j];
 			if (attribute->type == cgltf_attribute_type_position) {
@@ -379,6 +372,12 @@ static collision_trimesh_t load_collision_trimesh(const cgltf_mesh *gltfmesh)
 				vertexstart = positions.size();
 			}
 		}
+		if (primitive->indices) { 
+			// whatever the component type of the file, indices are kept as 32 bit
+			for (size_t index = 0; index < primitive->indices->count; index++) {
+				meshie.indices.push_back(base + uint32_t(cgltf_accessor_read_index(primitive->indices, index)));
+			}
+		}
 	}
 
 	return meshie;
@@ -447,4 +446,20 @@ static void print_gltf_error(cgltf_result error)
 	};
 }
 
+// FNV-1a of the JSON and every buffer, so the hash changes when the file does
+static uint64_t hash_contents(const cgltf_data *data)
+{
+	util::fnv_hash_t hash;
+	if (data->json) {
+		hash.add(data->json, data->json_size);
+	}
+	for (size_t i = 0; i < data->buffers_count; i++) {
+		if (data->buffers[i].data) {
+			hash.add(data->buffers[i].data, data->buffers[i].size);
+		}
+	}
+
+	return hash.value;
+}
+
 };
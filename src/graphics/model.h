@@ -26,7 +26,7 @@ struct node_t {
 struct collision_trimesh_t {
 	std::string name;
 	std::vector<glm::vec3> positions;
-	std::vector<uint16_t> indices;
+	std::vector<uint32_t> indices;
 };
 
 // convex hull data
@@ -41,6 +41,7 @@ public:
 	std::vector<collision_hull_t> collision_hulls;
 	std::vector<skin_t> skins; 
 	glm::vec3 bound_min, bound_max; // model bounding box
+	uint64_t hash = 0; // of the file contents, keys the caches of data built from the model
 public:
 	Model(const std::string &filepath);
 	~Model(void);
@@ -0,0 +1,60 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <functional>
+#include <GL/glew.h>
+#include <GL/gl.h> 
+
+#include <glm/glm.hpp>
+
+#include "../geometry/geom.h"
+#include "../util/image.h"
+#include "texture.h"
+#include "palette.h"
+
+namespace gfx {
+
+void SkinningPalette::alloc(void)
+{
+	transforms.alloc(GL_DYNAMIC_DRAW);
+}
+
+uint32_t SkinningPalette::allocate(uint32_t count)
+{
+	auto it = free_ranges.find(count);
+	if (it != free_ranges.end() && !it->second.empty()) {
+		uint32_t offset = it->second.back();
+		it->second.pop_back();
+		return offset;
+	}
+
+	uint32_t offset = transforms.matrices.size();
+	transforms.matrices.resize(offset + count, glm::mat4(1.f));
+
+	return offset;
+}
+
+void SkinningPalette::release(uint32_t offset, uint32_t count)
+{
+	auto &ranges = free_ranges[count];
+	ranges.insert(std::upper_bound(ranges.begin(), ranges.end(), offset, std::greater<uint32_t>()), offset);
+}
+
+void SkinningPalette::clear(void)
+{
+	transforms.matrices.clear();
+	free_ranges.clear();
+}
+
+void SkinningPalette::update(void)
+{
+	transforms.update();
+}
+
+void SkinningPalette::bind(GLenum unit) const
+{
+	transforms.bind(unit);
+}
+
+};
@@ -0,0 +1,24 @@
+namespace gfx {
+
+// joint matrices of every skinned instance in one buffer texture
+// each instance owns a fixed range so instances can fill their own range in parallel
+// and the whole palette is uploaded in one go
+class SkinningPalette {
+public:
+	void alloc(void);
+	// returns the index of the first joint of a new range
+	// the matrices can move when a range is added so only keep the index
+	uint32_t allocate(uint32_t count);
+	void release(uint32_t offset, uint32_t count);
+	void clear(void);
+	glm::mat4* joints(uint32_t offset) { return &transforms.matrices[offset]; }
+	void update(void);
+	void bind(GLenum unit) const;
+private:
+	TransformBuffer transforms;
+	// released ranges by joint count, reused by instances with the same skeleton
+	// sorted from high to low so the lowest range is reused first and the palette stays packed
+	std::map<uint32_t, std::vector<uint32_t>> free_ranges;
+};
+
+};
@@ -20,6 +20,8 @@
 #include "../util/entity.h"
 #include "../util/camera.h"
 #include "../util/image.h"
+#include "../util/heightquery.h"
+#include "../util/heightpyramid.h"
 #include "shader.h"
 #include "texture.h"
 #include "mesh.h"
@@ -92,7 +94,7 @@ void Terrain::change_rock_color(const glm::vec3 &color)
 	m_rock_color = color;
 }
 
-void Terrain::reload(const util::Image<float> *heightmap, const util::Image<uint8_t> *normalmap, const util::Image<uint8_t> *cadastre)
+void Terrain::reload(const util::Image<float> *heightmap, const util::HeightPyramid *pyramid, const util::Image<uint8_t> *normalmap, const util::Image<uint8_t> *cadastre)
 {
 	relief->reload(heightmap);
 
@@ -100,7 +102,7 @@ void Terrain::reload(const util::Image<float> *heightmap, const util::Image<uint
 
 	sitemasks->reload(cadastre);
 	
-	grass->refresh(heightmap, scale);
+	grass->refresh(pyramid);
 }
 	
 void Terrain::display_land(const util::Camera *camera) const
@@ -269,35 +271,14 @@ GrassSystem::~GrassSystem(void)
 	roots.clear();
 }
 
-void GrassSystem::refresh(const util::Image<float> *heightmap, const glm::vec3 &scale)
+void GrassSystem::refresh(const util::HeightPyramid *pyramid)
 {
-	// update bounding boxes based on new heightmap
+	// fit the bounding boxes to the new heightmap
 	for (auto &chunk : chunks) {
-		// find lowest and highest pixel in terrain heightmap to create bounding box
-		float min_height = std::numeric_limits<float>::max();
-		float max_height = std::numeric_limits<float>::min();
-
-		glm::vec2 min = geom::translate_3D_to_2D(chunk->bbox.min) / geom::translate_3D_to_2D(scale);
-		glm::vec2 max = geom::translate_3D_to_2D(chunk->bbox.max) / geom::translate_3D_to_2D(scale);
-		
-		int rect_min_x = floorf(min.x * heightmap->width());
-		int rect_min_y = floorf(min.y * heightmap->height());
-		int rect_max_x = floorf(max.x * heightmap->width());
-		int rect_max_y = floorf(max.y * heightmap->height());
-
-		for (int i = rect_min_x; i < rect_max_x; i++) {
-			for (int j = rect_min_y; j < rect_max_y; j++) {
-				float height = heightmap->sample(i, j, util::CHANNEL_RED);
-				if (height < min_height) { min_height = height; }
-				if (height > max_height) { max_height = height; }
-			}
-		}
-
-		if (min_height > 0.f && min_height < scale.y)  {
-			chunk->bbox.min.y = scale.y * min_height;
-		}
-		if (max_height > 0.f && max_height < scale.y) {
-			chunk->bbox.max.y = scale.y * max_height;
+		util::height_range_t range = pyramid->bounds(geom::translate_3D_to_2D(chunk->bbox.min), geom::translate_3D_to_2D(chunk->bbox.max));
+		if (!range.empty()) {
+			chunk->bbox.min.y = range.min;
+			chunk->bbox.max.y = range.max;
 		}
 	}
 }
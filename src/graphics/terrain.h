@@ -24,7 +24,7 @@ class GrassSystem {
 public:
 	GrassSystem(const Model *mod);
 	~GrassSystem(void);
-	void refresh(const util::Image<float> *heightmap, const glm::vec3 &scale);
+	void refresh(const util::HeightPyramid *pyramid);
 	void colorize(const glm::vec3 &colr, const glm::vec3 &fogclr, const glm::vec3 &sun, float fogfctr, const glm::vec3 &ambiance);
 	void display(const util::Camera *camera, const glm::vec3 &scale) const;
 private:
@@ -43,7 +43,7 @@ class Terrain {
 public:
 	Terrain(const glm::vec3 &mapscale, const util::Image<float> *heightmap, const util::Image<uint8_t> *normalmap, const util::Image<uint8_t> *cadastre);
 	void insert_material(const std::string &name, const Texture *texture);
-	void reload(const util::Image<float> *heightmap, const util::Image<uint8_t> *normalmap, const util::Image<uint8_t> *cadastre);
+	void reload(const util::Image<float> *heightmap, const util::HeightPyramid *pyramid, const util::Image<uint8_t> *normalmap, const util::Image<uint8_t> *cadastre);
 	void change_atmosphere(const glm::vec3 &sun, const glm::vec3 &fogclr, float fogfctr, const glm::vec3 &ambiance);
 	void change_grass(const glm::vec3 &color, bool enabled);
 	void change_rock_color(const glm::vec3 &color);
@@ -1,4 +1,6 @@
 #include <memory>
+#include <mutex>
+#include <atomic>
 #include <iostream>
 #include <fstream>
 #include <unordered_map>
@@ -9,6 +11,8 @@
 #include <list>
 #include <span>
 #include <array>
+#include <functional>
+#include <cstdio>
 
 #include <SDL2/SDL.h>
 #include <GL/glew.h>
@@ -35,6 +39,7 @@
 #include "extern/cereal/archives/binary.hpp"
 
 #include "extern/ozz/animation/runtime/animation.h"
+#include "extern/ozz/animation/runtime/blending_job.h"
 #include "extern/ozz/animation/runtime/local_to_model_job.h"
 #include "extern/ozz/animation/runtime/sampling_job.h"
 #include "extern/ozz/animation/runtime/skeleton.h"
@@ -59,19 +64,28 @@
 #include "geometry/geom.h"
 #include "geometry/voronoi.h"
 #include "util/image.h"
+#include "util/heightquery.h"
+#include "util/heightpyramid.h"
 #include "util/entity.h"
 #include "util/camera.h"
 #include "util/window.h"
 #include "util/input.h"
 #include "util/timer.h"
 #include "util/animation.h"
+#include "util/mappedfile.h"
+#include "util/navcache.h"
 #include "util/navigation.h"
+#include "util/proximity.h"
+#include "util/flowfield.h"
+#include "util/spatialhash.h"
+#include "util/taskgraph.h"
 #include "module/module.h"
 #include "graphics/text.h"
 #include "graphics/shader.h"
 #include "graphics/mesh.h"
 #include "graphics/texture.h"
 #include "graphics/model.h"
+#include "graphics/palette.h"
 #include "graphics/clouds.h"
 #include "graphics/sky.h"
 #include "graphics/render.h"
@@ -81,6 +95,9 @@
 #include "graphics/forest.h"
 #include "physics/heightfield.h"
 #include "physics/physics.h"
+#include "physics/ground.h"
+#include "physics/scenery.h"
+#include "physics/meshcache.h"
 #include "physics/bumper.h"
 #include "physics/ragdoll.h"
 #include "media.h"
@@ -93,13 +110,21 @@
 #include "geography/atlas.h"
 #include "geography/sitegen.h"
 #include "geography/landscape.h"
+#include "geography/sitecache.h"
 #include "army.h"
 #include "crowd.h"
+#include "formation.h"
 
 #include "campaign.h"
 #include "battle.h"
 //#include "util/sound.h" // TODO replace SDL_Mixer with OpenAL
 
+static const uint32_t MAX_NAVIGATION_TILE_REBUILDS = 2; // per frame
+static const float CROWD_AVOIDANCE_DISTANCE = 30.f; // agents further from the camera use the cheap flocking steering
+static const uint64_t MAX_NAVIGATION_CACHE_SIZE = 512 * 1024 * 1024; // in bytes
+static const uint64_t MAX_BVH_CACHE_SIZE = 512 * 1024 * 1024; // in bytes
+static const float SITE_PREFETCH_DISTANCE = 200.f; // the battle site is generated when the army is this close to its target
+
 enum class game_state {
 	TITLE,
 	NEW_CAMPAIGN,
@@ -118,6 +143,8 @@ struct game_settings_t {
 	float look_sensitivity;
 	// graphics
 	bool clouds_enabled;
+	// physics
+	bool physics_multithreaded;
 };
 
 class Game {
@@ -130,6 +157,7 @@ private:
 	bool debugmode;
 	module::Module modular;
 	std::string save_directory;
+	util::NavigationTileCache navcache;
 	enum game_state state;
 	game_settings_t settings;
 	util::Window window;
@@ -148,6 +176,7 @@ private:
 	void set_opengl_states();
 	void load_shaders();
 	void load_module();
+	void add_title_text();
 private:
 	void prepare_campaign();
 	void run_campaign();
@@ -156,6 +185,7 @@ private:
 	void load_campaign();
 private:
 	void prepare_battle();
+	void display_loading(float progress, const std::string &stage);
 	void run_battle();
 	void update_battle();
 };
@@ -192,6 +222,9 @@ void Game::load_settings()
 	// graphics settings
 	settings.clouds_enabled = reader.GetBoolean("", "CLOUDS_ENABLED", false);
 
+	// physics settings
+	settings.physics_multithreaded = reader.GetBoolean("", "PHYSICS_MULTITHREADED", false);
+
 	// module name
 	settings.module_name = reader.Get("", "MODULE", "native");
 }
@@ -246,6 +279,23 @@ bool Game::init()
 		return false;
 	}
 
+	// built navmesh tiles are kept on disk so revisited sites don't need to run Recast again
+	char *navcachepath = SDL_GetPrefPath("archeon", "navcache");
+	if (navcachepath) {
+		if (navcache.init(navcachepath, MAX_NAVIGATION_CACHE_SIZE)) {
+			battle.navigation.set_tile_cache(&navcache);
+			campaign.landnav.set_tile_cache(&navcache);
+			campaign.seanav.set_tile_cache(&navcache);
+		}
+		SDL_free(navcachepath);
+	}
+	// same for the BVHs of collision meshes
+	char *bvhcachepath = SDL_GetPrefPath("archeon", "bvhcache");
+	if (bvhcachepath) {
+		battle.collision_meshes.init(bvhcachepath, MAX_BVH_CACHE_SIZE);
+		SDL_free(bvhcachepath);
+	}
+
 	textman = new gfx::TextManager { "fonts/exocet.ttf", 40 };
 
 	load_shaders();
@@ -347,12 +397,14 @@ void Game::update_battle()
 		ImGui::Text("ms per frame: %d", timer.ms_per_frame);
 		ImGui::Text("cam position: %f, %f, %f", battle.camera.position.x, battle.camera.position.y, battle.camera.position.z);
 		ImGui::Text("anim mix: %f", battle.player->m_animation_mix);
+		std::vector<uint32_t> nearby;
+		battle.creature_hash.query_radius(battle.player->position, 20.f, util::spatial_filter_t{}, nearby);
+		ImGui::Text("creatures within 20m: %d", int(nearby.size()));
 		if (ImGui::Button("Ragdoll mode")) { 
-			battle.player->m_ragdoll_mode = !battle.player->m_ragdoll_mode; 
 			if (battle.player->m_ragdoll_mode) {
-				battle.player->add_ragdoll(battle.physicsman.get_world());
-			} else {
 				battle.player->remove_ragdoll(battle.physicsman.get_world());
+			} else {
+				battle.player->add_ragdoll(battle.physicsman.get_world());
 			}
 		}
 		if (ImGui::Button("Exit Battle")) { state = game_state::CAMPAIGN; }
@@ -366,43 +418,84 @@ void Game::update_battle()
 
 	input.update_keymap();
 
+	// far away units walk as a single aggregate without creatures or crowd agents
+	battle.update_formations(timer.delta, battle.camera.position, battle.camera.VP);
+
 	// update nav agents
+	// creatures share one goal so they all follow the same flow field instead of pathfinding on their own
+	const util::FlowField *flowfield = battle.flowfields->request(battle.crowd_goal);
+	// agent positions and velocities of the last crowd update, teleports are written back into them
+	const auto &agent_positions = battle.crowd_manager->positions();
+	const auto &agent_velocities = battle.crowd_manager->velocities();
 	for (int i = 0; i < battle.creatures.size(); i++) {
-		//if (time_to_update && result.found) {
-		//crowd->retarget_agent(i, result.position, result.poly);
-		//}
-		glm::vec3 agent_pos = battle.crowd_manager->agent_position(i);
+		const int32_t agent = battle.creature_agents[i];
+		if (agent < 0) { continue; }
+		glm::vec3 agent_pos = agent_positions[agent];
 		//glm::vec3 creature_pos = battle.player->position;
 		glm::vec3 creature_pos = battle.creatures[i]->position;
 		float dist = glm::distance(agent_pos, creature_pos);
 		if (dist > 5.f) {
-			struct target_result target = battle.crowd_manager->agent_target(i);
-			battle.crowd_manager->teleport_agent(i, creature_pos);
-			battle.crowd_manager->retarget_agent(i, target.position, target.ref);
+			battle.crowd_manager->teleport_agent(agent, creature_pos);
 		}
 		const float margin = 0.02f; // nav agent needs to be ahead of creature so it needs a higher speed
-		battle.crowd_manager->agent_speed(i, 6.f + margin);
+		battle.crowd_manager->agent_speed(agent, 6.f + margin);
+		// full avoidance is only worth it where it can be seen up close
+		const bool close = glm::distance(creature_pos, battle.camera.position) < CROWD_AVOIDANCE_DISTANCE;
+		battle.crowd_manager->agent_steering(agent, close ? crowd_steering::AVOIDANCE : crowd_steering::FLOCKING);
+		battle.crowd_manager->steer_agent(agent, flowfield);
 	}
-	// update creatures
+	battle.flowfields->collect();
+	// steer creatures, this sets body velocities so it stays on the main thread
 	for (int i = 0; i < battle.creatures.size(); i++) {
-		glm::vec3 agent_pos = battle.crowd_manager->agent_position(i);
-		glm::vec3 agent_vel = battle.crowd_manager->agent_velocity(i);
-		battle.creatures[i]->stick_to_agent(agent_pos, agent_vel);
+		const int32_t agent = battle.creature_agents[i];
+		if (agent < 0) { continue; }
+		battle.creatures[i]->stick_to_agent(agent_positions[agent], agent_velocities[agent]);
 	}
 
-	for (auto &creature : battle.creatures) {
-		creature->update(battle.physicsman.get_world());
+	// all creatures probe the ground in one batch, most of them only need the heightmap
+	std::vector<physics::ground_probe_t> ground_probes(battle.creatures.size());
+	for (int i = 0; i < battle.creatures.size(); i++) {
+		ground_probes[i] = battle.creatures[i]->ground_probe();
+	}
+	battle.ground.resolve(battle.physicsman.get_world(), ground_probes);
+	for (int i = 0; i < battle.creatures.size(); i++) {
+		battle.creatures[i]->update(battle.physicsman.get_world(), ground_probes[i]);
 	}
 	battle.player->update(battle.physicsman.get_world());
 
 	battle.physicsman.update(timer.delta);
 
 	for (auto &creature : battle.creatures) {
-		creature->sync(timer.delta);
+		creature->sync_body();
+		creature->settle_ragdoll(battle.physicsman.get_world());
 	}
-	battle.player->sync(timer.delta);
+	battle.player->sync_body();
 
+	// distant creatures are sampled less often and off screen creatures not at all
+	std::vector<geom::sphere_t> creature_bounds(battle.creatures.size());
+	for (int i = 0; i < battle.creatures.size(); i++) {
+		creature_bounds[i] = battle.creatures[i]->bounds();
+	}
+	if (!battle.creatures.empty()) {
+		const Creature *creature = battle.creatures.front().get();
+		battle.animation_scheduler.schedule(battle.camera.position, battle.camera.VP, creature_bounds, creature->joint_count(false), creature->joint_count(true));
+	}
+
+	// sampling, blending and skinning matrices are independent for each creature
+	const float delta = timer.delta;
+	#pragma omp parallel for
+	for (int i = 0; i < battle.creatures.size(); i++) {
+		battle.creatures[i]->animate(delta, battle.animation_scheduler.lod(i));
+	}
+	battle.player->animate(delta);
+
+	// OpenGL buffers can only be updated from the main thread
+	battle.palette->update();
+
+	// rebuild navmesh tiles touched by obstacles before the crowd moves over them
+	battle.navigation.update(MAX_NAVIGATION_TILE_REBUILDS);
 	battle.crowd_manager->update(timer.delta);
+	battle.update_creature_hash();
 
 	debug_cylinder.position = battle.crowd_manager->agent_position(0);
 	debug_cylinder.scale = 0.2f;
@@ -420,86 +513,91 @@ void Game::prepare_battle()
 	battle.camera.configure(0.1f, 9001.f, settings.window_width, settings.window_height, float(settings.FOV));
 	battle.camera.project();
 
-	// find the campaign tile the player is on and prepare local scene properties based on it
-	glm::vec2 position = geom::translate_3D_to_2D(campaign.player->position);
-	const auto tily = campaign.atlas.tile_at_position(position);
-	uint32_t tileref = 0;
-	float amp = 0.f;
+	// find the campaign tile of the battle and prepare local scene properties based on it
+	const auto tily = campaign.battle_tile();
 	uint8_t precipitation = 0;
-	uint8_t tree_density = 0;
 	uint8_t temperature = 0;
-	int32_t local_seed = 0;
-	uint8_t site_radius = 0;
 	enum geography::tile_regolith regolith = geography::tile_regolith::SAND;
-	enum geography::tile_feature feature = geography::tile_feature::NONE;
 	if (tily) {
-		battle.naval = !tily->land;
-		amp = tily->amp;
-		tileref = tily->index;
 		precipitation = tily->precipitation;
 		temperature = tily->temperature;
 		regolith = tily->regolith;
-		feature = tily->feature;
-		std::mt19937 gen(campaign.seed);
-		gen.discard(tileref);
-		std::uniform_int_distribution<int32_t> local_seed_distrib;
-		local_seed = local_seed_distrib(gen);
 	}
 
-	if (campaign.player->get_target_type() == TARGET_SETTLEMENT) {
-		auto search = campaign.settlements.find(campaign.battle_info.settlementID);
-		if (search != campaign.settlements.end()) {
-			const auto &settlement = search->second;
-			site_radius = settlement.population;
-		}
-	}
+	const geography::site_parameters_t site = campaign.battle_site();
+	battle.naval = site.nautical;
 
 	glm::vec3 fresh_grass = glm::mix(glm::vec3(1.5f)*modular.palette.grass.min, modular.palette.grass.max, 0.8f);
 	glm::vec3 grasscolor = glm::mix(glm::vec3(1.5f)*modular.palette.grass.min, fresh_grass, precipitation / 255.f);
 
-	if (feature == geography::tile_feature::WOODS) {
-		tree_density = 255;
-	} else if (regolith == geography::tile_regolith::SNOW || regolith == geography::tile_regolith::SAND) {
-		tree_density = 0;
-	} else {
-		tree_density = (precipitation > 64) ? 64 : precipitation;
-	}
+	// stages run as soon as what they need is there, the ones that upload to the GPU stay on the main thread
+	util::TaskGraph graph;
+
+	const uint32_t landscape = graph.add("landscape", [&]() {
+		// usually generated in the background while the army was on its way
+		if (!battle.sites->acquire(site, battle.landscape)) {
+			battle.landscape->generate(site);
+		}
+	});
+
+	const uint32_t wall_models = graph.add("wall models", [&]() {
+		battle.load_wall_models();
+	}, { landscape }, true);
 
-	battle.landscape->generate(campaign.seed, tileref, local_seed, amp, precipitation, temperature, tree_density, site_radius, true, battle.naval);
-	battle.terrain->reload(battle.landscape->get_heightmap(), battle.landscape->get_normalmap(), battle.landscape->get_sitemasks());
-	battle.terrain->change_atmosphere(campaign.battle_info.sun_position, modular.atmosphere.day.horizon, campaign.battle_info.fog_factor, campaign.battle_info.ambiance_color);
+	const uint32_t tree_models = graph.add("tree models", [&]() {
+		battle.load_tree_models();
+	}, { landscape }, true);
+
+	const uint32_t terrain = graph.add("terrain", [&]() {
+		battle.terrain->reload(battle.landscape->get_heightmap(), battle.landscape->get_pyramid(), battle.landscape->get_normalmap(), battle.landscape->get_sitemasks());
+		battle.terrain->change_atmosphere(campaign.battle_info.sun_position, modular.atmosphere.day.horizon, campaign.battle_info.fog_factor, campaign.battle_info.ambiance_color);
 	
-	glm::vec3 rock_color = glm::mix(glm::vec3(0.8f), glm::vec3(1.f), temperature / 255.f);
+		glm::vec3 rock_color = glm::mix(glm::vec3(0.8f), glm::vec3(1.f), temperature / 255.f);
 	
-	bool grass_present = false;
-	// main terrain soil
-	if (regolith == geography::tile_regolith::GRASS) {
-		grass_present = true;
-		battle.terrain->insert_material("REGOLITH_MAP", MediaManager::load_texture("ground/grass.dds"));
-	} else if (regolith == geography::tile_regolith::SAND) {
-		battle.terrain->insert_material("REGOLITH_MAP", MediaManager::load_texture("ground/sand.dds"));
-		grasscolor = glm::vec3(0.96, 0.83, 0.63);
-		rock_color = glm::vec3(0.96, 0.83, 0.63);
-	} else {
-		battle.terrain->insert_material("REGOLITH_MAP", MediaManager::load_texture("ground/snow.dds"));
-		grasscolor = glm::vec3(1.f);
-	}
+		bool grass_present = false;
+		// main terrain soil
+		if (regolith == geography::tile_regolith::GRASS) {
+			grass_present = true;
+			battle.terrain->insert_material("REGOLITH_MAP", MediaManager::load_texture("ground/grass.dds"));
+		} else if (regolith == geography::tile_regolith::SAND) {
+			battle.terrain->insert_material("REGOLITH_MAP", MediaManager::load_texture("ground/sand.dds"));
+			grasscolor = glm::vec3(0.96, 0.83, 0.63);
+			rock_color = glm::vec3(0.96, 0.83, 0.63);
+		} else {
+			battle.terrain->insert_material("REGOLITH_MAP", MediaManager::load_texture("ground/snow.dds"));
+			grasscolor = glm::vec3(1.f);
+		}
 
-	battle.terrain->change_grass(grasscolor, grass_present);
-	battle.terrain->change_rock_color(rock_color);
+		battle.terrain->change_grass(grasscolor, grass_present);
+		battle.terrain->change_rock_color(rock_color);
+	}, { landscape }, true);
 
-	// navigation
-	battle.create_navigation();
+	const uint32_t navigation = graph.add("navigation", [&]() {
+		battle.create_navigation();
+	}, { wall_models });
 
-	// first add the heightfield
-	battle.physicsman.add_heightfield(battle.landscape->get_heightmap(), battle.landscape->SCALE, physics::COLLISION_GROUP_HEIGHTMAP, physics::COLLISION_GROUP_ACTOR | physics::COLLISION_GROUP_RAY | physics::COLLISION_GROUP_RAGDOLL);
+	const uint32_t shapes = graph.add("collision shapes", [&]() {
+		battle.create_collision_shapes();
+	}, { wall_models, tree_models });
 
-	// add entities
-	battle.add_entities(&modular);
+	const uint32_t entities = graph.add("entities", [&]() {
+		// first add the heightfield
+		battle.physicsman.add_heightfield(battle.landscape->get_heightmap(), battle.landscape->SCALE, physics::COLLISION_GROUP_HEIGHTMAP, physics::COLLISION_GROUP_ACTOR | physics::COLLISION_GROUP_RAY | physics::COLLISION_GROUP_RAGDOLL);
 
-	battle.skybox.prepare();
+		// add entities
+		battle.add_entities(&modular);
+	}, { navigation, shapes, terrain }, true);
 
-	battle.forest->set_atmosphere(campaign.battle_info.sun_position, modular.atmosphere.day.horizon, campaign.battle_info.fog_factor, campaign.battle_info.ambiance_color);
+	graph.add("scene", [&]() {
+		battle.skybox.prepare();
+
+		battle.forest->set_atmosphere(campaign.battle_info.sun_position, modular.atmosphere.day.horizon, campaign.battle_info.fog_factor, campaign.battle_info.ambiance_color);
+	}, { entities }, true);
+
+	graph.run([&](float progress, const std::string &stage) {
+		display_loading(progress, stage);
+	});
+	textman->clear();
 
 	if (battle.naval) {
 		battle.camera.position = glm::vec3(3072.f, 270.f, 3072.f);
@@ -514,6 +612,28 @@ void Game::prepare_battle()
 	battle.ordinary->add_object(MediaManager::load_model("cylinder.glb"), ents);
 }
 
+void Game::display_loading(float progress, const std::string &stage)
+{
+	// keeps the window responsive while the battle is loading
+	input.update();
+
+	char percentage[16];
+	snprintf(percentage, sizeof(percentage), "%d%%", int(progress * 100.f));
+
+	textman->clear();
+	textman->add_text("Loading " + stage, glm::vec3(1.f, 1.f, 1.f), glm::vec2(50.f, 100.f));
+	textman->add_text(percentage, glm::vec3(1.f, 1.f, 1.f), glm::vec2(50.f, 50.f));
+
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+	shaders.font.use();
+	glm::mat4 project = glm::ortho(0.0f, float(window.width), 0.0f, float(window.height));
+	shaders.font.uniform_mat4("PROJECT", project);
+	textman->display();
+
+	window.swap();
+}
+
 void Game::run_battle()
 {
 	prepare_battle();
@@ -527,28 +647,53 @@ void Game::run_battle()
 	
 		battle.ordinary->display(&battle.camera);
 
-		const auto instancebuf = battle.player->joints();
-		instancebuf->bind(GL_TEXTURE20);
-		shaders.creature.uniform_bool("RAGDOLL", battle.player->m_ragdoll_mode);
+		battle.palette->bind(GL_TEXTURE20);
+
+		shaders.creature.use();
+		shaders.creature.uniform_int("JOINT_OFFSET", battle.player->joint_offset());
 		battle.creature_scenery->display(&battle.camera);
 
 		shaders.creature.use();
 		shaders.creature.uniform_mat4("VP", battle.camera.VP);
-		shaders.creature.uniform_bool("INSTANCED", false);
-
-		for (const auto &creature : battle.creatures) {
-			const auto joints = creature->joints();
-			joints->bind(GL_TEXTURE20);
-			shaders.creature.uniform_bool("RAGDOLL", creature->m_ragdoll_mode);
 
+		battle.creature_transforms.matrices.resize(battle.creatures.size());
+		for (int i = 0; i < battle.creatures.size(); i++) {
+			const auto &creature = battle.creatures[i];
 			glm::mat4 T = glm::translate(glm::mat4(1.f), creature->position);
 			glm::mat4 R = glm::mat4(creature->rotation);
 			glm::mat4 S = glm::scale(glm::mat4(1.f), glm::vec3(creature->scale));
-			glm::mat4 M = T * R * S;
-			glm::mat4 MVP = battle.camera.VP * M;
-			shaders.creature.uniform_mat4("MVP", MVP);
-			shaders.creature.uniform_mat4("MODEL", M);
-			creature->m_model->display();
+			battle.creature_transforms.matrices[i] = T * R * S;
+		}
+
+		shaders.creature.uniform_bool("INSTANCED", true);
+		if (!battle.creatures.empty()) {
+			battle.creature_transforms.update();
+			battle.creature_transforms.bind(GL_TEXTURE10);
+		}
+		// creatures are kept in palette order, every run of consecutive palette ranges is drawn in one call
+		uint32_t first = 0;
+		while (first < battle.creatures.size()) {
+			const auto &creature = battle.creatures[first];
+			const uint32_t stride = creature->joint_count(false);
+			uint32_t last = first + 1;
+			while (last < battle.creatures.size() && battle.creatures[last]->m_model == creature->m_model && battle.creatures[last]->joint_offset() == creature->joint_offset() + (last - first) * stride) {
+				last++;
+			}
+			shaders.creature.uniform_int("INSTANCE_OFFSET", first);
+			shaders.creature.uniform_int("JOINT_OFFSET", creature->joint_offset());
+			shaders.creature.uniform_int("JOINT_STRIDE", stride);
+			creature->m_model->display_instanced(last - first);
+			first = last;
+		}
+
+		// stand-ins of the aggregated formations all share one pose
+		if (!battle.aggregate_transforms.matrices.empty()) {
+			battle.aggregate_transforms.update();
+			battle.aggregate_transforms.bind(GL_TEXTURE10);
+			shaders.creature.uniform_int("INSTANCE_OFFSET", 0);
+			shaders.creature.uniform_int("JOINT_OFFSET", battle.aggregate_joints);
+			shaders.creature.uniform_int("JOINT_STRIDE", 0);
+			battle.get_creature_model()->display_instanced(battle.aggregate_transforms.matrices.size());
 		}
 
 		battle.forest->display(&battle.camera);
@@ -610,6 +755,8 @@ void Game::update_campaign()
 	campaign.player->update(timer.delta);
 	campaign.player_army.position = { campaign.player->position.x, campaign.player->position.z };
 
+	campaign.stream_navigation();
+
 	if (debugmode) {
 		ImGui_ImplOpenGL3_NewFrame();
 		ImGui_ImplSDL2_NewFrame(window.window);
@@ -627,13 +774,19 @@ void Game::update_campaign()
 		ImGui::End();
 	}
 
-	// trigger battle
+	// generate the site of the coming battle while the army is still on its way
 	if (campaign.player->get_target_type() == TARGET_SETTLEMENT) {
-		if (glm::distance(geom::translate_3D_to_2D(campaign.player->position), geom::translate_3D_to_2D(campaign.marker.position)) < 1.f) {
-			state = game_state::BATTLE;
+		glm::vec2 target = geom::translate_3D_to_2D(campaign.marker.position);
+		if (glm::distance(geom::translate_3D_to_2D(campaign.player->position), target) < SITE_PREFETCH_DISTANCE) {
+			battle.sites->prefetch(campaign.battle_site());
 		}
 	}
 
+	// trigger battle
+	if (campaign.update_proximity()) {
+		state = game_state::BATTLE;
+	}
+
 	input.update_keymap();
 
 	campaign.offset_entities();
@@ -668,6 +821,9 @@ void Game::new_campaign()
 	campaign.atlas.create_sea_navigation();
 	const auto sea_navsoup = campaign.atlas.get_navsoup();
 	campaign.seanav.build(sea_navsoup.vertices, sea_navsoup.indices);
+	// campaign navigation has no obstacles so the input can go
+	campaign.landnav.cleanup();
+	campaign.seanav.cleanup();
 	
 	campaign.spawn_settlements();
 
@@ -683,9 +839,10 @@ void Game::new_campaign()
 	
 void Game::load_campaign()
 {
-	campaign.load(save_directory + "game.save");
-
-	//campaign.add_heightfields();
+	if (!campaign.load(save_directory + "game.save")) {
+		state = game_state::TITLE;
+		return;
+	}
 
 	prepare_campaign();
 
@@ -710,7 +867,7 @@ void Game::prepare_campaign()
 
 	campaign.camera.direct(campaign.camera.direction);
 
-	campaign.add_heightfields();
+	campaign.create_proximity();
 
 	// add campaign entities
 	campaign.marker.position = { 2010.f, 200.f, 2010.f };
@@ -793,12 +950,13 @@ void Game::run()
 
 	// now that the module is loaded we initialize the campaign and battle
 	campaign.init(&window, &shaders);
+	// the battle world is still empty here so it can switch to the multithreaded world
+	battle.physicsman.set_multithreaded(settings.physics_multithreaded);
 	battle.init(&modular, &window, &shaders);
 	
 	state = game_state::TITLE;
 	
-	textman->add_text("Hello World!", glm::vec3(1.f, 1.f, 1.f), glm::vec2(50.f, 400.f));
-	textman->add_text("Archeon Prototype", glm::vec3(1.f, 1.f, 1.f), glm::vec2(50.f, 100.f));
+	add_title_text();
 
 	while (state == game_state::TITLE) {
 		input.update();
@@ -837,15 +995,25 @@ void Game::run()
 
 		window.swap();
 
+		// the loading screen of a battle replaces the text
 		if (state == game_state::NEW_CAMPAIGN) {
 			new_campaign();
+			add_title_text();
 		}
 		if (state == game_state::LOAD_CAMPAIGN) {
 			load_campaign();
+			add_title_text();
 		}
 	}
 }
 
+void Game::add_title_text()
+{
+	textman->clear();
+	textman->add_text("Hello World!", glm::vec3(1.f, 1.f, 1.f), glm::vec2(50.f, 400.f));
+	textman->add_text("Archeon Prototype", glm::vec3(1.f, 1.f, 1.f), glm::vec2(50.f, 100.f));
+}
+
 int main(int argc, char *argv[])
 {
 	Game archeon;
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fstream>
+#include <sstream>
 #include <vector>
 #include <algorithm>
 
@@ -8,6 +9,7 @@
 
 #include "../extern/aixlog/aixlog.h"
 
+#include "../util/hash.h"
 #include "module.h"
 	
 namespace module {
@@ -16,6 +18,7 @@ void Module::load(const std::string &modname)
 {
 	name = modname;
 	path = "modules/" + modname + "/";
+	hash = util::fnv_hash_t().value;
 	
 	load_file(params, path + "worldgen.json");
 
@@ -53,9 +56,17 @@ void Module::save_file(const T &data, const std::string &name, const std::string
 template <class T>
 void Module::load_file(T &data, const std::string &filepath)
 {
-	std::ifstream stream(filepath);
+	std::ifstream file(filepath);
 
-	if (stream.is_open()) {
+	if (file.is_open()) {
+		// the raw text goes into the module hash so caches of generated content notice changes
+		std::stringstream stream;
+		stream << file.rdbuf();
+		const std::string text = stream.str();
+		util::fnv_hash_t fnv;
+		fnv.value = hash;
+		fnv.add(text.data(), text.size());
+		hash = fnv.value;
 		cereal::JSONInputArchive archive(stream);
 		archive(data);
 	} else {
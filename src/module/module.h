@@ -352,6 +352,7 @@ public:
 	ragdoll_armature_import_t test_armature;
 	std::string path;
 	std::string name;
+	uint64_t hash = 0; // of the contents of every loaded file
 public:
 	vegetation_t vegetation;
 	atmosphere_t atmosphere;
@@ -13,8 +13,10 @@
 
 #include "../geometry/geom.h"
 #include "../util/image.h"
+#include "../util/heightquery.h"
 #include "heightfield.h"
 #include "physics.h"
+#include "ground.h"
 
 #include "bumper.h"
 
@@ -89,30 +91,50 @@ btRigidBody* Bumper::body() const
 	return m_body.get();
 }
 
+// the probe scales to avoid "snapping" if the bumper is on the ground or in the air
+ground_probe_t Bumper::ground_probe() const
+{
+	ground_probe_t probe;
+	probe.origin = bt_to_vec3(m_body->getWorldTransform().getOrigin());
+	probe.length = m_grounded ? m_probe_ground : m_probe_air;
+	probe.ignore = m_body.get();
+
+	return probe;
+}
+
 void Bumper::update(const btDynamicsWorld *world)
 {
+	ground_probe_t probe = ground_probe();
+
 	ClosestNotMe ray_callback(m_body.get());
 	ray_callback.m_collisionFilterGroup = COLLISION_GROUP_ACTOR;
 	ray_callback.m_collisionFilterMask = COLLISION_GROUP_ACTOR | COLLISION_GROUP_HEIGHTMAP | COLLISION_GROUP_WORLD;
 	
-	// to avoid "snapping" the probe scales if the bumper is on the ground or in the air
-	float probe_scale = m_grounded ? m_probe_ground : m_probe_air;
-
-	world->rayTest(m_body->getWorldTransform().getOrigin(), m_body->getWorldTransform().getOrigin() - btVector3(0.0f, probe_scale, 0.0f), ray_callback);
+	const btVector3 origin = vec3_to_bt(probe.origin);
+	world->rayTest(origin, origin - btVector3(0.0f, probe.length, 0.0f), ray_callback);
 	if (ray_callback.hasHit()) {
+		probe.hit = true;
+		probe.fraction = ray_callback.m_closestHitFraction;
+		probe.normal = bt_to_vec3(ray_callback.m_hitNormalWorld);
+	}
+
+	update(world, probe);
+}
+
+// the probe was resolved elsewhere, usually in a batch with other bumpers
+void Bumper::update(const btDynamicsWorld *world, const ground_probe_t &probe)
+{
+	if (probe.hit) {
 		m_grounded = true;
-		float fraction = ray_callback.m_closestHitFraction;
 		glm::vec3 current_pos = bt_to_vec3(m_body->getWorldTransform().getOrigin());
-		float hit_pos = current_pos.y - fraction * probe_scale; 
-
-		glm::vec3 hitnormal = bt_to_vec3(ray_callback.m_hitNormalWorld);
+		float hit_pos = current_pos.y - probe.fraction * probe.length; 
 
 		m_body->getWorldTransform().getOrigin().setX(current_pos.x);
 		m_body->getWorldTransform().getOrigin().setY(hit_pos+m_offset);
 		m_body->getWorldTransform().getOrigin().setZ(current_pos.z);
 
 		m_velocity.y = 0.f;
-		//float slope = hitnormal.y;
+		//float slope = probe.normal.y;
 	} else {
 		m_grounded = false;
 		m_velocity.y = m_body->getLinearVelocity().getY();
@@ -5,10 +5,12 @@ public:
 	Bumper(const glm::vec3 &origin, float radius, float length);
 public:
 	void update(const btDynamicsWorld *world);
+	void update(const btDynamicsWorld *world, const ground_probe_t &probe);
 	void jump();
 	void set_velocity(float x, float z);
 public:
 	btRigidBody* body() const;
+	ground_probe_t ground_probe() const;
 	glm::vec3 position() const;
 	bool grounded() const;
 private:
@@ -0,0 +1,163 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "bullet/btBulletDynamicsCommon.h"
+#include "bullet/BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h"
+#include "bullet/BulletCollision/CollisionDispatch/btGhostObject.h"
+
+#include "../geometry/geom.h"
+#include "../util/image.h"
+#include "../util/heightquery.h"
+#include "heightfield.h"
+#include "physics.h"
+#include "ground.h"
+
+namespace physics {
+
+static const float GRID_CELL_SIZE = 16.f; // world size of a cell in the static object grid
+static const uint16_t MAX_OCCUPANCY = 0xFFFF;
+
+class ClosestGround : public btCollisionWorld::ClosestRayResultCallback {
+public:
+	ClosestGround(const btCollisionObject *ignore) : btCollisionWorld::ClosestRayResultCallback(btVector3(0.0, 0.0, 0.0), btVector3(0.0, 0.0, 0.0))
+	{
+		me = ignore;
+	}
+	virtual btScalar addSingleResult(btCollisionWorld::LocalRayResult &rayResult, bool normalInWorldSpace)
+	{
+		if (rayResult.m_collisionObject == me) { return 1.0; }
+
+		return ClosestRayResultCallback::addSingleResult(rayResult, normalInWorldSpace);
+	}
+protected:
+	const btCollisionObject *me;
+};
+
+void GroundQuery::build(const btCollisionWorld *world, const util::HeightQuery *terrain, int collision_masks)
+{
+	heights = terrain;
+	const glm::vec3 scale = heights->get_scale();
+	masks = collision_masks;
+
+	columns = std::max(1, int(ceilf(scale.x / GRID_CELL_SIZE)));
+	rows = std::max(1, int(ceilf(scale.z / GRID_CELL_SIZE)));
+	occupancy.assign(columns * rows, 0);
+
+	// only static meshes that probes can hit, the heightfield itself is sampled directly
+	for (int i = 0; i < world->getNumCollisionObjects(); i++) {
+		const btCollisionObject *object = world->getCollisionObjectArray()[i];
+		if (!object->isStaticObject()) { continue; }
+		const btCollisionShape *shape = object->getCollisionShape();
+		if (!shape || shape->getShapeType() == TERRAIN_SHAPE_PROXYTYPE) { continue; }
+		const btBroadphaseProxy *proxy = object->getBroadphaseHandle();
+		if (!proxy || !(proxy->m_collisionFilterGroup & masks)) { continue; }
+
+		// batched scenery is one compound per cell, the children are much tighter than the whole cell
+		if (shape->isCompound()) {
+			const btCompoundShape *compound = static_cast<const btCompoundShape*>(shape);
+			for (int j = 0; j < compound->getNumChildShapes(); j++) {
+				btVector3 min, max;
+				compound->getChildShape(j)->getAabb(object->getWorldTransform() * compound->getChildTransform(j), min, max);
+				mark(min, max);
+			}
+		} else {
+			btVector3 min, max;
+			shape->getAabb(object->getWorldTransform(), min, max);
+			mark(min, max);
+		}
+	}
+}
+
+void GroundQuery::clear()
+{
+	heights = nullptr;
+	occupancy.clear();
+	columns = 0;
+	rows = 0;
+}
+
+void GroundQuery::resolve(const btCollisionWorld *world, std::vector<ground_probe_t> &probes) const
+{
+	// probes that need the broadphase are done afterwards
+	std::vector<uint8_t> deferred(probes.size(), 0);
+
+	#pragma omp parallel for
+	for (int i = 0; i < probes.size(); i++) {
+		ground_probe_t &probe = probes[i];
+		probe.hit = false;
+		probe.fraction = 1.f;
+		probe.normal = glm::vec3(0.f, 1.f, 0.f);
+		if (!heights || occupied(probe.origin.x, probe.origin.z)) {
+			deferred[i] = 1;
+			continue;
+		}
+		glm::vec3 normal;
+		float height = heights->height(probe.origin.x, probe.origin.z, normal);
+		float depth = probe.origin.y - height;
+		if (depth >= 0.f && depth <= probe.length) {
+			probe.hit = true;
+			probe.fraction = depth / probe.length;
+			probe.normal = normal;
+		}
+	}
+
+	// the broadphase keeps one ray stack unless Bullet is built thread safe so these stay on this thread
+	for (int i = 0; i < probes.size(); i++) {
+		if (deferred[i]) {
+			ray_test(world, probes[i]);
+		}
+	}
+}
+
+void GroundQuery::mark(const btVector3 &min, const btVector3 &max)
+{
+	int x0 = glm::clamp(int(floorf(min.x() / GRID_CELL_SIZE)), 0, columns-1);
+	int z0 = glm::clamp(int(floorf(min.z() / GRID_CELL_SIZE)), 0, rows-1);
+	int x1 = glm::clamp(int(floorf(max.x() / GRID_CELL_SIZE)), 0, columns-1);
+	int z1 = glm::clamp(int(floorf(max.z() / GRID_CELL_SIZE)), 0, rows-1);
+	for (int z = z0; z <= z1; z++) {
+		for (int x = x0; x <= x1; x++) {
+			uint16_t &count = occupancy[x + z * columns];
+			if (count < MAX_OCCUPANCY) { count++; }
+		}
+	}
+}
+
+bool GroundQuery::occupied(float x, float z) const
+{
+	if (occupancy.empty()) { return true; }
+
+	int column = int(floorf(x / GRID_CELL_SIZE));
+	int row = int(floorf(z / GRID_CELL_SIZE));
+	if (column < 0 || row < 0 || column >= columns || row >= rows) {
+		return true;
+	}
+
+	return occupancy[column + row * columns] > 0;
+}
+
+void GroundQuery::ray_test(const btCollisionWorld *world, ground_probe_t &probe) const
+{
+	const btVector3 from = vec3_to_bt(probe.origin);
+	const btVector3 to = from - btVector3(0.f, probe.length, 0.f);
+
+	ClosestGround callback(probe.ignore);
+	callback.m_collisionFilterGroup = COLLISION_GROUP_ACTOR;
+	callback.m_collisionFilterMask = masks;
+
+	world->rayTest(from, to, callback);
+	if (callback.hasHit()) {
+		probe.hit = true;
+		probe.fraction = callback.m_closestHitFraction;
+		probe.normal = bt_to_vec3(callback.m_hitNormalWorld);
+	}
+}
+
+};
@@ -0,0 +1,35 @@
+namespace physics {
+
+// downward ray from a capsule to find the ground below it
+struct ground_probe_t {
+	glm::vec3 origin = {};
+	float length = 0.f;
+	const btCollisionObject *ignore = nullptr; // the body of the prober itself
+	// filled in by the query
+	bool hit = false;
+	float fraction = 1.f; // along the probe like a Bullet ray result
+	glm::vec3 normal = { 0.f, 1.f, 0.f };
+};
+
+// answers the ground probes of all creatures in one batch
+// the terrain is sampled straight from the heightmap, only probes in columns with static meshes go through the broadphase
+class GroundQuery {
+public:
+	// the heights have to be placed the same way as the physics heightfield
+	void build(const btCollisionWorld *world, const util::HeightQuery *heights, int masks);
+	void clear();
+	void resolve(const btCollisionWorld *world, std::vector<ground_probe_t> &probes) const;
+private:
+	const util::HeightQuery *heights = nullptr;
+	int masks = 0;
+	// coarse grid over the heightmap with the number of static objects overlapping each cell
+	std::vector<uint16_t> occupancy;
+	int columns = 0;
+	int rows = 0;
+private:
+	void mark(const btVector3 &min, const btVector3 &max);
+	bool occupied(float x, float z) const;
+	void ray_test(const btCollisionWorld *world, ground_probe_t &probe) const;
+};
+
+};
@@ -0,0 +1,223 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <cstdio>
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "bullet/btBulletDynamicsCommon.h"
+#include "bullet/BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h"
+#include "bullet/BulletCollision/CollisionShapes/btOptimizedBvh.h"
+#include "bullet/BulletCollision/CollisionDispatch/btGhostObject.h"
+
+#include "../extern/aixlog/aixlog.h"
+
+#include "../geometry/geom.h"
+#include "../util/image.h"
+#include "../util/hash.h"
+#include "../util/filesystem.h"
+#include "heightfield.h"
+#include "physics.h"
+#include "meshcache.h"
+
+namespace physics {
+
+static const uint32_t BVH_MAGIC = 'B'<<24 | 'V'<<16 | 'H'<<8 | 'C';
+static const uint32_t BVH_VERSION = 1;
+static const char *BVH_EXTENSION = ".bvh";
+static const size_t BVH_ALIGNMENT = 16; // Bullet reads the nodes in place
+
+struct cached_bvh_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key;
+	uint32_t scalar_size; // float and double builds of Bullet don't share BVHs
+	uint32_t size;
+};
+
+static uint64_t bvh_key(uint64_t key, const std::vector<collision_mesh_view_t> &meshes);
+
+CollisionMeshCache::~CollisionMeshCache()
+{
+	clear();
+}
+
+bool CollisionMeshCache::init(const std::string &directory, uint64_t max_bytes)
+{
+	root.clear();
+
+	if (!util::directory_exists(directory)) {
+		LOG(ERROR, "Physics") << "collision mesh cache directory " + directory + " does not exist";
+		return false;
+	}
+
+	root = directory;
+	if (root.back() != '/' && root.back() != '\\') { root += '/'; }
+	capacity = max_bytes;
+
+	// every edit of a model leaves the BVH of its old triangles behind
+	util::prune_files(root, BVH_EXTENSION, capacity);
+
+	return true;
+}
+
+btCollisionShape* CollisionMeshCache::shape(uint64_t key, const std::vector<collision_mesh_view_t> &views)
+{
+	auto search = meshes.find(key);
+	if (search != meshes.end()) {
+		return search->second.shape.get();
+	}
+
+	cached_mesh_t &cached = meshes[key];
+
+	// the vertex data is referenced, not copied
+	cached.triangles = std::make_unique<btTriangleIndexVertexArray>();
+	for (const auto &view : views) {
+		if (view.index_count < 3 || view.vertex_count < 3) { continue; }
+		btIndexedMesh mesh;
+		mesh.m_numTriangles = view.index_count / 3;
+		mesh.m_triangleIndexBase = reinterpret_cast<const unsigned char*>(view.indices);
+		mesh.m_triangleIndexStride = 3 * sizeof(uint32_t);
+		mesh.m_numVertices = view.vertex_count;
+		mesh.m_vertexBase = reinterpret_cast<const unsigned char*>(view.positions);
+		mesh.m_vertexStride = sizeof(glm::vec3);
+		mesh.m_indexType = PHY_INTEGER;
+		mesh.m_vertexType = PHY_FLOAT;
+		cached.triangles->addIndexedMesh(mesh, PHY_INTEGER);
+	}
+
+	if (cached.triangles->getNumSubParts() == 0) {
+		LOG(ERROR, "Physics") << "Collision mesh shape error: no triangle data found";
+		cached.shape = std::make_unique<btSphereShape>(5.f);
+		return cached.shape.get();
+	}
+
+	const uint64_t disk_key = bvh_key(key, views);
+	cached.bvh = load_bvh(disk_key, cached.buffer);
+	if (cached.bvh) {
+		auto shape = std::make_unique<btBvhTriangleMeshShape>(cached.triangles.get(), true, false);
+		shape->setOptimizedBvh(cached.bvh);
+		cached.shape = std::move(shape);
+	} else {
+		auto shape = std::make_unique<btBvhTriangleMeshShape>(cached.triangles.get(), true, true);
+		store_bvh(disk_key, shape->getOptimizedBvh());
+		cached.shape = std::move(shape);
+	}
+
+	return cached.shape.get();
+}
+
+void CollisionMeshCache::clear()
+{
+	for (auto &it : meshes) {
+		cached_mesh_t &cached = it.second;
+		cached.shape.reset();
+		if (cached.bvh) {
+			cached.bvh->~btOptimizedBvh();
+		}
+		if (cached.buffer) {
+			btAlignedFree(cached.buffer);
+		}
+	}
+
+	meshes.clear();
+}
+
+btOptimizedBvh* CollisionMeshCache::load_bvh(uint64_t key, void *&buffer) const
+{
+	buffer = nullptr;
+
+	if (root.empty()) { return nullptr; }
+
+	const std::string path = bvh_path(key);
+	std::ifstream stream(path, std::ios::binary);
+	if (!stream.is_open()) { return nullptr; }
+
+	cached_bvh_header_t header;
+	stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if (!stream || header.magic != BVH_MAGIC || header.version != BVH_VERSION || header.key != key || header.scalar_size != sizeof(btScalar) || header.size == 0) {
+		LOG(ERROR, "Physics") << "removing invalid cached BVH " + path;
+		stream.close();
+		std::remove(path.c_str());
+		return nullptr;
+	}
+
+	buffer = btAlignedAlloc(header.size, BVH_ALIGNMENT);
+	stream.read(static_cast<char*>(buffer), header.size);
+	if (!stream) {
+		LOG(ERROR, "Physics") << "removing truncated cached BVH " + path;
+		btAlignedFree(buffer);
+		buffer = nullptr;
+		stream.close();
+		std::remove(path.c_str());
+		return nullptr;
+	}
+
+	// pruning goes by last write so a BVH that is still used stays
+	stream.close();
+	util::touch_file(path);
+
+	return btOptimizedBvh::deSerializeInPlace(buffer, header.size, false);
+}
+
+void CollisionMeshCache::store_bvh(uint64_t key, const btOptimizedBvh *bvh) const
+{
+	if (root.empty() || !bvh) { return; }
+
+	cached_bvh_header_t header;
+	header.magic = BVH_MAGIC;
+	header.version = BVH_VERSION;
+	header.key = key;
+	header.scalar_size = sizeof(btScalar);
+	header.size = bvh->calculateSerializeBufferSize();
+
+	void *buffer = btAlignedAlloc(header.size, BVH_ALIGNMENT);
+	if (!bvh->serializeInPlace(buffer, header.size, false)) {
+		btAlignedFree(buffer);
+		return;
+	}
+
+	// write to a temporary file so a crash never leaves half a BVH behind
+	const std::string path = bvh_path(key);
+	const std::string temporary = path + ".tmp";
+	std::ofstream stream(temporary, std::ios::binary);
+	if (stream.is_open()) {
+		stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		stream.write(static_cast<const char*>(buffer), header.size);
+		stream.close();
+		if (stream.fail() || !util::replace_file(temporary, path)) {
+			std::remove(temporary.c_str());
+		}
+	}
+
+	btAlignedFree(buffer);
+}
+
+std::string CollisionMeshCache::bvh_path(uint64_t key) const
+{
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+
+	return root + name + BVH_EXTENSION;
+}
+
+// the file key also covers the layout of the meshes so a BVH is never used with other triangles
+static uint64_t bvh_key(uint64_t key, const std::vector<collision_mesh_view_t> &meshes)
+{
+	util::fnv_hash_t hash;
+	hash.add(key);
+	for (const auto &mesh : meshes) {
+		hash.add(uint64_t(mesh.vertex_count));
+		hash.add(uint64_t(mesh.index_count));
+	}
+
+	return hash.value;
+}
+
+};
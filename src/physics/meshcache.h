@@ -0,0 +1,42 @@
+namespace physics {
+
+// collision triangles owned by someone else, usually a model
+struct collision_mesh_view_t {
+	const glm::vec3 *positions = nullptr;
+	uint32_t vertex_count = 0;
+	const uint32_t *indices = nullptr;
+	uint32_t index_count = 0;
+};
+
+// triangle mesh shapes that read the vertex data in place, one for every key
+// the BVH of a shape is serialized to disk so the next run only has to read it back
+class CollisionMeshCache {
+public:
+	CollisionMeshCache() = default;
+	CollisionMeshCache(const CollisionMeshCache&) = delete;
+	CollisionMeshCache& operator=(const CollisionMeshCache&) = delete;
+	~CollisionMeshCache();
+public:
+	// without a directory shapes are still shared but the BVHs are built every run
+	// the least recently used BVHs are removed until the directory fits in max_bytes
+	bool init(const std::string &directory, uint64_t max_bytes);
+	// the meshes have to outlive the shape
+	btCollisionShape* shape(uint64_t key, const std::vector<collision_mesh_view_t> &meshes);
+	void clear();
+private:
+	struct cached_mesh_t {
+		std::unique_ptr<btTriangleIndexVertexArray> triangles;
+		std::unique_ptr<btCollisionShape> shape;
+		btOptimizedBvh *bvh = nullptr; // loaded in place in the buffer, not owned by the shape
+		void *buffer = nullptr;
+	};
+	std::string root;
+	uint64_t capacity = 0;
+	std::unordered_map<uint64_t, cached_mesh_t> meshes;
+private:
+	btOptimizedBvh* load_bvh(uint64_t key, void *&buffer) const;
+	void store_bvh(uint64_t key, const btOptimizedBvh *bvh) const;
+	std::string bvh_path(uint64_t key) const;
+};
+
+};
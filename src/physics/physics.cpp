@@ -1,6 +1,9 @@
 #include <iostream>
 #include <memory>
 #include <vector>
+#include <chrono>
+#include <algorithm>
+#include <omp.h>
 #include <glm/glm.hpp>
 #include <glm/vec3.hpp>
 #include <glm/vec4.hpp>
@@ -10,6 +13,10 @@
 #include "bullet/btBulletDynamicsCommon.h"
 #include "bullet/BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h"
 #include "bullet/BulletCollision/CollisionDispatch/btGhostObject.h"
+#include "bullet/BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h"
+#include "bullet/BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h"
+#include "bullet/BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h"
+#include "bullet/LinearMath/btThreads.h"
 
 #include "../extern/aixlog/aixlog.h"
 
@@ -20,18 +27,120 @@
 
 namespace physics {
 
-static const int MAX_SUB_STEPS = 10;
+static const btScalar FIXED_TIMESTEP = btScalar(1.) / btScalar(60.);
+static const int MAX_SUB_STEPS = 4; // a long frame is simulated slower instead of catching up all at once
+static const float STEP_BUDGET = 0.008f; // seconds of a frame the simulation may use before it drops substeps
 static const btVector3 GRAVITY = { 0.F, -9.81F, 0.F }; // same gravity as in my house
 
+// runs Bullet's parallel loops on the OpenMP threads the rest of the game uses
+class OpenMPTaskScheduler : public btITaskScheduler {
+public:
+	OpenMPTaskScheduler() : btITaskScheduler("OpenMP")
+	{
+		threads = getMaxNumThreads();
+	}
+	int getMaxNumThreads() const override
+	{
+		return std::min(omp_get_max_threads(), int(BT_MAX_THREAD_COUNT));
+	}
+	int getNumThreads() const override
+	{
+		return threads;
+	}
+	void setNumThreads(int count) override
+	{
+		threads = std::max(1, std::min(count, getMaxNumThreads()));
+	}
+	void parallelFor(int begin, int end, int grain, const btIParallelForBody &body) override
+	{
+		const int count = (end - begin + grain - 1) / grain;
+		#pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+		for (int i = 0; i < count; i++) {
+			const int first = begin + i * grain;
+			body.forLoop(first, std::min(first + grain, end));
+		}
+	}
+	btScalar parallelSum(int begin, int end, int grain, const btIParallelSumBody &body) override
+	{
+		const int count = (end - begin + grain - 1) / grain;
+		btScalar sum = 0.f;
+		#pragma omp parallel for schedule(dynamic, 1) num_threads(threads) reduction(+:sum)
+		for (int i = 0; i < count; i++) {
+			const int first = begin + i * grain;
+			sum += body.sumLoop(first, std::min(first + grain, end));
+		}
+		return sum;
+	}
+private:
+	int threads = 1;
+};
+
 PhysicsManager::PhysicsManager()
 {
-	m_config = std::make_unique<btDefaultCollisionConfiguration>();
-	m_dispatcher = std::make_unique<btCollisionDispatcher>(m_config.get());
+	create_world(false);
+}
+
+bool PhysicsManager::set_multithreaded(bool enabled)
+{
+	if (enabled == m_multithreaded) { return true; }
+
+#if !BT_THREADSAFE
+	// without it the Mt world steps the islands one after another and the solvers aren't safe to share
+	if (enabled) {
+		LOG(ERROR, "Physics") << "Bullet was built without BT_THREADSAFE, the physics world stays single threaded";
+		return false;
+	}
+#endif
+
+	if (m_world->getNumCollisionObjects() > 0) {
+		LOG(ERROR, "Physics") << "can only change threading of an empty world";
+		return false;
+	}
+
+	create_world(enabled);
+
+	return true;
+}
+
+// the multithreaded world also needs its own dispatcher and a pool of solvers for the islands
+void PhysicsManager::create_world(bool multithreaded)
+{
+	m_world.reset();
+	m_solver.reset();
+	m_solver_pool.reset();
+	m_broadphase.reset();
+	m_dispatcher.reset();
+	m_config.reset();
+
+	m_multithreaded = multithreaded;
+
+	btDefaultCollisionConstructionInfo info;
+	if (multithreaded) {
+		// the pools are shared between threads so they can't grow on demand
+		info.m_defaultMaxPersistentManifoldPoolSize = 80000;
+		info.m_defaultMaxCollisionAlgorithmPoolSize = 80000;
+	}
+	m_config = std::make_unique<btDefaultCollisionConfiguration>(info);
 	m_broadphase = std::make_unique<btDbvtBroadphase>();
-	m_solver = std::make_unique<btSequentialImpulseConstraintSolver>();
 
-	m_world = std::make_unique<btDiscreteDynamicsWorld>(m_dispatcher.get(), m_broadphase.get(), m_solver.get(), m_config.get());
+	if (multithreaded) {
+		static OpenMPTaskScheduler scheduler;
+		if (btGetTaskScheduler() != &scheduler) {
+			btSetTaskScheduler(&scheduler);
+		}
+		m_dispatcher = std::make_unique<btCollisionDispatcherMt>(m_config.get());
+		m_solver_pool = std::make_unique<btConstraintSolverPoolMt>(scheduler.getNumThreads());
+		m_solver = std::make_unique<btSequentialImpulseConstraintSolverMt>();
+		m_world = std::make_unique<btDiscreteDynamicsWorldMt>(m_dispatcher.get(), m_broadphase.get(), m_solver_pool.get(), m_solver.get(), m_config.get());
+	} else {
+		m_dispatcher = std::make_unique<btCollisionDispatcher>(m_config.get());
+		m_solver = std::make_unique<btSequentialImpulseConstraintSolver>();
+		m_world = std::make_unique<btDiscreteDynamicsWorld>(m_dispatcher.get(), m_broadphase.get(), m_solver.get(), m_config.get());
+	}
+
 	m_world->setGravity(GRAVITY);
+
+	m_substeps = MAX_SUB_STEPS;
 }
 
 PhysicsManager::~PhysicsManager()
@@ -75,9 +184,21 @@ void PhysicsManager::clear()
 	m_shapes.clear();
 }
 
+// Bullet keeps the leftover time and interpolates the motion states between the last two fixed steps
 void PhysicsManager::update(float timestep)
 {
-	m_world->stepSimulation(timestep, MAX_SUB_STEPS);
+	auto start = std::chrono::steady_clock::now();
+	int steps = m_world->stepSimulation(timestep, m_substeps, FIXED_TIMESTEP);
+	if (steps == 0) { return; }
+
+	std::chrono::duration<float> elapsed = std::chrono::steady_clock::now() - start;
+	// drop substeps right away when over budget but only win them back one at a time
+	int affordable = int(STEP_BUDGET * float(steps) / std::max(elapsed.count(), 0.0001f));
+	if (affordable < m_substeps) {
+		m_substeps = std::max(affordable, 1);
+	} else if (m_substeps < MAX_SUB_STEPS) {
+		m_substeps++;
+	}
 }
 	
 const btDynamicsWorld* PhysicsManager::get_world() const
@@ -95,7 +216,7 @@ void PhysicsManager::add_shape(btCollisionShape *shape)
 	m_shapes.push_back(shape);
 }
 
-btCollisionShape* PhysicsManager::add_mesh(const std::vector<glm::vec3> &positions, const std::vector<uint16_t> &indices)
+btCollisionShape* PhysicsManager::add_mesh(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices)
 {
 	if (indices.size() < 3 || positions.size() < 3) {
 		LOG(ERROR, "Physics") << "Collision mesh shape error: no triangle data found";
@@ -108,7 +229,7 @@ btCollisionShape* PhysicsManager::add_mesh(const std::vector<glm::vec3> &positio
 	btTriangleMesh *mesh = new btTriangleMesh;
 
 	for (int i = 0; i < indices.size(); i += 3) {
-		uint16_t index = indices[i];
+		uint32_t index = indices[i];
 		btVector3 v0 = vec3_to_bt(positions[index]);
 		index = indices[i+1];
 		btVector3 v1 = vec3_to_bt(positions[index]);
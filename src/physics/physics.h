@@ -1,4 +1,6 @@
 
+class btConstraintSolverPoolMt;
+
 namespace physics {
 
 enum collision_group_t {
@@ -22,13 +24,16 @@ public:
 	PhysicsManager();
 	~PhysicsManager();
 public:
+	// only possible while the world is empty
+	bool set_multithreaded(bool enabled);
+	bool multithreaded() const { return m_multithreaded; }
 	const btDynamicsWorld* get_world() const;
 	btDynamicsWorld* get_world();
 	void update(float timestep);
 	void add_heightfield(const util::Image<float> *image, const glm::vec3 &scale, int group, int masks);
 	void add_heightfield(const util::Image<uint8_t> *image, const glm::vec3 &scale, int group, int masks);
 	void add_shape(btCollisionShape *shape);
-	btCollisionShape* add_mesh(const std::vector<glm::vec3> &positions, const std::vector<uint16_t> &indices);
+	btCollisionShape* add_mesh(const std::vector<glm::vec3> &positions, const std::vector<uint32_t> &indices);
 	btCollisionShape* add_hull(const std::vector<glm::vec3> &points);
 	void add_object(btCollisionObject *object, int groups, int masks);
 	void add_ghost_object(btGhostObject *object, int groups, int masks);
@@ -44,12 +49,17 @@ private:
 	std::unique_ptr<btCollisionConfiguration> m_config;
 	std::unique_ptr<btCollisionDispatcher> m_dispatcher;
 	std::unique_ptr<btBroadphaseInterface> m_broadphase;
+	std::unique_ptr<btConstraintSolverPoolMt> m_solver_pool;
 	std::unique_ptr<btConstraintSolver> m_solver;
 	std::unique_ptr<btDynamicsWorld> m_world;
+	bool m_multithreaded = false;
+	int m_substeps = 1; // substeps the simulation can afford this frame
 private:
 	btAlignedObjectArray<btCollisionShape*> m_shapes;
 	std::vector<btTriangleMesh*> m_meshes;
 	std::vector<std::unique_ptr<HeightField>> m_heightfields;
+private:
+	void create_world(bool multithreaded);
 };
 
 };
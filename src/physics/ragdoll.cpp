@@ -46,6 +46,21 @@ static glm::mat4 bullet_to_mat4(const btTransform &t)
 	return m;
 }
 
+// the transforms can carry the scale of the model, Bullet only takes rotation and translation
+static btTransform mat4_to_bullet(const glm::mat4 &m)
+{
+	btTransform t;
+	btMatrix3x3 basis;
+	const glm::vec3 x = glm::normalize(glm::vec3(m[0]));
+	const glm::vec3 y = glm::normalize(glm::vec3(m[1]));
+	const glm::vec3 z = glm::normalize(glm::vec3(m[2]));
+	basis.setValue(x.x, y.x, z.x, x.y, y.y, z.y, x.z, y.z, z.z);
+	t.setBasis(basis);
+	t.setOrigin(btVector3(m[3][0], m[3][1], m[3][2]));
+
+	return t;
+}
+
 namespace physics {
 	
 RagdollBone::RagdollBone(float radius, float height, const glm::vec3 &start, const glm::vec3 &rotation)
@@ -130,17 +145,19 @@ void Ragdoll::update()
 	}
 }
 
-void Ragdoll::add_to_world(btDynamicsWorld *world, const glm::vec3 &pos, const glm::vec3 &velocity)
+void Ragdoll::add_to_world(btDynamicsWorld *world, const std::vector<glm::mat4> &transforms, const glm::vec3 &velocity)
 {
-	btTransform offset;
-	offset.setIdentity();
-	offset.setOrigin(btVector3(pos.x, pos.y, pos.z));
-
-	for (auto &bone : m_bones) {
-		btTransform transform = bone->origin;
-		bone->body->setWorldTransform(offset * transform);
+	for (int i = 0; i < m_bones.size(); i++) {
+		auto &bone = m_bones[i];
+		const glm::mat4 transform = i < transforms.size() ? transforms[i] : glm::mat4(1.f);
+		bone->body->setWorldTransform(mat4_to_bullet(transform * bullet_to_mat4(bone->origin)));
 		bone->body->setLinearVelocity(vec3_to_bt(velocity));
-		bone->body->activate();
+		bone->body->setAngularVelocity(btVector3(0.f, 0.f, 0.f));
+		bone->body->forceActivationState(ACTIVE_TAG);
+		bone->body->setDeactivationTime(0.f);
+		if (bone->body->getMotionState()) {
+			bone->body->getMotionState()->setWorldTransform(bone->body->getWorldTransform());
+		}
 		world->addRigidBody(bone->body.get(), COLLISION_GROUP_RAGDOLL, COLLISION_GROUP_HEIGHTMAP | COLLISION_GROUP_WORLD);
 	}
 
@@ -160,4 +177,50 @@ void Ragdoll::remove_from_world(btDynamicsWorld *world)
 	}
 }
 
+bool Ragdoll::resting() const
+{
+	for (const auto &bone : m_bones) {
+		if (bone->body->isActive()) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void RagdollPool::create(const module::ragdoll_armature_import_t &armature, uint32_t count)
+{
+	clear();
+
+	for (uint32_t i = 0; i < count; i++) {
+		auto ragdoll = std::make_unique<Ragdoll>();
+		ragdoll->create(armature);
+		m_free.push_back(ragdoll.get());
+		m_ragdolls.push_back(std::move(ragdoll));
+	}
+}
+
+void RagdollPool::clear()
+{
+	m_free.clear();
+	m_ragdolls.clear();
+}
+
+Ragdoll* RagdollPool::acquire()
+{
+	if (m_free.empty()) { return nullptr; }
+
+	Ragdoll *ragdoll = m_free.back();
+	m_free.pop_back();
+
+	return ragdoll;
+}
+
+void RagdollPool::release(Ragdoll *ragdoll)
+{
+	if (ragdoll) {
+		m_free.push_back(ragdoll);
+	}
+}
+
 };
@@ -27,9 +27,13 @@ public:
 	void create(const module::ragdoll_armature_import_t &armature);
 	void update();
 	void clean();
-	void add_to_world(btDynamicsWorld *world, const glm::vec3 &pos, const glm::vec3 &velocity);
+	// every bone starts at its rest origin moved by its transform, so the ragdoll takes over an animated pose
+	void add_to_world(btDynamicsWorld *world, const std::vector<glm::mat4> &transforms, const glm::vec3 &velocity);
 	void remove_from_world(btDynamicsWorld *world);
+	// true once every bone has been put to sleep by Bullet
+	bool resting() const;
 public:
+	uint32_t bone_count() const { return m_bones.size(); }
 	glm::mat4 transform(uint32_t index) const 
 	{
 		if (index < m_bones.size()) {
@@ -49,4 +53,19 @@ private:
 	glm::quat m_rotation;
 };
 
+// a fixed number of ragdolls built up front, creatures only borrow one while they are limp
+// so the cost of ragdolls depends on how many are active and not on the number of creatures
+class RagdollPool {
+public:
+	void create(const module::ragdoll_armature_import_t &armature, uint32_t count);
+	void clear();
+	// nullptr if all ragdolls are in use
+	Ragdoll* acquire();
+	void release(Ragdoll *ragdoll);
+	uint32_t available() const { return m_free.size(); }
+private:
+	std::vector<std::unique_ptr<Ragdoll>> m_ragdolls;
+	std::vector<Ragdoll*> m_free;
+};
+
 };
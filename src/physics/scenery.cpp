@@ -0,0 +1,154 @@
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+#include <glm/vec4.hpp>
+#include <glm/mat4x4.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "bullet/btBulletDynamicsCommon.h"
+#include "bullet/BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h"
+#include "bullet/BulletCollision/CollisionDispatch/btGhostObject.h"
+
+#include "../geometry/geom.h"
+#include "../util/image.h"
+#include "heightfield.h"
+#include "physics.h"
+#include "scenery.h"
+
+namespace physics {
+
+StaticScenery::StaticScenery(float cell_size)
+	: cell_size(cell_size)
+{
+}
+
+StaticScenery::~StaticScenery()
+{
+	clear();
+}
+
+uint32_t StaticScenery::add(btCollisionShape *shape, const glm::vec3 &position, const glm::quat &rotation)
+{
+	const uint32_t index = find_cell(position);
+	scenery_cell_t &cell = cells[index];
+
+	// children are placed relative to the cell object which stays at the origin
+	btTransform transform;
+	transform.setIdentity();
+	transform.setOrigin(vec3_to_bt(position));
+	transform.setRotation(quat_to_bt(rotation));
+	cell.shape->addChildShape(transform, shape);
+
+	scenery_instance_t instance;
+	instance.cell = index;
+	instance.child = cell.children.size();
+	cell.children.push_back(instances.size());
+	instances.push_back(instance);
+
+	if (world) {
+		if (cell.children.size() == 1) {
+			world->addCollisionObject(cell.object.get(), groups, masks);
+		} else {
+			world->updateSingleAabb(cell.object.get());
+		}
+	}
+
+	return instances.size() - 1;
+}
+
+void StaticScenery::remove(uint32_t index)
+{
+	if (index >= instances.size() || instances[index].cell < 0) { return; }
+
+	scenery_instance_t &instance = instances[index];
+	scenery_cell_t &cell = cells[instance.cell];
+
+	// the compound shape swaps its last child into the hole so do the same here
+	cell.shape->removeChildShapeByIndex(instance.child);
+	// removing by index leaves the bounds of the compound as they were
+	cell.shape->recalculateLocalAabb();
+	const uint32_t last = cell.children.back();
+	cell.children[instance.child] = last;
+	instances[last].child = instance.child;
+	cell.children.pop_back();
+
+	instance.cell = -1;
+	instance.child = -1;
+
+	if (!world) { return; }
+
+	if (cell.children.empty()) {
+		world->removeCollisionObject(cell.object.get());
+	} else {
+		// the contact manifolds of the cell can still have points on the removed child
+		btBroadphaseProxy *proxy = cell.object->getBroadphaseHandle();
+		world->getBroadphase()->getOverlappingPairCache()->cleanProxyFromPairs(proxy, world->getDispatcher());
+		world->updateSingleAabb(cell.object.get());
+	}
+}
+
+void StaticScenery::insert(btCollisionWorld *collision_world, int collision_groups, int collision_masks)
+{
+	detach();
+
+	world = collision_world;
+	groups = collision_groups;
+	masks = collision_masks;
+
+	for (auto &cell : cells) {
+		if (!cell.children.empty()) {
+			world->addCollisionObject(cell.object.get(), groups, masks);
+		}
+	}
+}
+
+void StaticScenery::detach()
+{
+	if (!world) { return; }
+
+	for (auto &cell : cells) {
+		if (!cell.children.empty()) {
+			world->removeCollisionObject(cell.object.get());
+		}
+	}
+
+	world = nullptr;
+}
+
+void StaticScenery::clear()
+{
+	detach();
+
+	cells.clear();
+	cell_lookup.clear();
+	instances.clear();
+}
+
+uint32_t StaticScenery::find_cell(const glm::vec3 &position)
+{
+	const int32_t x = int32_t(floorf(position.x / cell_size));
+	const int32_t z = int32_t(floorf(position.z / cell_size));
+	const uint64_t key = (uint64_t(uint32_t(x)) << 32) | uint64_t(uint32_t(z));
+
+	auto search = cell_lookup.find(key);
+	if (search != cell_lookup.end()) {
+		return search->second;
+	}
+
+	scenery_cell_t cell;
+	cell.shape = std::make_unique<btCompoundShape>();
+	cell.object = std::make_unique<btCollisionObject>();
+	cell.object->setCollisionShape(cell.shape.get());
+	cell.object->setCollisionFlags(cell.object->getCollisionFlags() | btCollisionObject::CF_STATIC_OBJECT);
+
+	cells.push_back(std::move(cell));
+	cell_lookup[key] = cells.size() - 1;
+
+	return cells.size() - 1;
+}
+
+};
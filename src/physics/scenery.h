@@ -0,0 +1,43 @@
+namespace physics {
+
+// static collision of the scenery batched by cell, each cell is a compound shape in one collision object without a motion state
+// keeps the broadphase at a few hundred proxies instead of a body for every tree and house
+class StaticScenery {
+public:
+	static const uint32_t INVALID_INSTANCE = 0xFFFFFFFF;
+public:
+	StaticScenery(float cell_size);
+	StaticScenery(const StaticScenery&) = delete;
+	StaticScenery& operator=(const StaticScenery&) = delete;
+	~StaticScenery();
+public:
+	// the shape is not owned, returns a handle to remove the instance later
+	uint32_t add(btCollisionShape *shape, const glm::vec3 &position, const glm::quat &rotation);
+	// for a felled tree or a destroyed wall, the cell stays in the world as long as it has instances left
+	void remove(uint32_t instance);
+	void insert(btCollisionWorld *world, int groups, int masks);
+	void detach();
+	void clear();
+	size_t cell_count() const { return cells.size(); }
+private:
+	struct scenery_cell_t {
+		std::unique_ptr<btCompoundShape> shape;
+		std::unique_ptr<btCollisionObject> object;
+		std::vector<uint32_t> children; // instance of every child shape
+	};
+	struct scenery_instance_t {
+		int32_t cell = -1; // -1 if removed
+		int32_t child = -1;
+	};
+	float cell_size = 1.f;
+	std::vector<scenery_cell_t> cells;
+	std::unordered_map<uint64_t, uint32_t> cell_lookup; // packed cell coordinates to the index in cells
+	std::vector<scenery_instance_t> instances;
+	btCollisionWorld *world = nullptr; // set while the cells are in a world
+	int groups = 0;
+	int masks = 0;
+private:
+	uint32_t find_cell(const glm::vec3 &position);
+};
+
+};
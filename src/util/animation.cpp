@@ -1,6 +1,13 @@
 #include <iostream>
 #include <vector>
+#include <string>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <limits>
 
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
@@ -19,6 +26,8 @@
 
 #include "../extern/aixlog/aixlog.h"
 
+#include "../geometry/geom.h"
+
 #include "animation.h"
 
 namespace util {
@@ -34,7 +43,26 @@ glm::mat4 ozz_to_mat4(const ozz::math::Float4x4 &matrix)
 	return out;
 }
 	
-bool AnimationSampler::load(const std::string &filepath)
+bool AnimationSet::load(const std::string &skeletonpath, const std::vector<std::pair<uint32_t, std::string>> &animationpaths)
+{
+	if (!load_skeleton(skeletonpath)) {
+		return false;
+	}
+
+	const int num_joints = skeleton.num_joints();
+
+	for (const auto &path : animationpaths) {
+		ozz::animation::Animation &animation = animations[path.first];
+		load_animation(path.second, animation);
+		if (num_joints != animation.num_tracks()) {
+			LOG(ERROR, "Animation") << "skeleton joints of " + skeletonpath + " and animation tracks of " + path.second + " mismatch\n";
+		}
+	}
+
+	return true;
+}
+
+bool AnimationSet::load_animation(const std::string &filepath, ozz::animation::Animation &animation)
 {
 	ozz::io::File file(filepath.c_str(), "rb");
 	if (!file.opened()) {
@@ -52,26 +80,52 @@ bool AnimationSampler::load(const std::string &filepath)
 
 	return true;
 }
-	
-Animator::Animator(const std::string &skeletonpath, const std::vector<std::pair<uint32_t, std::string>> &animationpaths)
+
+std::shared_ptr<const AnimationSet> load_animation_set(const std::string &skeletonpath, const std::vector<std::pair<uint32_t, std::string>> &animationpaths)
 {
-	m_valid = load_skeleton(skeletonpath);
-	const int num_soa_joints = skeleton.num_soa_joints();
-	const int num_joints = skeleton.num_joints();
+	static std::mutex mutex;
+	static std::map<std::string, std::weak_ptr<const AnimationSet>> sets;
 
+	// the same skeleton can be played with different clips so they are all part of the key
+	std::string key = skeletonpath;
 	for (const auto &path : animationpaths) {
-		auto sampler = std::make_unique<AnimationSampler>();
-		sampler->load(path.second);
-		if (num_joints != sampler->animation.num_tracks()) {
-			LOG(ERROR, "Animation") << "skeleton joints of " + skeletonpath + " and animation tracks of " + path.second + " mismatch\n";
-		}
+		key += ";" + std::to_string(path.first) + "=" + path.second;
+	}
+
+	std::lock_guard<std::mutex> guard(mutex);
+
+	auto shared = sets[key].lock();
+	if (!shared) {
+		auto set = std::make_shared<AnimationSet>();
+		set->load(skeletonpath, animationpaths);
+		shared = set;
+		sets[key] = shared;
+	}
+
+	return shared;
+}
+	
+Animator::Animator(std::shared_ptr<const AnimationSet> set)
+	: m_set(set)
+{
+	m_valid = m_set->skeleton.num_joints() > 0;
+	const int num_soa_joints = m_set->skeleton.num_soa_joints();
+	const int num_joints = m_set->skeleton.num_joints();
+
+	// clip IDs are small enum values so a dense array wastes little
+	if (!m_set->animations.empty()) {
+		sampler_count = m_set->animations.rbegin()->first + 1;
+	}
+	samplers.reset(new AnimationSampler[sampler_count]);
+
+	for (const auto &animation : m_set->animations) {
+		AnimationSampler &sampler = samplers[animation.first];
+		sampler.animation = &animation.second;
 		// Allocates sampler runtime buffers.
-		sampler->locals.resize(num_soa_joints);
+		sampler.locals.resize(num_soa_joints);
 
 		// Allocates a cache that matches animation requirements.
-		sampler->cache.Resize(num_joints);
-
-		samplers[path.first] = std::move(sampler);
+		sampler.cache.Resize(num_joints);
 	}
 
 	// Allocates local space runtime buffers of blended data.
@@ -79,45 +133,106 @@ Animator::Animator(const std::string &skeletonpath, const std::vector<std::pair<
 
 	// Allocates model space runtime buffers of blended data.
 	models.resize(num_joints);
+	m_buffers[0].resize(num_joints);
+	m_buffers[1].resize(num_joints);
+	m_previous = m_current = m_output = &m_buffers[0];
 }
 	
 void Animator::update(float delta, uint32_t first, uint32_t second, float mix)
 {
-	// update blend ratio
-	for (auto it = samplers.begin(); it != samplers.end(); it++) {
-		auto sampler = it->second.get();
-		if (it->first == first) {
-			sampler->weight = 1.f - mix;
-		} else if (it->first == second) {
-			sampler->weight = mix;
-		} else {
-			sampler->weight = 0.f;
-		}
+	update(delta, first, second, mix, animation_lod_t());
+}
+
+void Animator::update(float delta, uint32_t first, uint32_t second, float mix, const animation_lod_t &lod)
+{
+	animation_blend_t blend;
+	if (first == second) {
+		blend.add(first, 1.f);
+	} else {
+		blend.add(first, 1.f - mix);
+		blend.add(second, mix);
 	}
 
-	// Updates and samples all animations to their respective local space
-	// transform buffers.
-	for (auto it = samplers.begin(); it != samplers.end(); it++) {
-		auto sampler = it->second.get();
+	update(delta, blend, lod);
+}
 
-		// Updates animations time.
-		sampler->controller.update(sampler->animation, delta);
+void Animator::update(float delta, const animation_blend_t &blend, const animation_lod_t &lod)
+{
+	m_clock += delta;
+
+	// off screen, clips catch up with the playback time when they are sampled again
+	if (!lod.visible) {
+		return;
+	}
+
+	if (lod.sample) {
+		// sample into the buffer that does not hold the current pose, it becomes the previous one
+		std::vector<ozz::math::Float4x4> &buffer = (m_current == &m_buffers[0]) ? m_buffers[1] : m_buffers[0];
+		const std::vector<ozz::math::Float4x4> *sampled = sample(blend, lod.shared ? m_poses : nullptr, buffer);
+		if (!sampled) {
+			return;
+		}
+		m_previous = lod.snap ? sampled : m_current;
+		m_current = sampled;
+	}
+
+	if (lod.alpha >= 1.f) {
+		m_output = m_current;
+	} else {
+		const ozz::math::SimdFloat4 alpha = ozz::math::simd_float4::Load1(lod.alpha);
+		for (int i = 0; i < models.size(); i++) {
+			for (int j = 0; j < 4; j++) {
+				models[i].cols[j] = ozz::math::Lerp((*m_previous)[i].cols[j], (*m_current)[i].cols[j], alpha);
+			}
+		}
+		m_output = &models;
+	}
+}
 
-		// Early out if this sampler weight makes it irrelevant during blending.
-		if (sampler->weight <= 0.f) {
+const std::vector<ozz::math::Float4x4>* Animator::sample(const animation_blend_t &blend, AnimationPoseCache *poses, std::vector<ozz::math::Float4x4> &output)
+{
+	// only the clips in the blend are touched
+	uint32_t count = 0;
+	for (int i = 0; i < blend.count; i++) {
+		const uint32_t clip = blend.clips[i];
+		if (clip >= sampler_count || !samplers[clip].animation) {
 			continue;
 		}
 
-		// Setup sampling job.
-		ozz::animation::SamplingJob sampling_job;
-		sampling_job.animation = &sampler->animation;
-		sampling_job.cache = &sampler->cache;
-		sampling_job.ratio = sampler->controller.time_ratio;
-		sampling_job.output = ozz::make_span(sampler->locals);
+		AnimationSampler &sampler = samplers[clip];
+		sampler.weight = blend.weights[i];
 
-		// Samples animation.
-		if (!sampling_job.Run()) {
-			return;
+		// Updates animations time.
+		sampler.controller.update(*sampler.animation, float(m_clock - sampler.synced));
+		sampler.synced = m_clock;
+
+		ozz::animation::BlendingJob::Layer &layer = m_layers[count++];
+		layer.weight = sampler.weight;
+
+		if (poses) {
+			// shared poses are already sampled
+			const shared_pose_t *pose = poses->pose(clip, sampler.controller.time_ratio);
+			if (!pose) {
+				return nullptr;
+			}
+			// a single clip doesn't even need blending
+			if (blend.count == 1) {
+				return &pose->models;
+			}
+			layer.transform = ozz::make_span(pose->locals);
+		} else {
+			// Setup sampling job.
+			ozz::animation::SamplingJob sampling_job;
+			sampling_job.animation = sampler.animation;
+			sampling_job.cache = &sampler.cache;
+			sampling_job.ratio = sampler.controller.time_ratio;
+			sampling_job.output = ozz::make_span(sampler.locals);
+
+			// Samples animation.
+			if (!sampling_job.Run()) {
+				return nullptr;
+			}
+			layer.transform = ozz::make_span(sampler.locals);
 		}
 	}
 
@@ -126,25 +241,16 @@ void Animator::update(float delta, uint32_t first, uint32_t second, float mix)
 	// (1st stage just above), and outputs the result to the local space
 	// transform buffer blended_locals_
 
-	// Prepares blending layers.
-	std::vector<ozz::animation::BlendingJob::Layer> layers;
-	for (auto it = samplers.begin(); it != samplers.end(); it++) {
-		ozz::animation::BlendingJob::Layer layer;
-		layer.transform = ozz::make_span(it->second->locals);
-		layer.weight = it->second->weight;
-		layers.push_back(layer);
-	}
-
 	// Setups blending job.
 	ozz::animation::BlendingJob blend_job;
 	blend_job.threshold = m_threshold;
-	blend_job.layers = ozz::make_span(layers);
-	blend_job.bind_pose = skeleton.joint_bind_poses();
+	blend_job.layers = ozz::span<const ozz::animation::BlendingJob::Layer>(m_layers, count);
+	blend_job.bind_pose = m_set->skeleton.joint_bind_poses();
 	blend_job.output = ozz::make_span(blended_locals);
 
 	// Blends.
 	if (!blend_job.Run()) {
-		return;
+		return nullptr;
 	}
 
 	// Converts from local space to model space matrices.
@@ -152,17 +258,86 @@ void Animator::update(float delta, uint32_t first, uint32_t second, float mix)
 
 	// Setup local-to-model conversion job.
 	ozz::animation::LocalToModelJob ltm_job;
-	ltm_job.skeleton = &skeleton;
+	ltm_job.skeleton = &m_set->skeleton;
 	ltm_job.input = ozz::make_span(blended_locals);
-	ltm_job.output = ozz::make_span(models);
+	ltm_job.output = ozz::make_span(output);
 
 	// Runs ltm job.
 	if (!ltm_job.Run()) {
-		return;
+		return nullptr;
 	}
+
+	return &output;
 }
 
-bool Animator::load_skeleton(const std::string &filepath)
+AnimationPoseCache::AnimationPoseCache(std::shared_ptr<const AnimationSet> set, float rate)
+	: m_set(set)
+{
+	for (const auto &animation : m_set->animations) {
+		clip_poses_t &clip = m_clips[animation.first];
+		clip.animation = &animation.second;
+		clip.count = glm::max(1, int(std::ceil(animation.second.duration() * rate)));
+		clip.slots.reset(new std::atomic<const shared_pose_t*>[clip.count]);
+		for (int i = 0; i < clip.count; i++) {
+			clip.slots[i].store(nullptr);
+		}
+	}
+
+	m_cache.Resize(m_set->skeleton.num_joints());
+}
+
+const shared_pose_t* AnimationPoseCache::pose(uint32_t clip, float ratio)
+{
+	auto it = m_clips.find(clip);
+	if (it == m_clips.end()) {
+		return nullptr;
+	}
+
+	clip_poses_t &poses = it->second;
+	const uint32_t index = glm::clamp(int(ratio * poses.count), 0, int(poses.count) - 1);
+
+	const shared_pose_t *pose = poses.slots[index].load(std::memory_order_acquire);
+	if (pose) {
+		return pose;
+	}
+
+	std::lock_guard<std::mutex> guard(m_mutex);
+
+	// another thread could have sampled it while this one waited
+	pose = poses.slots[index].load(std::memory_order_acquire);
+	if (pose) {
+		return pose;
+	}
+
+	auto sampled = std::make_unique<shared_pose_t>();
+	sampled->locals.resize(m_set->skeleton.num_soa_joints());
+	sampled->models.resize(m_set->skeleton.num_joints());
+
+	ozz::animation::SamplingJob sampling_job;
+	sampling_job.animation = poses.animation;
+	sampling_job.cache = &m_cache;
+	sampling_job.ratio = float(index) / float(poses.count);
+	sampling_job.output = ozz::make_span(sampled->locals);
+	if (!sampling_job.Run()) {
+		return nullptr;
+	}
+
+	ozz::animation::LocalToModelJob ltm_job;
+	ltm_job.skeleton = &m_set->skeleton;
+	ltm_job.input = ozz::make_span(sampled->locals);
+	ltm_job.output = ozz::make_span(sampled->models);
+	if (!ltm_job.Run()) {
+		return nullptr;
+	}
+
+	pose = sampled.get();
+	m_poses.push_back(std::move(sampled));
+	poses.slots[index].store(pose, std::memory_order_release);
+
+	return pose;
+}
+
+bool AnimationSet::load_skeleton(const std::string &filepath)
 {
 	ozz::io::File file(filepath.c_str(), "rb");
 
@@ -184,6 +359,80 @@ bool Animator::load_skeleton(const std::string &filepath)
 	return true;
 }
 
+void AnimationScheduler::schedule(const glm::vec3 &eye, const glm::mat4 &viewproj, const std::vector<geom::sphere_t> &bounds, uint32_t full_joints, uint32_t reduced_joints)
+{
+	if (m_lods.size() != bounds.size()) {
+		m_lods.resize(bounds.size());
+		// new instances need a sample as soon as they are seen
+		m_ages.assign(bounds.size(), std::numeric_limits<uint32_t>::max());
+		m_intervals.assign(bounds.size(), 1);
+		m_distances.resize(bounds.size());
+	}
+
+	glm::vec4 planes[6];
+	geom::frustum_to_planes(viewproj, planes);
+
+	m_due.clear();
+	for (int i = 0; i < bounds.size(); i++) {
+		const glm::vec3 extents = glm::vec3(bounds[i].radius);
+		animation_lod_t &lod = m_lods[i];
+		const bool was_visible = lod.visible;
+		lod.visible = geom::AABB_in_frustum(bounds[i].center - extents, bounds[i].center + extents, planes);
+		lod.sample = false;
+		lod.snap = false;
+
+		if (!lod.visible) {
+			// sample right away when it comes back into view
+			m_ages[i] = std::numeric_limits<uint32_t>::max();
+			continue;
+		}
+
+		const float distance = glm::distance(eye, bounds[i].center);
+		m_distances[i] = distance;
+		lod.reduced = distance > settings.reduced_distance;
+		lod.shared = distance > settings.full_distance;
+		if (distance < settings.full_distance) {
+			m_intervals[i] = 1;
+		} else {
+			m_intervals[i] = glm::clamp(uint32_t(distance / settings.full_distance) + 1, 1u, settings.max_interval);
+		}
+
+		if (!was_visible || m_ages[i] == std::numeric_limits<uint32_t>::max()) {
+			lod.snap = true;
+		}
+		if (m_ages[i] == std::numeric_limits<uint32_t>::max() || m_ages[i] + 1 >= m_intervals[i]) {
+			m_due.push_back(i);
+		}
+	}
+
+	// closest first, they are the most noticeable if they skip a sample
+	std::sort(m_due.begin(), m_due.end(), [&](uint32_t a, uint32_t b) {
+		return m_distances[a] < m_distances[b];
+	});
+
+	uint32_t budget = settings.joint_budget;
+	for (const auto i : m_due) {
+		const uint32_t cost = m_lods[i].reduced ? reduced_joints : full_joints;
+		// instances without a valid sample yet always pass
+		if (cost > budget && !m_lods[i].snap) { continue; }
+		budget = cost > budget ? 0 : budget - cost;
+		m_lods[i].sample = true;
+		m_ages[i] = 0;
+	}
+
+	for (int i = 0; i < bounds.size(); i++) {
+		animation_lod_t &lod = m_lods[i];
+		if (!lod.visible) { continue; }
+		if (lod.sample) {
+			// sampled every frame shows the new sample, otherwise start from the previous one
+			lod.alpha = (m_intervals[i] == 1 || lod.snap) ? 1.f : 0.f;
+		} else {
+			m_ages[i] = glm::min(m_ages[i] + 1, m_intervals[i] * settings.max_interval);
+			lod.alpha = glm::min(1.f, float(m_ages[i]) / float(m_intervals[i]));
+		}
+	}
+}
+
 PlaybackController::PlaybackController()
 {
 	time_ratio = 0.f;
@@ -37,6 +37,22 @@ private:
 	bool m_looping;
 };
 
+// skeleton and clips as loaded from disk
+// they never change after loading so every animator playing them can share one copy
+class AnimationSet {
+public:
+	ozz::animation::Skeleton skeleton;
+	std::map<uint32_t, ozz::animation::Animation> animations;
+public:
+	bool load(const std::string &skeletonpath, const std::vector<std::pair<uint32_t, std::string>> &animationpaths);
+private:
+	bool load_skeleton(const std::string &filepath);
+	bool load_animation(const std::string &filepath, ozz::animation::Animation &animation);
+};
+
+// each set is only loaded once, it is freed when the last handle to it is gone
+std::shared_ptr<const AnimationSet> load_animation_set(const std::string &skeletonpath, const std::vector<std::pair<uint32_t, std::string>> &animationpaths);
+
 // Sampler structure contains all the data required to sample a single
 // animation.
 class AnimationSampler {
@@ -46,34 +62,131 @@ public:
 	PlaybackController controller;
 	// Blending weight for the layer.
 	float weight = 1.f;
-	// Runtime animation.
-	ozz::animation::Animation animation;
+	// Runtime animation, owned by the animation set.
+	const ozz::animation::Animation *animation = nullptr;
 	// Sampling cache.
 	ozz::animation::SamplingCache cache;
 	// Buffer of local transforms as sampled from animation_.
 	std::vector<ozz::math::SoaTransform> locals;
-public: 
-	bool load(const std::string &filepath);
+	// clock of the animator when the controller was last updated
+	double synced = 0.0;
+};
+
+static const uint32_t MAX_ANIMATION_LAYERS = 3;
+
+// clips blended into one pose, layers without weight are left out
+struct animation_blend_t {
+	uint32_t clips[MAX_ANIMATION_LAYERS];
+	float weights[MAX_ANIMATION_LAYERS];
+	uint32_t count = 0;
+
+	void add(uint32_t clip, float weight)
+	{
+		if (count < MAX_ANIMATION_LAYERS && weight > 0.f) {
+			clips[count] = clip;
+			weights[count] = weight;
+			count++;
+		}
+	}
+};
+
+// what an animator does this frame, decided by the AnimationScheduler
+struct animation_lod_t {
+	bool visible = true; // off screen animators only keep track of the playback time
+	bool sample = true; // otherwise the output is interpolated between the last two samples
+	bool snap = false; // previous sample is outdated, don't interpolate from it
+	bool reduced = false; // far away so only the major joints need to be skinned
+	bool shared = false; // far enough that a pose from the shared pose cache is close enough
+	float alpha = 1.f; // interpolation factor between the last two samples
+};
+
+struct animation_lod_settings_t {
+	float full_distance = 20.f; // closer than this is sampled every frame
+	float reduced_distance = 60.f; // further than this uses the reduced joint set
+	uint32_t max_interval = 8; // most frames between two samples of a visible animator
+	uint32_t joint_budget = 16384; // joints that can be sampled in one frame
+};
+
+// pose of a clip at a fixed time, it never changes once it is sampled
+struct shared_pose_t {
+	std::vector<ozz::math::SoaTransform> locals;
+	std::vector<ozz::math::Float4x4> models;
+};
+
+// poses of every clip in a set sampled at a fixed rate
+// animators in the same clip at about the same time share one pose instead of sampling their own
+class AnimationPoseCache {
+public:
+	AnimationPoseCache(std::shared_ptr<const AnimationSet> set, float rate);
+	// pose closest to the time ratio, sampled on first use
+	// safe to call from several threads
+	const shared_pose_t* pose(uint32_t clip, float ratio);
+private:
+	struct clip_poses_t {
+		const ozz::animation::Animation *animation = nullptr;
+		uint32_t count = 0;
+		std::unique_ptr<std::atomic<const shared_pose_t*>[]> slots;
+	};
+	std::shared_ptr<const AnimationSet> m_set;
+	std::map<uint32_t, clip_poses_t> m_clips;
+	std::vector<std::unique_ptr<shared_pose_t>> m_poses;
+	ozz::animation::SamplingCache m_cache;
+	std::mutex m_mutex;
 };
 
 // skeleton animation
 class Animator {
 public:
-	std::map<uint32_t, std::unique_ptr<AnimationSampler>> samplers;
+	// indexed by clip ID, IDs missing from the set have no animation
+	std::unique_ptr<AnimationSampler[]> samplers;
+	uint32_t sampler_count = 0;
 	std::vector<ozz::math::Float4x4> models;
 	// Buffer of local transforms which stores the blending result.
 	std::vector<ozz::math::SoaTransform> blended_locals;
-	ozz::animation::Skeleton skeleton;
 public:
-	Animator(const std::string &skeletonpath, const std::vector<std::pair<uint32_t, std::string>> &animationpaths);
+	Animator(std::shared_ptr<const AnimationSet> set);
 	void update(float delta, uint32_t first, uint32_t second, float mix);
+	void update(float delta, uint32_t first, uint32_t second, float mix, const animation_lod_t &lod);
+	// nothing is allocated in here, every buffer is sized when the animator is made
+	void update(float delta, const animation_blend_t &blend, const animation_lod_t &lod);
 	bool is_valid() const { return m_valid; }
+	const ozz::animation::Skeleton& skeleton() const { return m_set->skeleton; }
+	void set_pose_cache(AnimationPoseCache *poses) { m_poses = poses; }
+	// model space matrices of the current pose, either shared or owned by this animator
+	const std::vector<ozz::math::Float4x4>& pose() const { return *m_output; }
 private:
+	std::shared_ptr<const AnimationSet> m_set;
+	AnimationPoseCache *m_poses = nullptr;
+	// the last two sampled poses, models is interpolated between them
+	// a shared pose is used in place so only poses sampled by this animator need a buffer
+	std::vector<ozz::math::Float4x4> m_buffers[2];
+	const std::vector<ozz::math::Float4x4> *m_previous = nullptr;
+	const std::vector<ozz::math::Float4x4> *m_current = nullptr;
+	const std::vector<ozz::math::Float4x4> *m_output = nullptr;
+	// seconds played, clips that were not in use catch up to it when they are sampled again
+	double m_clock = 0.0;
+	ozz::animation::BlendingJob::Layer m_layers[MAX_ANIMATION_LAYERS];
 	// Blending job bind pose threshold.
 	float m_threshold = 0.1f;
 	bool m_valid = true;
 private:
-	bool load_skeleton(const std::string &filepath);
+	const std::vector<ozz::math::Float4x4>* sample(const animation_blend_t &blend, AnimationPoseCache *poses, std::vector<ozz::math::Float4x4> &output);
+};
+
+// decides for every animated instance how often it gets sampled based on camera distance and visibility
+// instances close to the camera go first when the joint budget runs out
+class AnimationScheduler {
+public:
+	animation_lod_settings_t settings;
+public:
+	void schedule(const glm::vec3 &eye, const glm::mat4 &viewproj, const std::vector<geom::sphere_t> &bounds, uint32_t full_joints, uint32_t reduced_joints);
+	const animation_lod_t& lod(size_t index) const { return m_lods[index]; }
+private:
+	std::vector<animation_lod_t> m_lods;
+	std::vector<uint32_t> m_ages; // frames since the last sample
+	std::vector<uint32_t> m_intervals; // frames between two samples
+	std::vector<float> m_distances;
+	std::vector<uint32_t> m_due; // instances that want a sample this frame
 };
 
 };
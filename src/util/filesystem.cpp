@@ -0,0 +1,141 @@
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <algorithm>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <sys/types.h>
+#include <sys/utime.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <utime.h>
+#endif
+
+#include "filesystem.h"
+
+namespace util {
+
+static bool ends_with(const std::string &name, const std::string &extension);
+
+#ifdef _WIN32
+bool directory_exists(const std::string &path)
+{
+	DWORD attributes = GetFileAttributesA(path.c_str());
+
+	return attributes != INVALID_FILE_ATTRIBUTES && (attributes & FILE_ATTRIBUTE_DIRECTORY);
+}
+
+std::vector<file_info_t> list_files(const std::string &directory, const std::string &extension)
+{
+	std::vector<file_info_t> files;
+
+	std::string root = directory;
+	if (root.back() != '/' && root.back() != '\\') { root += '\\'; }
+
+	WIN32_FIND_DATAA data;
+	HANDLE search = FindFirstFileA((root + "*").c_str(), &data);
+	if (search == INVALID_HANDLE_VALUE) { return files; }
+
+	do {
+		const std::string name = data.cFileName;
+		if ((data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) || !ends_with(name, extension)) {
+			continue;
+		}
+		file_info_t file;
+		file.path = root + name;
+		file.size = (uint64_t(data.nFileSizeHigh) << 32) | data.nFileSizeLow;
+		file.last_write = (uint64_t(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime;
+		files.push_back(file);
+	} while (FindNextFileA(search, &data));
+	FindClose(search);
+
+	return files;
+}
+
+void touch_file(const std::string &path)
+{
+	_utime(path.c_str(), nullptr);
+}
+
+bool replace_file(const std::string &from, const std::string &to)
+{
+	// rename() refuses to overwrite an existing file on Windows
+	return MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+}
+#else
+bool directory_exists(const std::string &path)
+{
+	struct stat info;
+
+	return stat(path.c_str(), &info) == 0 && S_ISDIR(info.st_mode);
+}
+
+std::vector<file_info_t> list_files(const std::string &directory, const std::string &extension)
+{
+	std::vector<file_info_t> files;
+
+	std::string root = directory;
+	if (root.back() != '/') { root += '/'; }
+
+	DIR *dir = opendir(root.c_str());
+	if (!dir) { return files; }
+
+	while (struct dirent *entry = readdir(dir)) {
+		const std::string name = entry->d_name;
+		if (!ends_with(name, extension)) { continue; }
+		file_info_t file;
+		file.path = root + name;
+		struct stat info;
+		if (stat(file.path.c_str(), &info) != 0 || !S_ISREG(info.st_mode)) { continue; }
+		file.size = info.st_size;
+		file.last_write = info.st_mtime;
+		files.push_back(file);
+	}
+	closedir(dir);
+
+	return files;
+}
+
+void touch_file(const std::string &path)
+{
+	utime(path.c_str(), nullptr);
+}
+
+bool replace_file(const std::string &from, const std::string &to)
+{
+	return std::rename(from.c_str(), to.c_str()) == 0;
+}
+#endif
+
+void prune_files(const std::string &directory, const std::string &extension, uint64_t max_bytes)
+{
+	std::vector<file_info_t> entries = list_files(directory, extension);
+	uint64_t total = 0;
+	for (const auto &entry : entries) {
+		total += entry.size;
+	}
+
+	if (total <= max_bytes) { return; }
+
+	std::sort(entries.begin(), entries.end(), [](const file_info_t &a, const file_info_t &b) {
+		return a.last_write < b.last_write;
+	});
+
+	for (const auto &entry : entries) {
+		if (total <= max_bytes) { break; }
+		if (std::remove(entry.path.c_str()) == 0) {
+			total -= entry.size;
+		}
+	}
+}
+
+static bool ends_with(const std::string &name, const std::string &extension)
+{
+	return name.size() > extension.size() && name.compare(name.size() - extension.size(), extension.size(), extension) == 0;
+}
+
+};
@@ -0,0 +1,19 @@
+namespace util {
+
+struct file_info_t {
+	std::string path;
+	uint64_t size = 0;
+	uint64_t last_write = 0; // only comparable to other files on the same system
+};
+
+bool directory_exists(const std::string &path);
+// regular files directly in the directory that end with the extension
+std::vector<file_info_t> list_files(const std::string &directory, const std::string &extension);
+// sets the last write time to now, the file itself is left alone
+void touch_file(const std::string &path);
+// removes the least recently written files with the extension until the rest fit in max_bytes
+void prune_files(const std::string &directory, const std::string &extension, uint64_t max_bytes);
+// moves the file over the destination, replacing it if it exists
+bool replace_file(const std::string &from, const std::string &to);
+
+};
@@ -0,0 +1,246 @@
+#include <vector>
+#include <string>
+#include <list>
+#include <queue>
+#include <memory>
+#include <unordered_map>
+#include <limits>
+#include <functional>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "../extern/recast/Recast.h"
+#include "../extern/recast/DetourNavMesh.h"
+#include "../extern/recast/DetourNavMeshQuery.h"
+#include "../extern/recast/ChunkyTriMesh.h"
+
+#include "../geometry/geom.h"
+#include "image.h"
+#include "mappedfile.h"
+#include "navcache.h"
+#include "navigation.h"
+#include "flowfield.h"
+
+namespace util {
+
+static const float BOX_EXTENTS[3] = { 512.f, 512.f, 512.f }; // size of box around the goal to look for nav polygons
+static const uint32_t NO_TILE = std::numeric_limits<uint32_t>::max();
+static const float UNREACHABLE = std::numeric_limits<float>::max();
+
+static glm::vec3 portal_midpoint(const dtMeshTile *tile, const dtPoly *poly, const dtLink *link);
+
+FlowField::FlowField(const dtNavMesh *navmesh)
+	: navmesh(navmesh)
+{
+}
+
+bool FlowField::build(const dtNavMeshQuery *navquery, const glm::vec3 &goal_position)
+{
+	dtQueryFilter filter;
+	filter.setIncludeFlags(0xFFFF);
+	filter.setExcludeFlags(0);
+	filter.setAreaCost(SAMPLE_POLYAREA_GROUND, 1.f);
+
+	goal = goal_position;
+	goal_poly = 0;
+
+	float nearest[3];
+	dtStatus status = navquery->findNearestPoly(glm::value_ptr(goal_position), BOX_EXTENTS, &filter, &goal_poly, nearest);
+	if (dtStatusFailed(status) || !goal_poly) {
+		return false;
+	}
+	goal = glm::vec3(nearest[0], nearest[1], nearest[2]);
+
+	// every polygon in the navmesh gets a cell, tiles are laid out one after another
+	const int max_tiles = navmesh->getMaxTiles();
+	tile_offsets.assign(max_tiles, NO_TILE);
+	tile_salts.assign(max_tiles, 0);
+	uint32_t count = 0;
+	for (int i = 0; i < max_tiles; i++) {
+		const dtMeshTile *tile = navmesh->getTile(i);
+		if (!tile || !tile->header) { continue; }
+		tile_offsets[i] = count;
+		tile_salts[i] = tile->salt;
+		count += tile->header->polyCount;
+	}
+
+	integration.assign(count, UNREACHABLE);
+	waypoints.assign(count, goal);
+
+	// Dijkstra from the goal outwards, the cost between two polygons is the distance between their portals
+	typedef std::pair<float, dtPolyRef> node_t;
+	std::priority_queue<node_t, std::vector<node_t>, std::greater<node_t>> open;
+
+	integration[poly_index(goal_poly)] = 0.f;
+	open.push(std::make_pair(0.f, goal_poly));
+
+	while (!open.empty()) {
+		const node_t current = open.top();
+		open.pop();
+
+		const int32_t current_index = poly_index(current.second);
+		if (current.first > integration[current_index]) { continue; }
+
+		const dtMeshTile *tile = nullptr;
+		const dtPoly *poly = nullptr;
+		navmesh->getTileAndPolyByRefUnsafe(current.second, &tile, &poly);
+		const glm::vec3 &anchor = waypoints[current_index];
+
+		for (unsigned int i = poly->firstLink; i != DT_NULL_LINK; i = tile->links[i].next) {
+			const dtLink *link = &tile->links[i];
+			if (!link->ref) { continue; }
+
+			const dtMeshTile *neighbour_tile = nullptr;
+			const dtPoly *neighbour_poly = nullptr;
+			navmesh->getTileAndPolyByRefUnsafe(link->ref, &neighbour_tile, &neighbour_poly);
+			if (neighbour_poly->getType() == DT_POLYTYPE_OFFMESH_CONNECTION) { continue; }
+			if (!filter.passFilter(link->ref, neighbour_tile, neighbour_poly)) { continue; }
+
+			const int32_t neighbour_index = poly_index(link->ref);
+			if (neighbour_index < 0) { continue; }
+
+			const glm::vec3 portal = portal_midpoint(tile, poly, link);
+			const float cost = current.first + glm::distance(portal, anchor);
+			if (cost < integration[neighbour_index]) {
+				integration[neighbour_index] = cost;
+				waypoints[neighbour_index] = portal;
+				open.push(std::make_pair(cost, link->ref));
+			}
+		}
+	}
+
+	return true;
+}
+
+bool FlowField::stale() const
+{
+	const int max_tiles = navmesh->getMaxTiles();
+	if (max_tiles != int(tile_offsets.size())) { return true; }
+
+	for (int i = 0; i < max_tiles; i++) {
+		const dtMeshTile *tile = navmesh->getTile(i);
+		const bool present = (tile && tile->header);
+		if (present != (tile_offsets[i] != NO_TILE)) { return true; }
+		if (present && tile->salt != tile_salts[i]) { return true; }
+	}
+
+	return false;
+}
+
+bool FlowField::reachable(dtPolyRef poly) const
+{
+	return cost(poly) < UNREACHABLE;
+}
+
+float FlowField::cost(dtPolyRef poly) const
+{
+	int32_t index = poly_index(poly);
+	if (index < 0) { return UNREACHABLE; }
+
+	return integration[index];
+}
+
+glm::vec3 FlowField::direction(dtPolyRef poly, const glm::vec3 &position) const
+{
+	int32_t index = poly_index(poly);
+	if (index < 0 || integration[index] == UNREACHABLE) {
+		return glm::vec3(0.f);
+	}
+
+	glm::vec3 heading = waypoints[index] - position;
+	heading.y = 0.f;
+	float length = glm::length(heading);
+	if (length < 0.001f) {
+		return glm::vec3(0.f);
+	}
+
+	return heading / length;
+}
+
+int32_t FlowField::poly_index(dtPolyRef poly) const
+{
+	if (!poly) { return -1; }
+
+	unsigned int salt = 0, it = 0, ip = 0;
+	navmesh->decodePolyId(poly, salt, it, ip);
+	if (it >= tile_offsets.size() || tile_offsets[it] == NO_TILE || tile_salts[it] != salt) {
+		return -1;
+	}
+
+	const uint32_t index = tile_offsets[it] + ip;
+	if (index >= integration.size()) { return -1; }
+
+	return index;
+}
+
+FlowFieldCache::FlowFieldCache(const dtNavMesh *navmesh, const dtNavMeshQuery *navquery)
+	: navmesh(navmesh), navquery(navquery)
+{
+}
+
+const FlowField* FlowFieldCache::request(const glm::vec3 &goal)
+{
+	dtQueryFilter filter;
+	filter.setIncludeFlags(0xFFFF);
+	filter.setExcludeFlags(0);
+	filter.setAreaCost(SAMPLE_POLYAREA_GROUND, 1.f);
+
+	dtPolyRef goal_poly = 0;
+	float nearest[3];
+	dtStatus status = navquery->findNearestPoly(glm::value_ptr(goal), BOX_EXTENTS, &filter, &goal_poly, nearest);
+	if (dtStatusFailed(status) || !goal_poly) {
+		return nullptr;
+	}
+
+	cached_field_t &cached = fields[goal_poly];
+	cached.requested = true;
+	if (cached.field && !cached.field->stale()) {
+		return cached.field.get();
+	}
+
+	cached.field = std::make_unique<FlowField>(navmesh);
+	if (!cached.field->build(navquery, goal)) {
+		fields.erase(goal_poly);
+		return nullptr;
+	}
+
+	return cached.field.get();
+}
+
+void FlowFieldCache::collect()
+{
+	for (auto it = fields.begin(); it != fields.end(); ) {
+		if (it->second.requested) {
+			it->second.requested = false;
+			++it;
+		} else {
+			it = fields.erase(it);
+		}
+	}
+}
+
+void FlowFieldCache::clear()
+{
+	fields.clear();
+}
+
+// middle of the edge shared with the linked polygon
+// links on tile borders can cover only part of the edge
+static glm::vec3 portal_midpoint(const dtMeshTile *tile, const dtPoly *poly, const dtLink *link)
+{
+	const float *va = &tile->verts[poly->verts[link->edge]*3];
+	const float *vb = &tile->verts[poly->verts[(link->edge+1) % poly->vertCount]*3];
+	glm::vec3 left = glm::make_vec3(va);
+	glm::vec3 right = glm::make_vec3(vb);
+
+	if (link->side != 0xff && (link->bmin != 0 || link->bmax != 255)) {
+		const float s = 1.f / 255.f;
+		glm::vec3 edge = right - left;
+		right = left + (link->bmax * s) * edge;
+		left = left + (link->bmin * s) * edge;
+	}
+
+	return 0.5f * (left + right);
+}
+
+};
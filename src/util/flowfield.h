@@ -0,0 +1,46 @@
+namespace util {
+
+// shortest path tree over the navmesh polygons towards a single goal
+// every polygon knows the portal it has to leave through, so agents only need a lookup instead of a path query
+class FlowField {
+public:
+	FlowField(const dtNavMesh *navmesh);
+public:
+	bool build(const dtNavMeshQuery *navquery, const glm::vec3 &goal);
+	bool stale() const; // tiles have been rebuilt since the field was built
+	bool reachable(dtPolyRef poly) const;
+	float cost(dtPolyRef poly) const;
+	glm::vec3 direction(dtPolyRef poly, const glm::vec3 &position) const;
+	const glm::vec3& get_goal() const { return goal; }
+	dtPolyRef get_goal_poly() const { return goal_poly; }
+private:
+	const dtNavMesh *navmesh = nullptr;
+	glm::vec3 goal = {};
+	dtPolyRef goal_poly = 0;
+	std::vector<uint32_t> tile_offsets; // index of the first polygon of each tile
+	std::vector<uint32_t> tile_salts;
+	std::vector<float> integration; // path cost to the goal of each polygon
+	std::vector<glm::vec3> waypoints; // where to go next from each polygon
+private:
+	int32_t poly_index(dtPolyRef poly) const;
+};
+
+// fields are shared by every agent moving to the same goal polygon
+class FlowFieldCache {
+public:
+	FlowFieldCache(const dtNavMesh *navmesh, const dtNavMeshQuery *navquery);
+public:
+	const FlowField* request(const glm::vec3 &goal);
+	void collect(); // removes the fields that were not requested since the last collect
+	void clear();
+private:
+	struct cached_field_t {
+		std::unique_ptr<FlowField> field;
+		bool requested = false;
+	};
+	const dtNavMesh *navmesh = nullptr;
+	const dtNavMeshQuery *navquery = nullptr;
+	std::unordered_map<dtPolyRef, cached_field_t> fields;
+};
+
+};
@@ -0,0 +1,23 @@
+namespace util {
+
+// FNV-1a, incremental so input can be hashed piece by piece
+// used for cache keys and checksums, not for anything that has to be secure
+struct fnv_hash_t {
+	uint64_t value = 14695981039346656037ULL;
+
+	void add(const void *data, size_t size)
+	{
+		const uint8_t *bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; i++) {
+			value ^= bytes[i];
+			value *= 1099511628211ULL;
+		}
+	}
+	template <class T>
+	void add(const T &data)
+	{
+		add(&data, sizeof(T));
+	}
+};
+
+};
@@ -0,0 +1,261 @@
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+
+#include "../geometry/geom.h"
+#include "image.h"
+#include "heightquery.h"
+#include "heightpyramid.h"
+
+namespace util {
+
+static const float PARALLEL_EPSILON = 1e-12f;
+
+void HeightPyramid::build(const HeightQuery *query)
+{
+	levels.clear();
+
+	heights = query;
+	if (!heights || !heights->bound() || heights->get_width() < 2 || heights->get_height() < 2) {
+		heights = nullptr;
+		return;
+	}
+
+	pyramid_level_t leaves;
+	leaves.columns = heights->get_width() - 1;
+	leaves.rows = heights->get_height() - 1;
+	leaves.ranges.resize(size_t(leaves.columns) * leaves.rows);
+	levels.push_back(std::move(leaves));
+
+	#pragma omp parallel for
+	for (int y = 0; y < levels[0].rows; y++) {
+		for (int x = 0; x < levels[0].columns; x++) {
+			fit_leaf(x, y);
+		}
+	}
+
+	// halve until a single root node remains
+	while (levels.back().columns > 1 || levels.back().rows > 1) {
+		pyramid_level_t parent;
+		parent.columns = (levels.back().columns + 1) / 2;
+		parent.rows = (levels.back().rows + 1) / 2;
+		parent.ranges.resize(size_t(parent.columns) * parent.rows);
+		levels.push_back(std::move(parent));
+
+		const size_t level = levels.size() - 1;
+		#pragma omp parallel for
+		for (int y = 0; y < levels[level].rows; y++) {
+			for (int x = 0; x < levels[level].columns; x++) {
+				fit_node(level, x, y);
+			}
+		}
+	}
+}
+
+void HeightPyramid::clear()
+{
+	levels.clear();
+	heights = nullptr;
+}
+
+height_range_t HeightPyramid::bounds(const glm::vec2 &min, const glm::vec2 &max) const
+{
+	height_range_t range;
+	if (levels.empty()) { return range; }
+
+	const glm::vec3 scale = heights->get_scale();
+	const glm::vec2 spacing = { scale.x / float(heights->get_width()), scale.z / float(heights->get_height()) };
+
+	// cells are between texel centers
+	const pyramid_level_t &leaves = levels.front();
+	int min_x = glm::clamp(int(floorf(min.x / spacing.x - 0.5f)), 0, leaves.columns-1);
+	int min_y = glm::clamp(int(floorf(min.y / spacing.y - 0.5f)), 0, leaves.rows-1);
+	int max_x = glm::clamp(int(floorf(max.x / spacing.x - 0.5f)), 0, leaves.columns-1);
+	int max_y = glm::clamp(int(floorf(max.y / spacing.y - 0.5f)), 0, leaves.rows-1);
+
+	gather(levels.size()-1, 0, 0, min_x, min_y, max_x, max_y, range);
+
+	range.min *= scale.y;
+	range.max *= scale.y;
+
+	return range;
+}
+
+bool HeightPyramid::intersect(const glm::vec3 &origin, const glm::vec3 &direction, float max_distance, float &distance) const
+{
+	if (levels.empty()) { return false; }
+
+	// texel space like the height query so the leaves can solve the bilinear patch
+	const glm::vec3 scale = heights->get_scale();
+	const glm::vec2 spacing = { scale.x / float(heights->get_width()), scale.z / float(heights->get_height()) };
+	const glm::vec3 o = { origin.x / spacing.x - 0.5f, origin.y / scale.y, origin.z / spacing.y - 0.5f };
+	const glm::vec3 d = { direction.x / spacing.x, direction.y / scale.y, direction.z / spacing.y };
+
+	return traverse(levels.size()-1, 0, 0, o, d, 0.f, max_distance, distance);
+}
+
+void HeightPyramid::update(int min_x, int min_y, int max_x, int max_y)
+{
+	if (levels.empty()) { return; }
+
+	// a texel is a corner of the four cells around it
+	min_x = std::max(min_x - 1, 0);
+	min_y = std::max(min_y - 1, 0);
+	max_x = std::min(max_x, levels[0].columns-1);
+	max_y = std::min(max_y, levels[0].rows-1);
+	if (min_x > max_x || min_y > max_y) { return; }
+
+	for (int y = min_y; y <= max_y; y++) {
+		for (int x = min_x; x <= max_x; x++) {
+			fit_leaf(x, y);
+		}
+	}
+
+	for (size_t level = 1; level < levels.size(); level++) {
+		min_x /= 2;
+		min_y /= 2;
+		max_x /= 2;
+		max_y /= 2;
+		for (int y = min_y; y <= max_y; y++) {
+			for (int x = min_x; x <= max_x; x++) {
+				fit_node(level, x, y);
+			}
+		}
+	}
+}
+
+void HeightPyramid::fit_leaf(int x, int y)
+{
+	const float h00 = heights->texel(x, y);
+	const float h10 = heights->texel(x+1, y);
+	const float h01 = heights->texel(x, y+1);
+	const float h11 = heights->texel(x+1, y+1);
+
+	// a bilinear patch never leaves the range of its corners
+	height_range_t &range = levels[0].ranges[size_t(y) * levels[0].columns + x];
+	range.min = std::min(std::min(h00, h10), std::min(h01, h11));
+	range.max = std::max(std::max(h00, h10), std::max(h01, h11));
+}
+
+void HeightPyramid::fit_node(size_t level, int x, int y)
+{
+	const pyramid_level_t &children = levels[level-1];
+
+	height_range_t range;
+	for (int j = 2*y; j <= std::min(2*y+1, children.rows-1); j++) {
+		for (int i = 2*x; i <= std::min(2*x+1, children.columns-1); i++) {
+			range.merge(children.ranges[size_t(j) * children.columns + i]);
+		}
+	}
+
+	levels[level].ranges[size_t(y) * levels[level].columns + x] = range;
+}
+
+// nodes completely inside the rectangle are taken whole, only the nodes on its border are split
+void HeightPyramid::gather(size_t level, int x, int y, int min_x, int min_y, int max_x, int max_y, height_range_t &range) const
+{
+	const pyramid_level_t &current = levels[level];
+	if (x >= current.columns || y >= current.rows) { return; }
+
+	const int first_x = x << level;
+	const int first_y = y << level;
+	const int last_x = std::min(((x + 1) << level) - 1, levels[0].columns-1);
+	const int last_y = std::min(((y + 1) << level) - 1, levels[0].rows-1);
+
+	if (last_x < min_x || first_x > max_x || last_y < min_y || first_y > max_y) {
+		return;
+	}
+
+	if (level == 0 || (first_x >= min_x && last_x <= max_x && first_y >= min_y && last_y <= max_y)) {
+		range.merge(current.ranges[size_t(y) * current.columns + x]);
+		return;
+	}
+
+	for (int j = 0; j < 2; j++) {
+		for (int i = 0; i < 2; i++) {
+			gather(level-1, 2*x + i, 2*y + j, min_x, min_y, max_x, max_y, range);
+		}
+	}
+}
+
+bool HeightPyramid::traverse(size_t level, int x, int y, const glm::vec3 &o, const glm::vec3 &d, float t0, float t1, float &t) const
+{
+	float enter, exit;
+	if (!node_interval(level, x, y, o, d, enter, exit)) { return false; }
+	enter = std::max(enter, t0);
+	exit = std::min(exit, t1);
+	if (enter > exit) { return false; }
+
+	// the ray has to be below the highest point of the node somewhere in it
+	const height_range_t &range = levels[level].ranges[size_t(y) * levels[level].columns + x];
+	const float y0 = o.y + enter * d.y;
+	const float y1 = o.y + exit * d.y;
+	if (y0 > range.max && y1 > range.max) { return false; }
+
+	if (level == 0) {
+		return heights->intersect_cell(x, y, o, d, enter, exit, t);
+	}
+
+	// visit the children in the order the ray enters them
+	struct child_t {
+		int x, y;
+		float enter;
+	};
+	child_t children[4];
+	int count = 0;
+	const pyramid_level_t &below = levels[level-1];
+	for (int j = 0; j < 2; j++) {
+		for (int i = 0; i < 2; i++) {
+			child_t child = { 2*x + i, 2*y + j, 0.f };
+			if (child.x >= below.columns || child.y >= below.rows) { continue; }
+			float child_exit;
+			if (!node_interval(level-1, child.x, child.y, o, d, child.enter, child_exit)) { continue; }
+			if (std::max(child.enter, enter) > std::min(child_exit, exit)) { continue; }
+			children[count++] = child;
+		}
+	}
+	std::sort(children, children + count, [](const child_t &a, const child_t &b) {
+		return a.enter < b.enter;
+	});
+
+	for (int i = 0; i < count; i++) {
+		if (traverse(level-1, children[i].x, children[i].y, o, d, enter, exit, t)) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// the part of the ray above or below the horizontal area of the node
+bool HeightPyramid::node_interval(size_t level, int x, int y, const glm::vec3 &o, const glm::vec3 &d, float &t0, float &t1) const
+{
+	const float min[2] = { float(x << level), float(y << level) };
+	const float max[2] = {
+		float(std::min((x + 1) << level, levels[0].columns)),
+		float(std::min((y + 1) << level, levels[0].rows))
+	};
+	const float starts[2] = { o.x, o.z };
+	const float steps[2] = { d.x, d.z };
+
+	t0 = std::numeric_limits<float>::lowest();
+	t1 = std::numeric_limits<float>::max();
+	for (int axis = 0; axis < 2; axis++) {
+		if (fabsf(steps[axis]) < PARALLEL_EPSILON) {
+			if (starts[axis] < min[axis] || starts[axis] > max[axis]) { return false; }
+			continue;
+		}
+		float near = (min[axis] - starts[axis]) / steps[axis];
+		float far = (max[axis] - starts[axis]) / steps[axis];
+		if (near > far) { std::swap(near, far); }
+		t0 = std::max(t0, near);
+		t1 = std::min(t1, far);
+	}
+
+	return t0 <= t1;
+}
+
+};
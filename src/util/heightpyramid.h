@@ -0,0 +1,47 @@
+namespace util {
+
+struct height_range_t {
+	float min = std::numeric_limits<float>::max();
+	float max = std::numeric_limits<float>::lowest();
+
+	void merge(const height_range_t &other)
+	{
+		min = std::min(min, other.min);
+		max = std::max(max, other.max);
+	}
+	bool empty() const { return min > max; }
+};
+
+// quadtree of the lowest and highest height below each node of a heightmap
+// the leaves are the bilinear cells between four texels, each level above halves the resolution
+class HeightPyramid {
+public:
+	// the heights have to stay bound as long as the pyramid is used
+	void build(const HeightQuery *heights);
+	void clear();
+	bool built() const { return !levels.empty(); }
+	int get_depth() const { return levels.size(); }
+public:
+	// world height range of every cell that overlaps the rectangle
+	height_range_t bounds(const glm::vec2 &min, const glm::vec2 &max) const;
+	// first intersection of a ray with the surface, descends only into nodes the ray passes through under their highest point
+	bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, float max_distance, float &distance) const;
+	// refits the texel rectangle and its parents after the heightmap was changed there
+	void update(int min_x, int min_y, int max_x, int max_y);
+private:
+	struct pyramid_level_t {
+		int columns = 0;
+		int rows = 0;
+		std::vector<height_range_t> ranges;
+	};
+	const HeightQuery *heights = nullptr;
+	std::vector<pyramid_level_t> levels; // the leaves first
+private:
+	void fit_leaf(int x, int y);
+	void fit_node(size_t level, int x, int y);
+	void gather(size_t level, int x, int y, int min_x, int min_y, int max_x, int max_y, height_range_t &range) const;
+	bool traverse(size_t level, int x, int y, const glm::vec3 &origin, const glm::vec3 &direction, float t0, float t1, float &t) const;
+	bool node_interval(size_t level, int x, int y, const glm::vec3 &origin, const glm::vec3 &direction, float &t0, float &t1) const;
+};
+
+};
@@ -0,0 +1,275 @@
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+
+#include "../geometry/geom.h"
+#include "image.h"
+#include "heightquery.h"
+
+namespace util {
+
+static inline float cubic(float p0, float p1, float p2, float p3, float t);
+
+void HeightQuery::bind(const Image<float> *image, const glm::vec3 &world_scale)
+{
+	converted.clear();
+
+	columns = image->width();
+	rows = image->height();
+	stride = image->channels();
+	data = image->raster().data();
+	scale = world_scale;
+	spacing = glm::vec2(scale.x / float(columns), scale.z / float(rows));
+}
+
+void HeightQuery::bind(const Image<uint8_t> *image, const glm::vec3 &world_scale)
+{
+	columns = image->width();
+	rows = image->height();
+	stride = 1;
+	converted.resize(size_t(columns) * rows);
+	for (int y = 0; y < rows; y++) {
+		for (int x = 0; x < columns; x++) {
+			converted[size_t(y) * columns + x] = image->sample(x, y, CHANNEL_RED) / 255.f;
+		}
+	}
+	data = converted.data();
+	scale = world_scale;
+	spacing = glm::vec2(scale.x / float(columns), scale.z / float(rows));
+}
+
+void HeightQuery::unbind()
+{
+	data = nullptr;
+	converted.clear();
+	columns = 0;
+	rows = 0;
+}
+
+float HeightQuery::height(float x, float z) const
+{
+	float u = glm::clamp(x / spacing.x - 0.5f, 0.f, float(columns-1));
+	float v = glm::clamp(z / spacing.y - 0.5f, 0.f, float(rows-1));
+
+	int x0 = int(u);
+	int y0 = int(v);
+	float fx = u - x0;
+	float fy = v - y0;
+
+	float h00 = texel(x0, y0);
+	float h10 = texel(x0+1, y0);
+	float h01 = texel(x0, y0+1);
+	float h11 = texel(x0+1, y0+1);
+
+	float top = h00 + fx * (h10 - h00);
+	float bottom = h01 + fx * (h11 - h01);
+
+	return scale.y * (top + fy * (bottom - top));
+}
+
+// Catmull-Rom through the 4x4 texels around the position
+float HeightQuery::height_bicubic(float x, float z) const
+{
+	float u = glm::clamp(x / spacing.x - 0.5f, 0.f, float(columns-1));
+	float v = glm::clamp(z / spacing.y - 0.5f, 0.f, float(rows-1));
+
+	int x0 = int(u);
+	int y0 = int(v);
+	float fx = u - x0;
+	float fy = v - y0;
+
+	float rows[4];
+	for (int i = 0; i < 4; i++) {
+		int y = y0 - 1 + i;
+		rows[i] = cubic(texel(x0-1, y), texel(x0, y), texel(x0+1, y), texel(x0+2, y), fx);
+	}
+
+	return scale.y * cubic(rows[0], rows[1], rows[2], rows[3], fy);
+}
+
+glm::vec3 HeightQuery::normal(float x, float z) const
+{
+	glm::vec3 result;
+	height(x, z, result);
+
+	return result;
+}
+
+// the normal follows the slope of the bilinear patch so it matches the surface the rays hit
+float HeightQuery::height(float x, float z, glm::vec3 &normal) const
+{
+	float u = glm::clamp(x / spacing.x - 0.5f, 0.f, float(columns-1));
+	float v = glm::clamp(z / spacing.y - 0.5f, 0.f, float(rows-1));
+
+	int x0 = int(u);
+	int y0 = int(v);
+	float fx = u - x0;
+	float fy = v - y0;
+
+	float h00 = texel(x0, y0);
+	float h10 = texel(x0+1, y0);
+	float h01 = texel(x0, y0+1);
+	float h11 = texel(x0+1, y0+1);
+
+	float top = h00 + fx * (h10 - h00);
+	float bottom = h01 + fx * (h11 - h01);
+
+	float dx = scale.y * ((h10 - h00) + fy * ((h11 - h01) - (h10 - h00))) / spacing.x;
+	float dz = scale.y * (bottom - top) / spacing.y;
+	normal = glm::normalize(glm::vec3(-dx, 1.f, -dz));
+
+	return scale.y * (top + fy * (bottom - top));
+}
+
+void HeightQuery::heights(const glm::vec2 *points, float *results, size_t count) const
+{
+	const float max_u = float(columns-1);
+	const float max_v = float(rows-1);
+	const float inverse_x = 1.f / spacing.x;
+	const float inverse_z = 1.f / spacing.y;
+
+	#pragma omp simd
+	for (size_t i = 0; i < count; i++) {
+		float u = std::min(std::max(points[i].x * inverse_x - 0.5f, 0.f), max_u);
+		float v = std::min(std::max(points[i].y * inverse_z - 0.5f, 0.f), max_v);
+		int x0 = int(u);
+		int y0 = int(v);
+		int x1 = std::min(x0 + 1, columns-1);
+		int y1 = std::min(y0 + 1, rows-1);
+		float fx = u - x0;
+		float fy = v - y0;
+		float h00 = data[(size_t(y0) * columns + x0) * stride];
+		float h10 = data[(size_t(y0) * columns + x1) * stride];
+		float h01 = data[(size_t(y1) * columns + x0) * stride];
+		float h11 = data[(size_t(y1) * columns + x1) * stride];
+		float top = h00 + fx * (h10 - h00);
+		float bottom = h01 + fx * (h11 - h01);
+		results[i] = scale.y * (top + fy * (bottom - top));
+	}
+}
+
+// walks the texel cells under the ray and solves the exact intersection with the bilinear patch of each cell
+bool HeightQuery::intersect(const glm::vec3 &origin, const glm::vec3 &direction, float max_distance, float &distance) const
+{
+	if (!data || columns < 2 || rows < 2) { return false; }
+
+	// texel space, x and z in texels and y in normalized height, the ray parameter stays the same
+	const glm::vec3 o = { origin.x / spacing.x - 0.5f, origin.y / scale.y, origin.z / spacing.y - 0.5f };
+	const glm::vec3 d = { direction.x / spacing.x, direction.y / scale.y, direction.z / spacing.y };
+
+	// clip the ray to the area of the heightmap
+	float t0 = 0.f;
+	float t1 = max_distance;
+	const float bounds_min[2] = { 0.f, 0.f };
+	const float bounds_max[2] = { float(columns-1), float(rows-1) };
+	const float starts[2] = { o.x, o.z };
+	const float steps[2] = { d.x, d.z };
+	for (int axis = 0; axis < 2; axis++) {
+		if (fabsf(steps[axis]) < 1e-12f) {
+			if (starts[axis] < bounds_min[axis] || starts[axis] > bounds_max[axis]) { return false; }
+			continue;
+		}
+		float near = (bounds_min[axis] - starts[axis]) / steps[axis];
+		float far = (bounds_max[axis] - starts[axis]) / steps[axis];
+		if (near > far) { std::swap(near, far); }
+		t0 = std::max(t0, near);
+		t1 = std::min(t1, far);
+	}
+	if (t0 > t1) { return false; }
+
+	// grid traversal of Amanatides and Woo
+	glm::vec3 start = o + t0 * d;
+	int x = glm::clamp(int(floorf(start.x)), 0, columns-2);
+	int z = glm::clamp(int(floorf(start.z)), 0, rows-2);
+	const int step_x = d.x > 0.f ? 1 : -1;
+	const int step_z = d.z > 0.f ? 1 : -1;
+	const float infinity = std::numeric_limits<float>::max();
+	const float delta_x = fabsf(d.x) > 1e-12f ? fabsf(1.f / d.x) : infinity;
+	const float delta_z = fabsf(d.z) > 1e-12f ? fabsf(1.f / d.z) : infinity;
+	float next_x = fabsf(d.x) > 1e-12f ? (float(x + (step_x > 0 ? 1 : 0)) - o.x) / d.x : infinity;
+	float next_z = fabsf(d.z) > 1e-12f ? (float(z + (step_z > 0 ? 1 : 0)) - o.z) / d.z : infinity;
+
+	float enter = t0;
+	while (enter <= t1) {
+		float exit = std::min(std::min(next_x, next_z), t1);
+		float t;
+		if (intersect_cell(x, z, o, d, enter, exit, t)) {
+			distance = t;
+			return true;
+		}
+		if (exit >= t1) { break; }
+		if (next_x < next_z) {
+			x += step_x;
+			next_x += delta_x;
+		} else {
+			z += step_z;
+			next_z += delta_z;
+		}
+		if (x < 0 || z < 0 || x > columns-2 || z > rows-2) { break; }
+		enter = exit;
+	}
+
+	return false;
+}
+
+// along the ray the bilinear height minus the ray height is a quadratic in t
+bool HeightQuery::intersect_cell(int x, int y, const glm::vec3 &o, const glm::vec3 &d, float t0, float t1, float &t) const
+{
+	const float h00 = texel(x, y);
+	const float h10 = texel(x+1, y);
+	const float h01 = texel(x, y+1);
+	const float h11 = texel(x+1, y+1);
+
+	const float b = h10 - h00;
+	const float c = h01 - h00;
+	const float e = h00 - h10 - h01 + h11;
+
+	// local coordinates in the cell at t0
+	const float s0 = o.x + t0 * d.x - float(x);
+	const float r0 = o.z + t0 * d.z - float(y);
+	const float y0 = o.y + t0 * d.y;
+
+	const float C = h00 + b * s0 + c * r0 + e * s0 * r0 - y0;
+	// the ray starts under the surface
+	if (C >= 0.f) {
+		t = t0;
+		return true;
+	}
+	const float B = b * d.x + c * d.z + e * (s0 * d.z + r0 * d.x) - d.y;
+	const float A = e * d.x * d.z;
+	const float length = t1 - t0;
+
+	float root = -1.f;
+	if (fabsf(A) < 1e-12f) {
+		if (fabsf(B) > 1e-12f) {
+			root = -C / B;
+		}
+	} else {
+		float discriminant = B * B - 4.f * A * C;
+		if (discriminant >= 0.f) {
+			float sq = sqrtf(discriminant);
+			float q = B < 0.f ? -0.5f * (B - sq) : -0.5f * (B + sq);
+			float first = q / A;
+			float second = fabsf(q) > 1e-12f ? C / q : first;
+			if (first > second) { std::swap(first, second); }
+			root = first >= 0.f ? first : second;
+		}
+	}
+
+	if (root >= 0.f && root <= length) {
+		t = t0 + root;
+		return true;
+	}
+
+	return false;
+}
+
+static inline float cubic(float p0, float p1, float p2, float p3, float t)
+{
+	return p1 + 0.5f * t * (p2 - p0 + t * (2.f * p0 - 5.f * p1 + 4.f * p2 - p3 + t * (3.f * (p1 - p2) + p3 - p0)));
+}
+
+};
@@ -0,0 +1,46 @@
+namespace util {
+
+// analytic queries on a heightmap image without a physics world
+// the texels are placed like the physics heightfield, texel centers at (i + 0.5) * spacing
+// and the height is the normalized texel value times the vertical scale
+class HeightQuery {
+public:
+	// float images are read in place so they have to outlive the query and not be resized
+	void bind(const Image<float> *image, const glm::vec3 &scale);
+	// byte images are converted to normalized floats once
+	void bind(const Image<uint8_t> *image, const glm::vec3 &scale);
+	void unbind();
+	bool bound() const { return data != nullptr; }
+	glm::vec3 get_scale() const { return scale; }
+	int get_width() const { return columns; }
+	int get_height() const { return rows; }
+public:
+	// positions outside the heightmap get the height of the nearest edge
+	float height(float x, float z) const;
+	float height(float x, float z, glm::vec3 &normal) const;
+	float height_bicubic(float x, float z) const;
+	glm::vec3 normal(float x, float z) const;
+	// many lookups at once, written so the compiler can vectorize it
+	void heights(const glm::vec2 *points, float *results, size_t count) const;
+	// first intersection of a ray with the bilinear surface, the distance is in units of the direction
+	bool intersect(const glm::vec3 &origin, const glm::vec3 &direction, float max_distance, float &distance) const;
+	// normalized texel value, x and y are clamped
+	float texel(int x, int y) const
+	{
+		x = x < 0 ? 0 : (x >= columns ? columns-1 : x);
+		y = y < 0 ? 0 : (y >= rows ? rows-1 : y);
+		return data[(size_t(y) * columns + x) * stride];
+	}
+	// the surface in the texel cell with corner (x, y) between t0 and t1 of a ray in texel space
+	bool intersect_cell(int x, int y, const glm::vec3 &origin, const glm::vec3 &direction, float t0, float t1, float &t) const;
+private:
+	const float *data = nullptr;
+	size_t stride = 1; // channels of the image
+	int columns = 0;
+	int rows = 0;
+	glm::vec3 scale = {};
+	glm::vec2 spacing = {};
+	std::vector<float> converted; // only for byte images
+};
+
+};
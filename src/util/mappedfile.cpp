@@ -0,0 +1,161 @@
+#include <string>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "../extern/aixlog/aixlog.h"
+
+#include "mappedfile.h"
+
+namespace util {
+
+static size_t page_size();
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+#ifdef _WIN32
+bool MappedFile::open(const std::string &filepath)
+{
+	close();
+
+	HANDLE file = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+		CloseHandle(file);
+		return false;
+	}
+
+	// copy on write so callers can patch the data in memory
+	HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	CloseHandle(file);
+	if (!mapping) {
+		LOG(ERROR, "Mapped File") << "could not map " + filepath;
+		return false;
+	}
+
+	// the view stays valid after closing the mapping handle
+	void *address = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!address) {
+		LOG(ERROR, "Mapped File") << "could not map " + filepath;
+		return false;
+	}
+
+	bytes = static_cast<uint8_t*>(address);
+	length = size.QuadPart;
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (bytes) {
+		UnmapViewOfFile(bytes);
+	}
+	bytes = nullptr;
+	length = 0;
+}
+#else
+bool MappedFile::open(const std::string &filepath)
+{
+	close();
+
+	int fd = ::open(filepath.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat info;
+	if (fstat(fd, &info) != 0 || info.st_size == 0) {
+		::close(fd);
+		return false;
+	}
+
+	// private mapping so callers can patch the data in memory
+	void *address = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	// the mapping stays valid after closing the descriptor
+	::close(fd);
+	if (address == MAP_FAILED) {
+		LOG(ERROR, "Mapped File") << "could not map " + filepath;
+		return false;
+	}
+
+	bytes = static_cast<uint8_t*>(address);
+	length = info.st_size;
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (bytes) {
+		munmap(bytes, length);
+	}
+	bytes = nullptr;
+	length = 0;
+}
+#endif
+
+void MappedFile::prefetch(size_t offset, size_t count) const
+{
+	const size_t page = page_size();
+	// grow the range to whole pages
+	size_t begin = (offset / page) * page;
+	size_t end = offset + count < length ? offset + count : length;
+	if (bytes && end > begin) {
+#ifdef _WIN32
+		// only a hint, touching one byte per page does the same without needing Windows 8
+		volatile uint8_t sum = 0;
+		for (size_t i = begin; i < end; i += page) {
+			sum += bytes[i];
+		}
+#else
+		madvise(bytes + begin, end - begin, MADV_WILLNEED);
+#endif
+	}
+}
+
+void MappedFile::release(size_t offset, size_t count) const
+{
+	const size_t page = page_size();
+	// shrink the range to whole pages so neighbouring data is left alone
+	size_t begin = ((offset + page - 1) / page) * page;
+	size_t end = offset + count < length ? ((offset + count) / page) * page : length;
+	if (bytes && end > begin) {
+#ifdef _WIN32
+		// unlocking pages that aren't locked takes them out of the working set
+		// written pages keep their contents, Detour rewrites the links when a tile is added again
+		VirtualUnlock(bytes + begin, end - begin);
+#else
+		// private pages that were written to go back to the contents of the file
+		madvise(bytes + begin, end - begin, MADV_DONTNEED);
+#endif
+	}
+}
+
+static size_t page_size()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwPageSize;
+#else
+	return sysconf(_SC_PAGESIZE);
+#endif
+}
+
+};
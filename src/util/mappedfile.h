@@ -0,0 +1,25 @@
+namespace util {
+
+// file mapped into memory, the OS pages it in on first access
+// written pages are private copies so the file on disk never changes
+class MappedFile {
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile();
+public:
+	bool open(const std::string &filepath);
+	void close();
+	bool is_open() const { return bytes != nullptr; }
+	uint8_t* data() const { return bytes; }
+	size_t size() const { return length; }
+	// hints to the OS to load or drop a range of pages
+	void prefetch(size_t offset, size_t count) const;
+	void release(size_t offset, size_t count) const;
+private:
+	uint8_t *bytes = nullptr;
+	size_t length = 0;
+};
+
+};
@@ -0,0 +1,135 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstdio>
+
+#include "../extern/aixlog/aixlog.h"
+
+#include "../extern/recast/DetourNavMesh.h"
+
+#include "hash.h"
+#include "filesystem.h"
+#include "navcache.h"
+
+namespace util {
+
+static const uint32_t TILE_MAGIC = 'N'<<24 | 'T'<<16 | 'C'<<8 | 'H';
+static const uint32_t TILE_VERSION = 1;
+static const char *TILE_EXTENSION = ".tile";
+
+struct cached_tile_header_t {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t key; // guards against a renamed or swapped file
+	uint64_t checksum; // hash of the tile data
+	uint32_t size;
+	uint32_t padding;
+};
+
+bool NavigationTileCache::init(const std::string &directory, uint64_t max_bytes)
+{
+	root.clear();
+
+	if (!directory_exists(directory)) {
+		LOG(ERROR, "Navigation") << "tile cache directory " + directory + " does not exist";
+		return false;
+	}
+
+	root = directory;
+	if (root.back() != '/' && root.back() != '\\') { root += '/'; }
+	capacity = max_bytes;
+
+	prune();
+
+	return true;
+}
+
+uint8_t* NavigationTileCache::fetch(uint64_t key, int &size) const
+{
+	if (root.empty()) { return nullptr; }
+
+	const std::string path = tile_path(key);
+	std::ifstream stream(path, std::ios::binary);
+	if (!stream.is_open()) { return nullptr; }
+
+	stream.seekg(0, std::ios::end);
+	const uint64_t length = stream.tellg();
+	stream.seekg(0, std::ios::beg);
+
+	cached_tile_header_t header;
+	stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+	// the size is checked against the file before anything is allocated for it
+	if (!stream || header.magic != TILE_MAGIC || header.version != TILE_VERSION || header.key != key || header.size == 0 || header.size != length - sizeof(header)) {
+		LOG(ERROR, "Navigation") << "removing invalid cached tile " + path;
+		stream.close();
+		std::remove(path.c_str());
+		return nullptr;
+	}
+
+	uint8_t *data = static_cast<uint8_t*>(dtAlloc(header.size, DT_ALLOC_PERM));
+	if (!data) { return nullptr; }
+
+	stream.read(reinterpret_cast<char*>(data), header.size);
+	fnv_hash_t checksum;
+	checksum.add(data, header.size);
+	if (!stream || checksum.value != header.checksum) {
+		LOG(ERROR, "Navigation") << "removing corrupt cached tile " + path;
+		dtFree(data);
+		stream.close();
+		std::remove(path.c_str());
+		return nullptr;
+	}
+
+	// a hit counts as a use for the least recently used order
+	touch_file(path);
+
+	size = header.size;
+
+	return data;
+}
+
+void NavigationTileCache::store(uint64_t key, const uint8_t *data, int size) const
+{
+	if (root.empty() || !data || size <= 0) { return; }
+
+	cached_tile_header_t header;
+	header.magic = TILE_MAGIC;
+	header.version = TILE_VERSION;
+	header.key = key;
+	fnv_hash_t checksum;
+	checksum.add(data, size);
+	header.checksum = checksum.value;
+	header.size = size;
+	header.padding = 0;
+
+	// tiles are built on several threads, write to a temporary file so a reader never sees half a tile
+	const std::string path = tile_path(key);
+	const std::string temporary = path + ".tmp";
+	std::ofstream stream(temporary, std::ios::binary);
+	if (!stream.is_open()) { return; }
+
+	stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	stream.write(reinterpret_cast<const char*>(data), size);
+	stream.close();
+
+	if (stream.fail() || std::rename(temporary.c_str(), path.c_str()) != 0) {
+		std::remove(temporary.c_str());
+	}
+}
+
+void NavigationTileCache::prune() const
+{
+	if (root.empty()) { return; }
+
+	prune_files(root, TILE_EXTENSION, capacity);
+}
+
+std::string NavigationTileCache::tile_path(uint64_t key) const
+{
+	char name[17];
+	snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+
+	return root + name + TILE_EXTENSION;
+}
+
+};
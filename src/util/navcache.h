@@ -0,0 +1,21 @@
+namespace util {
+
+// on disk store of built navmesh tiles, named by the hash of everything that went into the tile
+// the same input always builds the same tile so a hit can skip Recast completely
+class NavigationTileCache {
+public:
+	bool init(const std::string &directory, uint64_t max_bytes);
+	bool enabled() const { return !root.empty(); }
+	// returns tile data allocated with dtAlloc so the navmesh can own it, or nullptr on a miss
+	uint8_t* fetch(uint64_t key, int &size) const;
+	void store(uint64_t key, const uint8_t *data, int size) const;
+	// removes the least recently used tiles until the cache fits in its size limit
+	void prune() const;
+private:
+	std::string root;
+	uint64_t capacity = 0;
+private:
+	std::string tile_path(uint64_t key) const;
+};
+
+};
@@ -8,6 +8,10 @@
 #include <cstring>
 #include <thread>
 #include <mutex>
+#include <limits>
+#include <algorithm>
+#include <string>
+#include <fstream>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 #include <glm/gtx/quaternion.hpp>
@@ -21,6 +25,12 @@
 #include "../extern/recast/DetourNavMeshQuery.h"
 #include "../extern/recast/ChunkyTriMesh.h"
 
+#include "../geometry/geom.h"
+#include "image.h"
+#include "hash.h"
+#include "filesystem.h"
+#include "mappedfile.h"
+#include "navcache.h"
 #include "navigation.h"
 
 #define MAX_PATHPOLY 256 // max number of polygons in a path
@@ -44,7 +54,7 @@ public:
 		rcFreePolyMeshDetail(dmesh);
 		delete context;
 	}
-	uint8_t *alloc_navdata(const int tx, const int ty, float *bmin, float *bmax, int &data_size, const float *verts, const int nverts, const rcChunkyTriMesh *chunky_mesh, const rcConfig *cfg);
+	uint8_t *alloc_navdata(const int tx, const int ty, float *bmin, float *bmax, int &data_size, const float *verts, const int nverts, const rcChunkyTriMesh *chunky_mesh, const navigation_heightmap_t *terrain, const std::vector<navigation_obstacle_t> *obstacles, const NavigationTileCache *cache, const rcConfig *cfg);
 private:
 	uint8_t *triareas = 0;
 	rcContext *context = nullptr;
@@ -72,10 +82,44 @@ static const float DETAIL_SAMPLE_DIST = 6.f;
 static const float DETAIL_SAMPLE_MAX_ERROR = 1.f;
 static const int TILE_SIZE = 128;
 
+static const uint32_t BLOB_MAGIC = 'N'<<24 | 'A'<<16 | 'V'<<8 | 'B';
+static const uint32_t BLOB_VERSION = 1;
+static const uint64_t BLOB_ALIGNMENT = 16; // tile data is read in place by Detour so it needs to be aligned
+
 std::mutex global_mutex;
 
-static void add_tile_mesh_rows(const int y, const int tw, const float tcs, const float *bmin, const float *bmax, const float *verts, const int nverts, const rcChunkyTriMesh *chunky_mesh, const rcConfig *cfg, dtNavMesh *navmesh);
+struct navigation_blob_header_t {
+	uint32_t magic;
+	uint32_t version;
+	float origin[3];
+	float tilewidth;
+	float tileheight;
+	int32_t maxtiles;
+	int32_t maxpolys;
+	uint32_t tile_count;
+};
+
+// where the data of a tile written to a blob comes from
+struct blob_source_t {
+	int32_t x;
+	int32_t y;
+	const uint8_t *data;
+	uint32_t size;
+};
+
+static void add_tile_mesh_rows(const int y, const int tw, const float tcs, const float *bmin, const float *bmax, const float *verts, const int nverts, const rcChunkyTriMesh *chunky_mesh, const navigation_heightmap_t *terrain, const std::vector<navigation_obstacle_t> *obstacles, const NavigationTileCache *cache, const rcConfig *cfg, dtNavMesh *navmesh);
 static uint8_t* build_tile_mesh(const int tx, const int ty, float *bmin, float *bmax, int &data_size, const float *verts, const int nverts, const rcChunkyTriMesh *chunky_mesh, const rcConfig *cfg);
+static bool rasterize_heightmap(rcContext *context, rcHeightfield &solid, const navigation_heightmap_t *terrain, const rcConfig *cfg);
+static void mark_obstacles(rcContext *context, rcCompactHeightfield &chf, const std::vector<navigation_obstacle_t> *obstacles, const float *bmin, const float *bmax);
+static void obstacle_bounds(const navigation_obstacle_t &obstacle, float *bmin, float *bmax);
+static void heightmap_bounds(const navigation_heightmap_t *terrain, float *bmin, float *bmax);
+static uint64_t tile_input_hash(const int tx, const int ty, const float *bmin, const float *bmax, const float *verts, const rcChunkyTriMesh *chunky_mesh, const int *cid, const int ncid, const navigation_heightmap_t *terrain, const std::vector<navigation_obstacle_t> *obstacles, const rcConfig *cfg);
+static float sample_heightmap(const navigation_heightmap_t *terrain, float x, float z);
+
+static inline uint64_t align_blob(uint64_t offset)
+{
+	return (offset + BLOB_ALIGNMENT - 1) & ~(BLOB_ALIGNMENT - 1);
+}
 
 static inline uint32_t nextpow2(uint32_t v)
 {
@@ -139,6 +183,9 @@ void Navigation::cleanup()
 {
 	verts.clear();
 	tris.clear();
+	terrain = navigation_heightmap_t();
+	obstacles.clear();
+	dirty_tiles.clear();
 }
 
 bool Navigation::alloc(const glm::vec3 &origin, float tilewidth, float tileheight, int maxtiles, int maxpolys)
@@ -170,21 +217,47 @@ bool Navigation::alloc(const glm::vec3 &origin, float tilewidth, float tileheigh
 	return true;
 }
 
-bool Navigation::build(const std::vector<float> &vertices, const std::vector<int> &indices)
+bool Navigation::build(const std::vector<float> &vertices, const std::vector<int> &indices, const navigation_heightmap_t *heightmap)
 {
 	navquery = std::make_unique<dtNavMeshQuery>();
 	chunky_mesh = std::make_unique<rcChunkyTriMesh>();
 
 	// populate verts and tris:
-	verts.insert(verts.begin(), vertices.begin(), vertices.end());
-	tris.insert(tris.begin(), indices.begin(), indices.end());
+	// they are kept after the build so tiles can be rebuilt around obstacles
+	verts.assign(vertices.begin(), vertices.end());
+	tris.assign(indices.begin(), indices.end());
+	dirty_tiles.clear();
 
-	rcCreateChunkyTriMesh(verts.data(), tris.data(), tris.size()/3, 256, chunky_mesh.get());
+	terrain = navigation_heightmap_t();
+	if (heightmap && heightmap->image) {
+		terrain = *heightmap;
+	}
+
+	if (tris.size() < 3 && terrain.image == nullptr) {
+		LOG(ERROR, "Navigation") << "Build tiled navigation: no input geometry";
+		return false;
+	}
+
+	float bmin[3] = { 
+		std::numeric_limits<float>::max(), 
+		std::numeric_limits<float>::max(), 
+		std::numeric_limits<float>::max() 
+	};
+	float bmax[3] = { 
+		-std::numeric_limits<float>::max(), 
+		-std::numeric_limits<float>::max(), 
+		-std::numeric_limits<float>::max() 
+	};
+	if (tris.size() >= 3) {
+		rcCreateChunkyTriMesh(verts.data(), tris.data(), tris.size()/3, 256, chunky_mesh.get());
+		rcCalcBounds(verts.data(), vertices.size()/3, bmin, bmax);
+	}
+	// the heightmap is not part of the triangle soup so include it in the bounds separately
+	if (terrain.image) {
+		heightmap_bounds(&terrain, bmin, bmax);
+	}
 
 	int gw = 0, gh = 0;
-	float bmin[3];
-	float bmax[3];
-	rcCalcBounds(verts.data(), vertices.size()/3, bmin, bmax);
 	rcCalcGridSize(bmin, bmax, cfg.cs, &gw, &gh);
 	BOUNDS_MIN[0] = bmin[0];
 	BOUNDS_MIN[1] = bmin[1];
@@ -205,6 +278,8 @@ bool Navigation::build(const std::vector<float> &vertices, const std::vector<int
 	max_polys_per_tile = 1 << poly_bits;
 
 	navmesh = std::make_unique<dtNavMesh>();
+	// the old navmesh is gone so its tiles in the blob are no longer used
+	close_blob();
 
 	dtNavMeshParams params;
 	rcVcopy(params.orig, bmin);
@@ -227,8 +302,9 @@ bool Navigation::build(const std::vector<float> &vertices, const std::vector<int
 
 	build_all_tiles();
 
-	verts.clear();
-	tris.clear();
+	if (tile_cache) {
+		tile_cache->prune();
+	}
 
 	return true;
 }
@@ -245,6 +321,209 @@ void Navigation::load_tilemesh(int x, int y, const std::vector<uint8_t> &data)
 	if (dtStatusFailed(status)) { dtFree(cpy); }
 }
 	
+bool Navigation::save_blob(const std::string &filepath)
+{
+	const dtNavMesh *mesh = navmesh.get();
+	if (!mesh) { return false; }
+
+	std::vector<blob_source_t> tiles;
+	// tiles of a mapped blob that are streamed out are written straight from the mapping
+	for (uint32_t i = 0; i < blob_tile_count; i++) {
+		const navigation_blob_tile_t &tile = blob_tiles[i];
+		const dtMeshTile *loaded = mesh->getTileAt(tile.x, tile.y, 0);
+		// a tile rebuilt at runtime replaces the one in the blob
+		if (loaded && loaded->data != blob.data() + tile.offset) { continue; }
+		tiles.push_back({ tile.x, tile.y, blob.data() + tile.offset, tile.size });
+	}
+	// everything else that is loaded was built in memory
+	for (int i = 0; i < mesh->getMaxTiles(); i++) {
+		const dtMeshTile *tile = mesh->getTile(i);
+		if (tile && tile->header && !inside_blob(tile->data)) {
+			tiles.push_back({ tile->header->x, tile->header->y, tile->data, uint32_t(tile->dataSize) });
+		}
+	}
+
+	const dtNavMeshParams *navparams = mesh->getParams();
+	navigation_blob_header_t header;
+	header.magic = BLOB_MAGIC;
+	header.version = BLOB_VERSION;
+	rcVcopy(header.origin, navparams->orig);
+	header.tilewidth = navparams->tileWidth;
+	header.tileheight = navparams->tileHeight;
+	header.maxtiles = navparams->maxTiles;
+	header.maxpolys = navparams->maxPolys;
+	header.tile_count = tiles.size();
+
+	std::vector<navigation_blob_tile_t> table(tiles.size());
+	uint64_t offset = align_blob(sizeof(navigation_blob_header_t) + table.size() * sizeof(navigation_blob_tile_t));
+	for (int i = 0; i < tiles.size(); i++) {
+		table[i].x = tiles[i].x;
+		table[i].y = tiles[i].y;
+		table[i].size = tiles[i].size;
+		table[i].offset = offset;
+		offset = align_blob(offset + tiles[i].size);
+	}
+
+	// write next to the old blob first, it could still be mapped by a navmesh
+	const std::string temporary = filepath + ".tmp";
+	std::ofstream stream(temporary, std::ios::binary);
+	if (!stream.is_open()) {
+		LOG(ERROR, "Navigation") << "navmesh blob " + filepath + " could not be saved";
+		return false;
+	}
+
+	stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	stream.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(navigation_blob_tile_t));
+	const char padding[BLOB_ALIGNMENT] = {};
+	for (int i = 0; i < tiles.size(); i++) {
+		stream.write(padding, table[i].offset - uint64_t(stream.tellp()));
+		stream.write(reinterpret_cast<const char*>(tiles[i].data), tiles[i].size);
+	}
+	stream.close();
+
+	if (stream.fail()) {
+		LOG(ERROR, "Navigation") << "navmesh blob " + filepath + " could not be saved";
+		std::remove(temporary.c_str());
+		return false;
+	}
+
+	// Windows can't replace a file that is still mapped so the navmesh lets go of the old blob first
+	const bool remap = blob.data() && blob_path == filepath;
+	std::vector<std::pair<int, int>> loaded;
+	if (remap) {
+		for (int i = 0; i < mesh->getMaxTiles(); i++) {
+			const dtMeshTile *tile = mesh->getTile(i);
+			if (tile && tile->header) {
+				loaded.push_back(std::make_pair(tile->header->x, tile->header->y));
+			}
+		}
+		navmesh.reset();
+		close_blob();
+	}
+
+	const bool replaced = replace_file(temporary, filepath);
+	if (!replaced) {
+		LOG(ERROR, "Navigation") << "navmesh blob " + filepath + " could not be replaced";
+		std::remove(temporary.c_str());
+	}
+
+	// the same tiles are loaded again, from the old blob if it could not be replaced
+	if (remap) {
+		reload_blob(filepath, loaded);
+	}
+
+	return replaced;
+}
+
+bool Navigation::load_blob(const std::string &filepath, bool resident)
+{
+	// tiles of the previous blob have to be removed before it is unmapped
+	navmesh.reset();
+	close_blob();
+
+	if (!blob.open(filepath)) {
+		LOG(ERROR, "Navigation") << "navmesh blob " + filepath + " could not be loaded";
+		return false;
+	}
+
+	if (blob.size() < sizeof(navigation_blob_header_t)) {
+		LOG(ERROR, "Navigation") << "navmesh blob " + filepath + " is not valid";
+		close_blob();
+		return false;
+	}
+	const navigation_blob_header_t *header = reinterpret_cast<const navigation_blob_header_t*>(blob.data());
+	const uint64_t table_end = sizeof(navigation_blob_header_t) + uint64_t(header->tile_count) * sizeof(navigation_blob_tile_t);
+	if (header->magic != BLOB_MAGIC || header->version != BLOB_VERSION || table_end > blob.size()) {
+		LOG(ERROR, "Navigation") << "navmesh blob " + filepath + " is not valid";
+		close_blob();
+		return false;
+	}
+
+	const navigation_blob_tile_t *table = reinterpret_cast<const navigation_blob_tile_t*>(blob.data() + sizeof(navigation_blob_header_t));
+	for (uint32_t i = 0; i < header->tile_count; i++) {
+		if (table[i].offset % BLOB_ALIGNMENT != 0 || table[i].offset < table_end || table[i].offset + table[i].size > blob.size()) {
+			LOG(ERROR, "Navigation") << "navmesh blob " + filepath + " has a corrupt tile table";
+			close_blob();
+			return false;
+		}
+	}
+
+	if (!alloc(glm::vec3(header->origin[0], header->origin[1], header->origin[2]), header->tilewidth, header->tileheight, header->maxtiles, header->maxpolys)) {
+		close_blob();
+		return false;
+	}
+
+	blob_path = filepath;
+	blob_tiles = table;
+	blob_tile_count = header->tile_count;
+
+	if (resident) {
+		for (uint32_t i = 0; i < blob_tile_count; i++) {
+			const navigation_blob_tile_t &tile = blob_tiles[i];
+			// no DT_TILE_FREE_DATA, the blob owns the data
+			dtStatus status = navmesh->addTile(blob.data() + tile.offset, tile.size, 0, 0, 0);
+			if (dtStatusFailed(status)) {
+				LOG(ERROR, "Navigation") << "navmesh blob " + filepath + " has an invalid tile";
+			}
+		}
+	}
+
+	return true;
+}
+
+void Navigation::stream_tiles(const glm::vec2 &min, const glm::vec2 &max)
+{
+	if (!navmesh || !blob_tiles) { return; }
+
+	const dtNavMeshParams *navparams = navmesh->getParams();
+
+	for (uint32_t i = 0; i < blob_tile_count; i++) {
+		const navigation_blob_tile_t &tile = blob_tiles[i];
+		const float tile_min_x = navparams->orig[0] + tile.x * navparams->tileWidth;
+		const float tile_min_z = navparams->orig[2] + tile.y * navparams->tileHeight;
+		const bool inside = tile_min_x <= max.x && tile_min_x + navparams->tileWidth >= min.x && tile_min_z <= max.y && tile_min_z + navparams->tileHeight >= min.y;
+
+		const dtMeshTile *loaded = navmesh->getTileAt(tile.x, tile.y, 0);
+		// a tile rebuilt at runtime is not part of the blob
+		const bool from_blob = loaded && loaded->data == blob.data() + tile.offset;
+
+		if (inside && !loaded) {
+			blob.prefetch(tile.offset, tile.size);
+			navmesh->addTile(blob.data() + tile.offset, tile.size, 0, 0, 0);
+		} else if (!inside && from_blob) {
+			navmesh->removeTile(navmesh->getTileRefAt(tile.x, tile.y, 0), 0, 0);
+			// drops the links Detour wrote into the tile, they are made again when it is added
+			blob.release(tile.offset, tile.size);
+		}
+	}
+}
+
+void Navigation::reload_blob(const std::string &filepath, std::vector<std::pair<int, int>> &loaded)
+{
+	if (!load_blob(filepath, false)) { return; }
+
+	std::sort(loaded.begin(), loaded.end());
+	for (uint32_t i = 0; i < blob_tile_count; i++) {
+		const navigation_blob_tile_t &tile = blob_tiles[i];
+		if (std::binary_search(loaded.begin(), loaded.end(), std::make_pair(int(tile.x), int(tile.y)))) {
+			navmesh->addTile(blob.data() + tile.offset, tile.size, 0, 0, 0);
+		}
+	}
+}
+
+bool Navigation::inside_blob(const uint8_t *data) const
+{
+	return blob.data() && data >= blob.data() && data < blob.data() + blob.size();
+}
+
+void Navigation::close_blob()
+{
+	blob.close();
+	blob_path.clear();
+	blob_tiles = nullptr;
+	blob_tile_count = 0;
+}
+	
 void Navigation::build_all_tiles()
 {
 	const float *bmin = BOUNDS_MIN;
@@ -260,7 +539,7 @@ void Navigation::build_all_tiles()
 	
 	// Start the build process.
 	for (int y = 0; y < th; ++y) {
-		threads.push_back(std::thread(add_tile_mesh_rows, y, tw, tcs, bmin, bmax, verts.data(), verts.size(), chunky_mesh.get(), &cfg, navmesh.get()));
+		threads.push_back(std::thread(add_tile_mesh_rows, y, tw, tcs, bmin, bmax, verts.data(), verts.size(), chunky_mesh.get(), &terrain, &obstacles, tile_cache, &cfg, navmesh.get()));
 	}
 
 	for (std::thread &th : threads) {
@@ -286,6 +565,134 @@ void Navigation::remove_all_tiles()
 	}
 }
 
+uint32_t Navigation::add_cylinder_obstacle(const glm::vec3 &position, float radius, float height)
+{
+	navigation_obstacle_t obstacle;
+	obstacle.shape = navigation_obstacle_shape::CYLINDER;
+	obstacle.position = position;
+	obstacle.extents = { radius, height, radius };
+
+	return add_obstacle(obstacle);
+}
+
+uint32_t Navigation::add_box_obstacle(const glm::vec3 &min, const glm::vec3 &max)
+{
+	navigation_obstacle_t obstacle;
+	obstacle.shape = navigation_obstacle_shape::BOX;
+	obstacle.position = 0.5f * (min + max);
+	obstacle.extents = 0.5f * (max - min);
+
+	return add_obstacle(obstacle);
+}
+
+uint32_t Navigation::add_oriented_box_obstacle(const glm::vec3 &center, const glm::vec3 &half_extents, float angle)
+{
+	navigation_obstacle_t obstacle;
+	obstacle.shape = navigation_obstacle_shape::ORIENTED_BOX;
+	obstacle.position = center;
+	obstacle.extents = half_extents;
+	obstacle.angle = angle;
+
+	return add_obstacle(obstacle);
+}
+
+bool Navigation::remove_obstacle(uint32_t id)
+{
+	auto it = std::find_if(obstacles.begin(), obstacles.end(), [id](const navigation_obstacle_t &obstacle) { return obstacle.id == id; });
+	if (it == obstacles.end()) {
+		return false;
+	}
+
+	// tiles have to be rebuilt without the obstacle
+	mark_dirty_tiles(*it);
+	obstacles.erase(it);
+
+	return true;
+}
+
+bool Navigation::update(uint32_t max_tiles)
+{
+	const size_t count = std::min(size_t(max_tiles), dirty_tiles.size());
+	for (size_t i = 0; i < count; i++) {
+		rebuild_tile(dirty_tiles[i].first, dirty_tiles[i].second);
+	}
+	// rebuilt tiles are dropped in one go instead of shifting the queue for every tile
+	dirty_tiles.erase(dirty_tiles.begin(), dirty_tiles.begin() + count);
+
+	return dirty_tiles.empty();
+}
+
+uint32_t Navigation::add_obstacle(const navigation_obstacle_t &obstacle)
+{
+	if (!navmesh || (verts.empty() && terrain.image == nullptr)) {
+		LOG(ERROR, "Navigation") << "Add obstacle: no input geometry to rebuild tiles from";
+		return 0;
+	}
+
+	obstacles.push_back(obstacle);
+	obstacles.back().id = ++obstacle_counter;
+
+	mark_dirty_tiles(obstacles.back());
+
+	return obstacles.back().id;
+}
+
+void Navigation::mark_dirty_tiles(const navigation_obstacle_t &obstacle)
+{
+	float bmin[3], bmax[3];
+	obstacle_bounds(obstacle, bmin, bmax);
+
+	int gw = 0, gh = 0;
+	rcCalcGridSize(BOUNDS_MIN, BOUNDS_MAX, cfg.cs, &gw, &gh);
+	const int ts = TILE_SIZE;
+	const int tw = (gw + ts-1) / ts;
+	const int th = (gh + ts-1) / ts;
+	const float tcs = TILE_SIZE * cfg.cs;
+	// tiles also read the geometry in their border
+	const float border = cfg.borderSize * cfg.cs;
+
+	const int min_x = rcClamp(int(floorf((bmin[0] - border - BOUNDS_MIN[0]) / tcs)), 0, tw-1);
+	const int min_y = rcClamp(int(floorf((bmin[2] - border - BOUNDS_MIN[2]) / tcs)), 0, th-1);
+	const int max_x = rcClamp(int(floorf((bmax[0] + border - BOUNDS_MIN[0]) / tcs)), 0, tw-1);
+	const int max_y = rcClamp(int(floorf((bmax[2] + border - BOUNDS_MIN[2]) / tcs)), 0, th-1);
+
+	for (int y = min_y; y <= max_y; y++) {
+		for (int x = min_x; x <= max_x; x++) {
+			auto tile = std::make_pair(x, y);
+			if (std::find(dirty_tiles.begin(), dirty_tiles.end(), tile) == dirty_tiles.end()) {
+				dirty_tiles.push_back(tile);
+			}
+		}
+	}
+}
+
+void Navigation::rebuild_tile(int x, int y)
+{
+	const float tcs = TILE_SIZE * cfg.cs;
+
+	float tile_min[3];
+	tile_min[0] = BOUNDS_MIN[0] + x*tcs;
+	tile_min[1] = BOUNDS_MIN[1];
+	tile_min[2] = BOUNDS_MIN[2] + y*tcs;
+		
+	float tile_max[3];
+	tile_max[0] = BOUNDS_MIN[0] + (x+1)*tcs;
+	tile_max[1] = BOUNDS_MAX[1];
+	tile_max[2] = BOUNDS_MIN[2] + (y+1)*tcs;
+
+	int data_size = 0;
+	Navbuilder builder;
+	uint8_t *data = builder.alloc_navdata(x, y, tile_min, tile_max, data_size, verts.data(), verts.size(), chunky_mesh.get(), &terrain, &obstacles, tile_cache, &cfg);
+
+	// the old tile goes away even if the new one is empty, the salt of its poly refs changes
+	// so crowd agents on it find their nearest poly again and replan their paths
+	navmesh->removeTile(navmesh->getTileRefAt(x, y, 0), 0, 0);
+	if (data) {
+		dtStatus status = navmesh->addTile(data, data_size, DT_TILE_FREE_DATA, 0, 0);
+		if (dtStatusFailed(status)) { dtFree(data); }
+	}
+}
+
 void Navigation::find_2D_path(const glm::vec2 &startpos, const glm::vec2 &endpos, std::list<glm::vec2> &pathways) const
 {
 	const glm::vec3 start = { startpos.x, 0.f, startpos.y };
@@ -416,7 +823,7 @@ poly_result_t Navigation::point_on_navmesh(const glm::vec3 &point) const
 	return result;
 }
 
-static void add_tile_mesh_rows(const int y, const int tw, const float tcs, const float *bmin, const float *bmax, const float *verts, const int nverts, const rcChunkyTriMesh *chunky_mesh, const rcConfig *cfg, dtNavMesh *navmesh)
+static void add_tile_mesh_rows(const int y, const int tw, const float tcs, const float *bmin, const float *bmax, const float *verts, const int nverts, const rcChunkyTriMesh *chunky_mesh, const navigation_heightmap_t *terrain, const std::vector<navigation_obstacle_t> *obstacles, const NavigationTileCache *cache, const rcConfig *cfg, dtNavMesh *navmesh)
 {
 	for (int x = 0; x < tw; ++x) {
 		float tile_min[3];
@@ -431,7 +838,7 @@ static void add_tile_mesh_rows(const int y, const int tw, const float tcs, const
 		
 		int data_size = 0;
 		Navbuilder builder;
-		uint8_t *data = builder.alloc_navdata(x, y, tile_min, tile_max, data_size, verts, nverts, chunky_mesh, cfg);
+		uint8_t *data = builder.alloc_navdata(x, y, tile_min, tile_max, data_size, verts, nverts, chunky_mesh, terrain, obstacles, cache, cfg);
 		std::lock_guard<std::mutex> guard(global_mutex);
 		if (data) {
 			// Remove any previous data (navmesh owns and deletes the data).
@@ -443,7 +850,7 @@ static void add_tile_mesh_rows(const int y, const int tw, const float tcs, const
 	}
 }
 
-uint8_t* Navbuilder::alloc_navdata(const int tx, const int ty, float *bmin, float *bmax, int &data_size, const float *verts, const int nverts, const rcChunkyTriMesh *chunky_mesh, const rcConfig *cfg)
+uint8_t* Navbuilder::alloc_navdata(const int tx, const int ty, float *bmin, float *bmax, int &data_size, const float *verts, const int nverts, const rcChunkyTriMesh *chunky_mesh, const navigation_heightmap_t *terrain, const std::vector<navigation_obstacle_t> *obstacles, const NavigationTileCache *cache, const rcConfig *cfg)
 {
 	// Expand the heighfield bounding box by border size to find the extents of geometry we need to build this tile.
 	//
@@ -470,6 +877,32 @@ uint8_t* Navbuilder::alloc_navdata(const int tx, const int ty, float *bmin, floa
 	bmin[2] -= cfg->borderSize*cfg->cs;
 	bmax[0] += cfg->borderSize*cfg->cs;
 	bmax[2] += cfg->borderSize*cfg->cs;
+
+	// buildings and walls are still rasterized as triangles
+	int ncid = 0;
+	int cid[512];
+	if (chunky_mesh->nnodes > 0) {
+		float tbmin[2], tbmax[2];
+		tbmin[0] = bmin[0];
+		tbmin[1] = bmin[2];
+		tbmax[0] = bmax[0];
+		tbmax[1] = bmax[2];
+		ncid = rcGetChunksOverlappingRect(chunky_mesh, tbmin, tbmax, cid, 512);
+	}
+	bool terrain_present = (terrain && terrain->image);
+	if (!ncid && !terrain_present) { 
+		return 0; 
+	}
+
+	// the same input always builds the same tile so try the cache before running Recast
+	uint64_t cache_key = 0;
+	if (cache && cache->enabled()) {
+		cache_key = tile_input_hash(tx, ty, bmin, bmax, verts, chunky_mesh, cid, ncid, terrain, obstacles, cfg);
+		uint8_t *cached = cache->fetch(cache_key, data_size);
+		if (cached) {
+			return cached;
+		}
+	}
 	
 	// Allocate voxel heightfield where we rasterize our input data to.
 	solid = rcAllocHeightfield();
@@ -482,24 +915,19 @@ uint8_t* Navbuilder::alloc_navdata(const int tx, const int ty, float *bmin, floa
 		return 0;
 	}
 	
+	// terrain spans are added directly from the heightmap, no triangles needed
+	if (terrain_present) {
+		if (!rasterize_heightmap(context, *solid, terrain, cfg)) {
+			LOG(ERROR, "Navigation") << "could not rasterize heightmap"; 
+			return 0; 
+		}
+	}
+	
 	// Allocate array that can hold triangle flags.
 	// If you have multiple meshes you need to process, allocate
 	// and array which can hold the max number of triangles you need to process.
-	triareas = new uint8_t[chunky_mesh->maxTrisPerChunk];
-	if (!triareas) {
-		LOG(ERROR, "Navigation") << "buildNavigation: Out of memory 'triareas'";
-		return 0;
-	}
-	
-	float tbmin[2], tbmax[2];
-	tbmin[0] = bmin[0];
-	tbmin[1] = bmin[2];
-	tbmax[0] = bmax[0];
-	tbmax[1] = bmax[2];
-	int cid[512];
-	const int ncid = rcGetChunksOverlappingRect(chunky_mesh, tbmin, tbmax, cid, 512);
-	if (!ncid) { 
-		return 0; 
+	if (ncid) {
+		triareas = new uint8_t[chunky_mesh->maxTrisPerChunk];
 	}
 	
 	int tile_tri_count = 0;
@@ -544,6 +972,11 @@ uint8_t* Navbuilder::alloc_navdata(const int tx, const int ty, float *bmin, floa
 	rcFreeHeightField(solid);
 	solid = 0;
 
+	// carve out the obstacles before eroding so agents keep their radius away from them
+	if (obstacles) {
+		mark_obstacles(context, *chf, obstacles, bmin, bmax);
+	}
+
 	// Erode the walkable area by agent radius.
 	if (!rcErodeWalkableArea(context, cfg->walkableRadius, *chf)) {
 		LOG(ERROR, "Navigation") << "buildNavigation: Could not erode";
@@ -689,7 +1122,248 @@ uint8_t* Navbuilder::alloc_navdata(const int tx, const int ty, float *bmin, floa
 	
 	data_size = navdata_size;
 
+	if (cache && cache->enabled() && navdata) {
+		cache->store(cache_key, navdata, navdata_size);
+	}
+
 	return navdata;
 }
 
+// fills the voxel columns of a tile with spans straight from the heightmap
+// the surface inside a column is bound by the min and max height of its four corners
+static bool rasterize_heightmap(rcContext *context, rcHeightfield &solid, const navigation_heightmap_t *terrain, const rcConfig *cfg)
+{
+	const int w = solid.width;
+	const int h = solid.height;
+	const float cs = solid.cs;
+	const float ich = 1.f / solid.ch;
+	const float span_range = solid.bmax[1] - solid.bmin[1];
+	const float walkable_threshold = cosf(cfg->walkableSlopeAngle / 180.f * RC_PI);
+
+	// sample the heightmap once at every column corner so each tile only reads the window it covers
+	std::vector<float> corners((w+1) * (h+1));
+	for (int z = 0; z <= h; z++) {
+		for (int x = 0; x <= w; x++) {
+			corners[x + z * (w+1)] = sample_heightmap(terrain, solid.bmin[0] + x * cs, solid.bmin[2] + z * cs);
+		}
+	}
+
+	for (int z = 0; z < h; z++) {
+		for (int x = 0; x < w; x++) {
+			const glm::vec2 center = { solid.bmin[0] + (x + 0.5f) * cs, solid.bmin[2] + (z + 0.5f) * cs };
+			if (!geom::point_in_rectangle(center, terrain->area)) { continue; }
+
+			const float h00 = corners[x + z * (w+1)];
+			const float h10 = corners[(x+1) + z * (w+1)];
+			const float h01 = corners[x + (z+1) * (w+1)];
+			const float h11 = corners[(x+1) + (z+1) * (w+1)];
+
+			const float span_min = rcMin(rcMin(h00, h10), rcMin(h01, h11)) - solid.bmin[1];
+			const float span_max = rcMax(rcMax(h00, h10), rcMax(h01, h11)) - solid.bmin[1];
+			// column is outside the vertical range of the heightfield
+			if (span_max < 0.f || span_min > span_range) { continue; }
+
+			const int smin = rcClamp(int(floorf(span_min * ich)), 0, RC_SPAN_MAX_HEIGHT);
+			const int smax = rcClamp(int(ceilf(span_max * ich)), smin+1, RC_SPAN_MAX_HEIGHT);
+
+			// same slope test as rcMarkWalkableTriangles but with the column gradient
+			const float dx = 0.5f * ((h10 + h11) - (h00 + h01));
+			const float dz = 0.5f * ((h01 + h11) - (h00 + h10));
+			const float normal_y = cs / sqrtf(dx*dx + cs*cs + dz*dz);
+			const uint8_t area = (normal_y > walkable_threshold) ? RC_WALKABLE_AREA : RC_NULL_AREA;
+
+			if (!rcAddSpan(context, solid, x, z, uint16_t(smin), uint16_t(smax), area, cfg->walkableClimb)) {
+				return false;
+			}
+		}
+	}
+
+	return true;
+}
+
+static void mark_obstacles(rcContext *context, rcCompactHeightfield &chf, const std::vector<navigation_obstacle_t> *obstacles, const float *bmin, const float *bmax)
+{
+	for (const auto &obstacle : *obstacles) {
+		float obstacle_min[3], obstacle_max[3];
+		obstacle_bounds(obstacle, obstacle_min, obstacle_max);
+		// only obstacles that overlap the tile and its border
+		if (obstacle_min[0] > bmax[0] || obstacle_max[0] < bmin[0]) { continue; }
+		if (obstacle_min[2] > bmax[2] || obstacle_max[2] < bmin[2]) { continue; }
+
+		switch (obstacle.shape) {
+		case navigation_obstacle_shape::CYLINDER:
+			rcMarkCylinderArea(context, glm::value_ptr(obstacle.position), obstacle.extents.x, obstacle.extents.y, RC_NULL_AREA, chf);
+			break;
+		case navigation_obstacle_shape::BOX:
+			rcMarkBoxArea(context, obstacle_min, obstacle_max, RC_NULL_AREA, chf);
+			break;
+		case navigation_obstacle_shape::ORIENTED_BOX: {
+			const float c = cosf(obstacle.angle);
+			const float s = sinf(obstacle.angle);
+			const float ex = obstacle.extents.x;
+			const float ez = obstacle.extents.z;
+			// corners in counter clockwise order
+			const float corners[4][2] = { { -ex, -ez }, { -ex, ez }, { ex, ez }, { ex, -ez } };
+			float poly[12];
+			for (int i = 0; i < 4; i++) {
+				poly[i*3] = obstacle.position.x + c * corners[i][0] + s * corners[i][1];
+				poly[i*3+1] = obstacle.position.y;
+				poly[i*3+2] = obstacle.position.z - s * corners[i][0] + c * corners[i][1];
+			}
+			rcMarkConvexPolyArea(context, poly, 4, obstacle_min[1], obstacle_max[1], RC_NULL_AREA, chf);
+			break;
+		}
+		}
+	}
+}
+
+static void obstacle_bounds(const navigation_obstacle_t &obstacle, float *bmin, float *bmax)
+{
+	switch (obstacle.shape) {
+	case navigation_obstacle_shape::CYLINDER:
+		bmin[0] = obstacle.position.x - obstacle.extents.x;
+		bmin[1] = obstacle.position.y;
+		bmin[2] = obstacle.position.z - obstacle.extents.z;
+		bmax[0] = obstacle.position.x + obstacle.extents.x;
+		bmax[1] = obstacle.position.y + obstacle.extents.y;
+		bmax[2] = obstacle.position.z + obstacle.extents.z;
+		break;
+	case navigation_obstacle_shape::BOX:
+		rcVsub(bmin, glm::value_ptr(obstacle.position), glm::value_ptr(obstacle.extents));
+		rcVadd(bmax, glm::value_ptr(obstacle.position), glm::value_ptr(obstacle.extents));
+		break;
+	case navigation_obstacle_shape::ORIENTED_BOX: {
+		// extents of the rotated footprint
+		const float c = fabsf(cosf(obstacle.angle));
+		const float s = fabsf(sinf(obstacle.angle));
+		const float ex = c * obstacle.extents.x + s * obstacle.extents.z;
+		const float ez = s * obstacle.extents.x + c * obstacle.extents.z;
+		bmin[0] = obstacle.position.x - ex;
+		bmin[1] = obstacle.position.y - obstacle.extents.y;
+		bmin[2] = obstacle.position.z - ez;
+		bmax[0] = obstacle.position.x + ex;
+		bmax[1] = obstacle.position.y + obstacle.extents.y;
+		bmax[2] = obstacle.position.z + ez;
+		break;
+	}
+	}
+}
+
+// everything that affects the output of alloc_navdata for this tile
+static uint64_t tile_input_hash(const int tx, const int ty, const float *bmin, const float *bmax, const float *verts, const rcChunkyTriMesh *chunky_mesh, const int *cid, const int ncid, const navigation_heightmap_t *terrain, const std::vector<navigation_obstacle_t> *obstacles, const rcConfig *cfg)
+{
+	fnv_hash_t hash;
+
+	const int version = DT_NAVMESH_VERSION;
+	hash.add(version);
+	hash.add(*cfg);
+	hash.add(AGENT_HEIGHT);
+	hash.add(AGENT_RADIUS);
+	hash.add(AGENT_MAX_CLIMB);
+	hash.add(tx);
+	hash.add(ty);
+	hash.add(bmin, 3 * sizeof(float));
+	hash.add(bmax, 3 * sizeof(float));
+
+	// triangles of the chunks that overlap the tile
+	for (int i = 0; i < ncid; i++) {
+		const rcChunkyTriMeshNode &node = chunky_mesh->nodes[cid[i]];
+		const int *ctris = &chunky_mesh->tris[node.i*3];
+		for (int j = 0; j < node.n*3; j++) {
+			hash.add(&verts[ctris[j]*3], 3 * sizeof(float));
+		}
+	}
+
+	// the heightmap texels under the tile
+	if (terrain && terrain->image) {
+		const Image<float> *image = terrain->image;
+		hash.add(terrain->offset);
+		hash.add(terrain->spacing);
+		hash.add(terrain->amplitude);
+		hash.add(terrain->area);
+		int min_x = rcClamp(int(floorf((bmin[0] - terrain->offset.x) / terrain->spacing)), 0, image->width()-1);
+		int min_y = rcClamp(int(floorf((bmin[2] - terrain->offset.y) / terrain->spacing)), 0, image->height()-1);
+		int max_x = rcClamp(int(ceilf((bmax[0] - terrain->offset.x) / terrain->spacing)) + 1, 0, image->width()-1);
+		int max_y = rcClamp(int(ceilf((bmax[2] - terrain->offset.y) / terrain->spacing)) + 1, 0, image->height()-1);
+		for (int y = min_y; y <= max_y; y++) {
+			for (int x = min_x; x <= max_x; x++) {
+				hash.add(image->sample(x, y, CHANNEL_RED));
+			}
+		}
+	}
+
+	// obstacles are carved out of the tile so they change it as well
+	if (obstacles) {
+		for (const auto &obstacle : *obstacles) {
+			float obstacle_min[3], obstacle_max[3];
+			obstacle_bounds(obstacle, obstacle_min, obstacle_max);
+			if (obstacle_min[0] > bmax[0] || obstacle_max[0] < bmin[0]) { continue; }
+			if (obstacle_min[2] > bmax[2] || obstacle_max[2] < bmin[2]) { continue; }
+			hash.add(obstacle.shape);
+			hash.add(obstacle.position);
+			hash.add(obstacle.extents);
+			hash.add(obstacle.angle);
+		}
+	}
+
+	return hash.value;
+}
+
+static void heightmap_bounds(const navigation_heightmap_t *terrain, float *bmin, float *bmax)
+{
+	const util::Image<float> *image = terrain->image;
+
+	int min_x = floorf((terrain->area.min.x - terrain->offset.x) / terrain->spacing);
+	int min_y = floorf((terrain->area.min.y - terrain->offset.y) / terrain->spacing);
+	int max_x = ceilf((terrain->area.max.x - terrain->offset.x) / terrain->spacing);
+	int max_y = ceilf((terrain->area.max.y - terrain->offset.y) / terrain->spacing);
+	min_x = rcClamp(min_x, 0, image->width()-1);
+	min_y = rcClamp(min_y, 0, image->height()-1);
+	max_x = rcClamp(max_x, 0, image->width()-1);
+	max_y = rcClamp(max_y, 0, image->height()-1);
+
+	float min_height = std::numeric_limits<float>::max();
+	float max_height = -std::numeric_limits<float>::max();
+	for (int y = min_y; y <= max_y; y++) {
+		for (int x = min_x; x <= max_x; x++) {
+			float height = terrain->amplitude * image->sample(x, y, CHANNEL_RED);
+			min_height = rcMin(min_height, height);
+			max_height = rcMax(max_height, height);
+		}
+	}
+
+	bmin[0] = rcMin(bmin[0], terrain->area.min.x);
+	bmin[1] = rcMin(bmin[1], min_height);
+	bmin[2] = rcMin(bmin[2], terrain->area.min.y);
+	bmax[0] = rcMax(bmax[0], terrain->area.max.x);
+	bmax[1] = rcMax(bmax[1], max_height);
+	bmax[2] = rcMax(bmax[2], terrain->area.max.y);
+}
+
+// bilinear height lookup in world space, clamped to the edges of the heightmap
+static float sample_heightmap(const navigation_heightmap_t *terrain, float x, float z)
+{
+	const util::Image<float> *image = terrain->image;
+
+	float u = rcClamp((x - terrain->offset.x) / terrain->spacing, 0.f, float(image->width()-1));
+	float v = rcClamp((z - terrain->offset.y) / terrain->spacing, 0.f, float(image->height()-1));
+
+	int x0 = int(u);
+	int y0 = int(v);
+	int x1 = rcMin(x0 + 1, image->width()-1);
+	int y1 = rcMin(y0 + 1, image->height()-1);
+	float fx = u - x0;
+	float fy = v - y0;
+
+	float h00 = image->sample(x0, y0, CHANNEL_RED);
+	float h10 = image->sample(x1, y0, CHANNEL_RED);
+	float h01 = image->sample(x0, y1, CHANNEL_RED);
+	float h11 = image->sample(x1, y1, CHANNEL_RED);
+
+	float top = h00 + fx * (h10 - h00);
+	float bottom = h01 + fx * (h11 - h01);
+
+	return terrain->amplitude * (top + fy * (bottom - top));
+}
+
 };
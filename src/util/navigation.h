@@ -18,6 +18,39 @@ enum sample_poly_flags {
 	SAMPLE_POLYFLAGS_ALL = 0xffff // All abilities.
 };
 
+// regular grid terrain that is rasterized straight into the voxel heightfield instead of as triangles
+struct navigation_heightmap_t {
+	const Image<float> *image = nullptr;
+	glm::vec2 offset = {}; // world position of the first texel
+	float spacing = 1.f; // world distance between two texels
+	float amplitude = 1.f; // multiply texel value to get world height
+	geom::rectangle_t area = {}; // only this part of the heightmap is walkable
+};
+
+enum class navigation_obstacle_shape : uint8_t {
+	CYLINDER,
+	BOX,
+	ORIENTED_BOX
+};
+
+// temporary obstacle that is carved out of the navmesh tiles it overlaps
+struct navigation_obstacle_t {
+	uint32_t id = 0;
+	navigation_obstacle_shape shape = navigation_obstacle_shape::CYLINDER;
+	glm::vec3 position = {}; // base center for cylinders, center for boxes
+	glm::vec3 extents = {}; // cylinder (radius, height, radius), box half extents
+	float angle = 0.f; // rotation around the Y axis for oriented boxes
+};
+
+// tile table entry of a navmesh blob
+struct navigation_blob_tile_t {
+	int32_t x = 0;
+	int32_t y = 0;
+	uint32_t size = 0;
+	uint32_t padding = 0;
+	uint64_t offset = 0; // aligned position of the tile data in the blob
+};
+
 struct poly_result_t {
 	bool found = false;
 	glm::vec3 position = {};
@@ -35,12 +68,34 @@ public:
 public:
 	bool alloc(const glm::vec3 &origin, float tilewidth, float tileheight, int maxtiles, int maxpolys);
 	void cleanup();
-	bool build(const std::vector<float> &vertices, const std::vector<int> &indices);
+	bool build(const std::vector<float> &vertices, const std::vector<int> &indices, const navigation_heightmap_t *heightmap = nullptr);
 	void load_tilemesh(int x, int y, const std::vector<uint8_t> &data);
+	// built tiles are looked up in and added to this cache
+	void set_tile_cache(const NavigationTileCache *cache) { tile_cache = cache; }
+	// blobs are memory mapped and Detour uses the tiles in place
+	// a blob that is mapped by this navmesh can be saved over, its tiles are mapped again from the new file
+	bool save_blob(const std::string &filepath);
+	bool load_blob(const std::string &filepath, bool resident = true);
+	// for blobs loaded without residency, only keeps the tiles in this area loaded
+	void stream_tiles(const glm::vec2 &min, const glm::vec2 &max);
+public:
+	// obstacles need the input geometry from build() so they only work until cleanup()
+	uint32_t add_cylinder_obstacle(const glm::vec3 &position, float radius, float height);
+	uint32_t add_box_obstacle(const glm::vec3 &min, const glm::vec3 &max);
+	uint32_t add_oriented_box_obstacle(const glm::vec3 &center, const glm::vec3 &half_extents, float angle);
+	bool remove_obstacle(uint32_t id);
+	// rebuilds at most max_tiles dirty tiles, returns true if the navmesh is up to date
+	bool update(uint32_t max_tiles);
 public:	
 	void find_2D_path(const glm::vec2 &startpos, const glm::vec2 &endpos, std::list<glm::vec2> &pathways) const;
 	void find_3D_path(const glm::vec3 &startpos, const glm::vec3 &endpos, std::vector<glm::vec3> &pathways) const;
 	poly_result_t point_on_navmesh(const glm::vec3 &point) const;
+private:
+	// must outlive the navmesh that points into it
+	MappedFile blob;
+	std::string blob_path;
+	const navigation_blob_tile_t *blob_tiles = nullptr;
+	uint32_t blob_tile_count = 0;
 private:
 	std::unique_ptr<dtNavMesh> navmesh;
 	std::unique_ptr<dtNavMeshQuery> navquery;
@@ -54,9 +109,20 @@ private:
 	std::vector<float> verts;
 	std::vector<int> tris;
 	std::unique_ptr<rcChunkyTriMesh> chunky_mesh;
+	navigation_heightmap_t terrain;
+	std::vector<navigation_obstacle_t> obstacles;
+	std::vector<std::pair<int, int>> dirty_tiles;
+	uint32_t obstacle_counter = 0;
+	const NavigationTileCache *tile_cache = nullptr;
 private:
 	void build_all_tiles();
 	void remove_all_tiles();
+	uint32_t add_obstacle(const navigation_obstacle_t &obstacle);
+	void mark_dirty_tiles(const navigation_obstacle_t &obstacle);
+	void rebuild_tile(int x, int y);
+	void reload_blob(const std::string &filepath, std::vector<std::pair<int, int>> &loaded);
+	bool inside_blob(const uint8_t *data) const;
+	void close_blob();
 };
 
 };
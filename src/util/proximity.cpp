@@ -0,0 +1,232 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+
+#include "proximity.h"
+
+namespace util {
+
+void ProximityGrid::init(const glm::vec2 &min, const glm::vec2 &max, float size)
+{
+	clear();
+
+	origin = min;
+	cell_size = size;
+	columns = std::max(1, int(ceilf((max.x - min.x) / cell_size)));
+	rows = std::max(1, int(ceilf((max.y - min.y) / cell_size)));
+	cells.resize(size_t(columns) * rows);
+}
+
+void ProximityGrid::clear()
+{
+	entries.clear();
+	free_entries.clear();
+	cells.clear();
+	watchers.clear();
+	events.clear();
+	max_radius = 0.f;
+	columns = 0;
+	rows = 0;
+}
+
+uint32_t ProximityGrid::insert(const glm::vec2 &position, float radius, uint32_t kind, uint32_t tag)
+{
+	uint32_t handle = 0;
+	if (free_entries.empty()) {
+		handle = entries.size();
+		entries.emplace_back();
+	} else {
+		handle = free_entries.back();
+		free_entries.pop_back();
+	}
+
+	proximity_entry_t &entry = entries[handle];
+	entry.position = position;
+	entry.radius = radius;
+	entry.kind = kind;
+	entry.tag = tag;
+	entry.watched = 0;
+	entry.alive = true;
+	entry.contacts.clear();
+	entry.cell = cell_index(position);
+	cells[entry.cell].push_back(handle);
+
+	max_radius = std::max(max_radius, radius);
+
+	return handle;
+}
+
+void ProximityGrid::remove(uint32_t handle)
+{
+	if (handle >= entries.size() || !entries[handle].alive) { return; }
+
+	watch(handle, 0);
+	unlink(handle);
+
+	proximity_entry_t &entry = entries[handle];
+	entry.alive = false;
+	entry.cell = -1;
+	entry.contacts.clear();
+
+	free_entries.push_back(handle);
+}
+
+void ProximityGrid::move(uint32_t handle, const glm::vec2 &position)
+{
+	proximity_entry_t &entry = entries[handle];
+	entry.position = position;
+
+	int32_t cell = cell_index(position);
+	if (cell != entry.cell) {
+		unlink(handle);
+		entry.cell = cell;
+		cells[cell].push_back(handle);
+	}
+}
+
+void ProximityGrid::watch(uint32_t handle, uint32_t kinds)
+{
+	proximity_entry_t &entry = entries[handle];
+	if (kinds && !entry.watched) {
+		watchers.push_back(handle);
+	} else if (!kinds && entry.watched) {
+		watchers.erase(std::remove(watchers.begin(), watchers.end(), handle), watchers.end());
+		entry.contacts.clear();
+	}
+	entry.watched = kinds;
+}
+
+void ProximityGrid::query_radius(const glm::vec2 &center, float radius, uint32_t kinds, std::vector<uint32_t> &results) const
+{
+	if (cells.empty()) { return; }
+
+	// circles in cells outside the reach can still overlap if they are large
+	const float reach = radius + max_radius;
+	int min_x, min_y, max_x, max_y;
+	cell_coords(center - glm::vec2(reach), min_x, min_y);
+	cell_coords(center + glm::vec2(reach), max_x, max_y);
+
+	for (int y = min_y; y <= max_y; y++) {
+		for (int x = min_x; x <= max_x; x++) {
+			for (uint32_t handle : cells[y * columns + x]) {
+				const proximity_entry_t &entry = entries[handle];
+				if (!(entry.kind & kinds)) { continue; }
+				const float overlap = radius + entry.radius;
+				glm::vec2 offset = entry.position - center;
+				if (glm::dot(offset, offset) < overlap * overlap) {
+					results.push_back(handle);
+				}
+			}
+		}
+	}
+}
+
+// grows square rings of cells around the center until nothing outside them can be closer than the candidates
+void ProximityGrid::query_nearest(const glm::vec2 &center, size_t count, uint32_t kinds, std::vector<uint32_t> &results) const
+{
+	if (cells.empty() || count == 0) { return; }
+
+	std::vector<std::pair<float, uint32_t>> candidates;
+
+	int center_x, center_y;
+	cell_coords(center, center_x, center_y);
+	const int max_ring = std::max(columns, rows);
+	for (int ring = 0; ring <= max_ring; ring++) {
+		for (int y = center_y - ring; y <= center_y + ring; y++) {
+			if (y < 0 || y >= rows) { continue; }
+			// only the border of the ring, the inside was visited already
+			const int step = (y == center_y - ring || y == center_y + ring) ? 1 : 2 * ring;
+			for (int x = center_x - ring; x <= center_x + ring; x += std::max(step, 1)) {
+				if (x < 0 || x >= columns) { continue; }
+				for (uint32_t handle : cells[y * columns + x]) {
+					const proximity_entry_t &entry = entries[handle];
+					if (!(entry.kind & kinds)) { continue; }
+					glm::vec2 offset = entry.position - center;
+					candidates.push_back(std::make_pair(glm::dot(offset, offset), handle));
+				}
+			}
+		}
+		if (candidates.size() >= count) {
+			std::nth_element(candidates.begin(), candidates.begin() + (count - 1), candidates.end());
+			const float bound = float(ring) * cell_size;
+			if (candidates[count - 1].first <= bound * bound) { break; }
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end());
+	const size_t found = std::min(count, candidates.size());
+	for (size_t i = 0; i < found; i++) {
+		results.push_back(candidates[i].second);
+	}
+}
+
+const std::vector<proximity_event_t>& ProximityGrid::update()
+{
+	events.clear();
+
+	std::vector<uint32_t> overlaps;
+	for (uint32_t watcher : watchers) {
+		proximity_entry_t &entry = entries[watcher];
+
+		overlaps.clear();
+		query_radius(entry.position, entry.radius, entry.watched, overlaps);
+		overlaps.erase(std::remove(overlaps.begin(), overlaps.end(), watcher), overlaps.end());
+		std::sort(overlaps.begin(), overlaps.end());
+
+		// both lists are sorted so the difference is one pass
+		auto current = overlaps.begin();
+		auto previous = entry.contacts.begin();
+		while (current != overlaps.end() || previous != entry.contacts.end()) {
+			if (previous == entry.contacts.end() || (current != overlaps.end() && *current < *previous)) {
+				events.push_back({ proximity_event_type::ENTER, watcher, *current });
+				++current;
+			} else if (current == overlaps.end() || *previous < *current) {
+				// removed entries leave as well
+				events.push_back({ proximity_event_type::LEAVE, watcher, *previous });
+				++previous;
+			} else {
+				++current;
+				++previous;
+			}
+		}
+
+		entry.contacts.swap(overlaps);
+	}
+
+	return events;
+}
+
+bool ProximityGrid::touching(uint32_t watcher, uint32_t other) const
+{
+	const std::vector<uint32_t> &contacts = entries[watcher].contacts;
+
+	return std::binary_search(contacts.begin(), contacts.end(), other);
+}
+
+int32_t ProximityGrid::cell_index(const glm::vec2 &position) const
+{
+	int x, y;
+	cell_coords(position, x, y);
+
+	return y * columns + x;
+}
+
+// positions outside the grid go in the border cells
+void ProximityGrid::cell_coords(const glm::vec2 &position, int &x, int &y) const
+{
+	x = glm::clamp(int(floorf((position.x - origin.x) / cell_size)), 0, columns-1);
+	y = glm::clamp(int(floorf((position.y - origin.y) / cell_size)), 0, rows-1);
+}
+
+void ProximityGrid::unlink(uint32_t handle)
+{
+	std::vector<uint32_t> &cell = cells[entries[handle].cell];
+	auto it = std::find(cell.begin(), cell.end(), handle);
+	if (it != cell.end()) {
+		*it = cell.back();
+		cell.pop_back();
+	}
+}
+
+};
@@ -0,0 +1,75 @@
+namespace util {
+
+// what an entry in the proximity grid stands for, used as masks in queries
+enum proximity_kind_t : uint32_t {
+	PROXIMITY_ARMY = 1 << 0,
+	PROXIMITY_SETTLEMENT = 1 << 1,
+	PROXIMITY_LANDMARK = 1 << 2
+};
+
+enum class proximity_event_type {
+	ENTER,
+	LEAVE
+};
+
+struct proximity_event_t {
+	proximity_event_type type;
+	uint32_t watcher;
+	uint32_t other;
+};
+
+// uniform grid of circles on a plane
+// watchers track which other circles overlap them and report the changes as enter and leave events
+class ProximityGrid {
+public:
+	static const uint32_t INVALID_HANDLE = 0xFFFFFFFF;
+public:
+	void init(const glm::vec2 &min, const glm::vec2 &max, float cell_size);
+	void clear();
+public:
+	uint32_t insert(const glm::vec2 &position, float radius, uint32_t kind, uint32_t tag);
+	void remove(uint32_t handle);
+	void move(uint32_t handle, const glm::vec2 &position);
+	// the entry gets events for the kinds in the mask, 0 stops watching
+	void watch(uint32_t handle, uint32_t kinds);
+	uint32_t tag(uint32_t handle) const { return entries[handle].tag; }
+	uint32_t kind(uint32_t handle) const { return entries[handle].kind; }
+	const glm::vec2& position(uint32_t handle) const { return entries[handle].position; }
+	float radius(uint32_t handle) const { return entries[handle].radius; }
+public:
+	// entries whose circle overlaps the query circle
+	void query_radius(const glm::vec2 &center, float radius, uint32_t kinds, std::vector<uint32_t> &results) const;
+	// closest entries by center distance, nearest first
+	void query_nearest(const glm::vec2 &center, size_t count, uint32_t kinds, std::vector<uint32_t> &results) const;
+	// compares the current overlaps of every watcher with the last update
+	const std::vector<proximity_event_t>& update();
+	// overlap of a watcher at the last update
+	bool touching(uint32_t watcher, uint32_t other) const;
+private:
+	struct proximity_entry_t {
+		glm::vec2 position = {};
+		float radius = 0.f;
+		uint32_t kind = 0;
+		uint32_t tag = 0;
+		uint32_t watched = 0; // kinds the entry gets events for
+		int32_t cell = -1;
+		bool alive = false;
+		std::vector<uint32_t> contacts; // sorted overlapping entries of the last update
+	};
+	glm::vec2 origin = {};
+	float cell_size = 1.f;
+	int columns = 0;
+	int rows = 0;
+	float max_radius = 0.f; // how far outside its cell a circle can reach
+	std::vector<proximity_entry_t> entries;
+	std::vector<uint32_t> free_entries;
+	std::vector<std::vector<uint32_t>> cells;
+	std::vector<uint32_t> watchers;
+	std::vector<proximity_event_t> events;
+private:
+	int32_t cell_index(const glm::vec2 &position) const;
+	void cell_coords(const glm::vec2 &position, int &x, int &y) const;
+	void unlink(uint32_t handle);
+};
+
+};
@@ -0,0 +1,160 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <glm/vec3.hpp>
+
+#include "spatialhash.h"
+
+namespace util {
+
+SpatialHash::SpatialHash(float size)
+	: cell_size(size)
+{
+}
+
+// counting sort on the cell hash, the keys and the scatter run in parallel
+void SpatialHash::build(const std::vector<spatial_point_t> &points)
+{
+	const int count = points.size();
+
+	uint32_t buckets = 1;
+	while (buckets < 2 * points.size()) { buckets <<= 1; }
+	cell_starts.assign(buckets + 1, 0);
+	keys.resize(count);
+	sorted.resize(count);
+
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++) {
+		const glm::vec3 &position = points[i].position;
+		keys[i] = hash_cell(floorf(position.x / cell_size), floorf(position.z / cell_size));
+	}
+
+	for (int i = 0; i < count; i++) {
+		cell_starts[keys[i] + 1]++;
+	}
+	for (uint32_t i = 0; i < buckets; i++) {
+		cell_starts[i+1] += cell_starts[i];
+	}
+
+	// the scatter order within a bucket depends on the threads, sorting the buckets after keeps queries deterministic
+	std::vector<uint32_t> cursors(cell_starts.begin(), cell_starts.end() - 1);
+	#pragma omp parallel for
+	for (int i = 0; i < count; i++) {
+		uint32_t slot;
+		#pragma omp atomic capture
+		slot = cursors[keys[i]]++;
+		sorted[slot] = points[i];
+	}
+
+	#pragma omp parallel for schedule(dynamic, 64)
+	for (int i = 0; i < int(buckets); i++) {
+		if (cell_starts[i+1] - cell_starts[i] < 2) { continue; }
+		std::sort(sorted.begin() + cell_starts[i], sorted.begin() + cell_starts[i+1], [](const spatial_point_t &a, const spatial_point_t &b) {
+			return a.id < b.id;
+		});
+	}
+}
+
+void SpatialHash::clear()
+{
+	cell_starts.clear();
+	sorted.clear();
+	keys.clear();
+}
+
+void SpatialHash::query_radius(const glm::vec3 &center, float radius, const spatial_filter_t &filter, std::vector<uint32_t> &results) const
+{
+	if (sorted.empty()) { return; }
+
+	const int32_t min_x = floorf((center.x - radius) / cell_size);
+	const int32_t min_z = floorf((center.z - radius) / cell_size);
+	const int32_t max_x = floorf((center.x + radius) / cell_size);
+	const int32_t max_z = floorf((center.z + radius) / cell_size);
+	const float radius_squared = radius * radius;
+
+	for (int32_t z = min_z; z <= max_z; z++) {
+		for (int32_t x = min_x; x <= max_x; x++) {
+			visit_cell(x, z, [&](const spatial_point_t &point) {
+				if (!accepts(point, filter)) { return; }
+				const float dx = point.position.x - center.x;
+				const float dz = point.position.z - center.z;
+				if (dx * dx + dz * dz <= radius_squared) {
+					results.push_back(point.id);
+				}
+			});
+		}
+	}
+}
+
+// square rings of cells around the center until the candidates are closer than anything outside the rings
+void SpatialHash::query_nearest(const glm::vec3 &center, size_t count, float max_distance, const spatial_filter_t &filter, std::vector<uint32_t> &results) const
+{
+	if (sorted.empty() || count == 0) { return; }
+
+	std::vector<std::pair<float, uint32_t>> candidates;
+	const float max_squared = max_distance * max_distance;
+	const int32_t center_x = floorf(center.x / cell_size);
+	const int32_t center_z = floorf(center.z / cell_size);
+	const int32_t max_ring = int32_t(ceilf(max_distance / cell_size));
+
+	for (int32_t ring = 0; ring <= max_ring; ring++) {
+		for (int32_t z = center_z - ring; z <= center_z + ring; z++) {
+			const bool edge = (z == center_z - ring || z == center_z + ring);
+			const int32_t step = edge ? 1 : std::max(2 * ring, 1);
+			for (int32_t x = center_x - ring; x <= center_x + ring; x += step) {
+				visit_cell(x, z, [&](const spatial_point_t &point) {
+					if (!accepts(point, filter)) { return; }
+					const float dx = point.position.x - center.x;
+					const float dz = point.position.z - center.z;
+					const float distance = dx * dx + dz * dz;
+					if (distance <= max_squared) {
+						candidates.push_back(std::make_pair(distance, point.id));
+					}
+				});
+			}
+		}
+		if (candidates.size() >= count) {
+			std::nth_element(candidates.begin(), candidates.begin() + (count - 1), candidates.end());
+			const float bound = float(ring) * cell_size;
+			if (candidates[count - 1].first <= bound * bound) { break; }
+		}
+	}
+
+	std::sort(candidates.begin(), candidates.end());
+	const size_t found = std::min(count, candidates.size());
+	for (size_t i = 0; i < found; i++) {
+		results.push_back(candidates[i].second);
+	}
+}
+
+uint32_t SpatialHash::hash_cell(int32_t x, int32_t z) const
+{
+	const uint32_t hash = (uint32_t(x) * 73856093u) ^ (uint32_t(z) * 19349663u);
+
+	return hash & (cell_starts.size() - 2);
+}
+
+bool SpatialHash::accepts(const spatial_point_t &point, const spatial_filter_t &filter) const
+{
+	if (point.team >= 32 || !(filter.teams & (1u << point.team))) { return false; }
+	if (filter.unit >= 0 && point.unit != filter.unit) { return false; }
+
+	return int64_t(point.id) != filter.ignore;
+}
+
+template <class F>
+void SpatialHash::visit_cell(int32_t x, int32_t z, F &&visitor) const
+{
+	const uint32_t bucket = hash_cell(x, z);
+	for (uint32_t i = cell_starts[bucket]; i < cell_starts[bucket+1]; i++) {
+		const spatial_point_t &point = sorted[i];
+		if (int32_t(floorf(point.position.x / cell_size)) != x || int32_t(floorf(point.position.z / cell_size)) != z) {
+			continue;
+		}
+		visitor(point);
+	}
+}
+
+};
@@ -0,0 +1,42 @@
+namespace util {
+
+struct spatial_point_t {
+	glm::vec3 position = {};
+	uint32_t id = 0; // what the point stands for, a creature index in battles
+	uint16_t team = 0;
+	uint16_t unit = 0;
+};
+
+// which points a query returns
+struct spatial_filter_t {
+	uint32_t teams = 0xFFFFFFFF; // bit per team, at most 32 teams
+	int32_t unit = -1; // only this unit if not negative
+	int64_t ignore = -1; // id to leave out, usually the asker itself
+};
+
+// points hashed by the grid cell they are in on the horizontal plane, rebuilt from scratch every frame
+// the layout is one array sorted by cell so a query reads a few contiguous runs
+class SpatialHash {
+public:
+	SpatialHash(float cell_size = 8.f);
+	void build(const std::vector<spatial_point_t> &points);
+	void clear();
+	size_t size() const { return sorted.size(); }
+public:
+	void query_radius(const glm::vec3 &center, float radius, const spatial_filter_t &filter, std::vector<uint32_t> &results) const;
+	// the closest points within the maximum distance, nearest first
+	void query_nearest(const glm::vec3 &center, size_t count, float max_distance, const spatial_filter_t &filter, std::vector<uint32_t> &results) const;
+private:
+	float cell_size = 8.f;
+	std::vector<uint32_t> cell_starts;
+	std::vector<spatial_point_t> sorted;
+	std::vector<uint32_t> keys; // scratch for the build
+private:
+	uint32_t hash_cell(int32_t x, int32_t z) const;
+	bool accepts(const spatial_point_t &point, const spatial_filter_t &filter) const;
+	// visits the points in a single cell, skips points of other cells that share its bucket
+	template <class F>
+	void visit_cell(int32_t x, int32_t z, F &&visitor) const;
+};
+
+};
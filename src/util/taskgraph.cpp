@@ -0,0 +1,139 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+
+#include "../extern/aixlog/aixlog.h"
+
+#include "taskgraph.h"
+
+namespace util {
+
+uint32_t TaskGraph::add(const std::string &name, std::function<void()> work, const std::vector<uint32_t> &dependencies, bool main_thread)
+{
+	const uint32_t id = tasks.size();
+
+	task_t task;
+	task.name = name;
+	task.work = work;
+	task.main_thread = main_thread;
+	for (const auto &dependency : dependencies) {
+		if (dependency >= id) {
+			LOG(ERROR, "Util") << "task " + name + " depends on a task that is not in the graph yet";
+			continue;
+		}
+		tasks[dependency].dependents.push_back(id);
+		task.dependencies++;
+	}
+
+	tasks.push_back(task);
+
+	return id;
+}
+
+void TaskGraph::run(std::function<void(float progress, const std::string &stage)> progress)
+{
+	const uint32_t total = tasks.size();
+	if (total == 0) { return; }
+
+	std::mutex mutex;
+	std::condition_variable signal;
+	std::deque<uint32_t> worker_queue;
+	std::deque<uint32_t> main_queue;
+	std::vector<uint32_t> waiting(total);
+	std::vector<uint32_t> finished; // in the order they were done
+	finished.reserve(total);
+
+	uint32_t worker_tasks = 0;
+	for (uint32_t i = 0; i < total; i++) {
+		waiting[i] = tasks[i].dependencies;
+		if (!tasks[i].main_thread) { worker_tasks++; }
+		if (waiting[i] == 0) {
+			if (tasks[i].main_thread) {
+				main_queue.push_back(i);
+			} else {
+				worker_queue.push_back(i);
+			}
+		}
+	}
+
+	// has to be called with the mutex locked
+	auto complete = [&](uint32_t id) {
+		for (const auto &dependent : tasks[id].dependents) {
+			if (--waiting[dependent] == 0) {
+				if (tasks[dependent].main_thread) {
+					main_queue.push_back(dependent);
+				} else {
+					worker_queue.push_back(dependent);
+				}
+			}
+		}
+		finished.push_back(id);
+		signal.notify_all();
+	};
+
+	// no more workers than stages that can use them, the stages themselves are free to use OpenMP
+	uint32_t worker_count = std::min(worker_tasks, std::max(1u, std::thread::hardware_concurrency()));
+	std::vector<std::thread> workers;
+	for (uint32_t i = 0; i < worker_count; i++) {
+		workers.push_back(std::thread([&]() {
+			while (true) {
+				std::unique_lock<std::mutex> lock(mutex);
+				signal.wait(lock, [&]() { return !worker_queue.empty() || finished.size() == total; });
+				if (worker_queue.empty()) { return; }
+				const uint32_t id = worker_queue.front();
+				worker_queue.pop_front();
+				lock.unlock();
+
+				tasks[id].work();
+
+				lock.lock();
+				complete(id);
+			}
+		}));
+	}
+
+	// the calling thread runs its own stages and reports the progress
+	uint32_t reported = 0;
+	while (true) {
+		std::unique_lock<std::mutex> lock(mutex);
+		signal.wait(lock, [&]() { return !main_queue.empty() || finished.size() > reported; });
+
+		std::vector<uint32_t> done(finished.begin() + reported, finished.end());
+		uint32_t id = INVALID_TASK;
+		if (!main_queue.empty()) {
+			id = main_queue.front();
+			main_queue.pop_front();
+		}
+		lock.unlock();
+
+		for (const auto &stage : done) {
+			reported++;
+			if (progress) {
+				progress(float(reported) / float(total), tasks[stage].name);
+			}
+		}
+		if (reported == total) { break; }
+
+		if (id != INVALID_TASK) {
+			tasks[id].work();
+			lock.lock();
+			complete(id);
+		}
+	}
+
+	for (auto &worker : workers) {
+		worker.join();
+	}
+}
+
+void TaskGraph::clear()
+{
+	tasks.clear();
+}
+
+};
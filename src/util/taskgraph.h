@@ -0,0 +1,26 @@
+namespace util {
+
+// a job split in stages, every stage starts as soon as the stages it depends on are done
+// stages that touch OpenGL have to run on the thread that calls run()
+class TaskGraph {
+public:
+	static const uint32_t INVALID_TASK = 0xFFFFFFFF;
+public:
+	// dependencies have to be added before the stages that depend on them so the graph can't have cycles
+	uint32_t add(const std::string &name, std::function<void()> work, const std::vector<uint32_t> &dependencies = {}, bool main_thread = false);
+	// blocks until every stage is done, progress is reported on the calling thread after each stage
+	void run(std::function<void(float progress, const std::string &stage)> progress = nullptr);
+	void clear();
+	size_t size() const { return tasks.size(); }
+private:
+	struct task_t {
+		std::string name;
+		std::function<void()> work;
+		std::vector<uint32_t> dependents;
+		uint32_t dependencies = 0;
+		bool main_thread = false;
+	};
+	std::vector<task_t> tasks;
+};
+
+};